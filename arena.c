@@ -0,0 +1,229 @@
+#include <stdio.h>     // fprintf
+#include <stdlib.h>    // malloc, free, exit
+#include <string.h>    // memset
+#include <stdbool.h>   // true, false
+#include <pthread.h>   // mutexes
+#include <sys/mman.h>  // mmap, munmap, madvise
+
+#include "arena.h"
+
+// size of a normal page, regions are rounded up to it
+#define ARENA_PAGE  4096
+
+// a mapped region, handed out whole to one buffer at a time
+typedef struct arenaRegion_s {
+    uint8_t *base;                // start of the mapping
+    size_t capacity;              // length of the mapping
+    bool used;                    // handed out right now
+    bool fresh;                   // never handed out, still zero from mmap
+    struct arenaRegion_s *next;
+} arenaRegion_t;
+
+// every region of the run, the reader and writer threads of a batch
+// allocate while the filter stage does, so the list is guarded by a lock
+static struct {
+    pthread_mutex_t lock;
+    arenaRegion_t *regions;
+    uint32_t kept;                // regions that are released but still mapped
+} arena = { PTHREAD_MUTEX_INITIALIZER, NULL, 0 };
+
+/*!
+ ******************************************************************************
+ * Function Name: arenaMap                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Maps a new region. Large regions are aligned to a huge page by mapping a  *
+ *  huge page more and unmapping the ends, and are marked for transparent     *
+ *  huge pages so the kernel can back them with 2MB pages instead of 512      *
+ *  small ones. Where the kernel supports it the pages are faulted in with    *
+ *  one call here, instead of one fault per page on first touch               *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  size_t size                                                               *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the new region, NULL when mmap failed                                     *
+ ******************************************************************************
+!*/
+static arenaRegion_t *
+arenaMap(size_t size)
+{
+    arenaRegion_t *region = malloc(sizeof(arenaRegion_t));
+    bool huge             = size >= ARENA_HUGE_PAGE;
+    size_t align          = huge ? ARENA_HUGE_PAGE : ARENA_PAGE;
+    size_t capacity       = (size + align - 1) / align * align;
+    size_t length         = huge ? capacity + ARENA_HUGE_PAGE : capacity;
+    uint8_t *map;
+
+    if (region == NULL)
+        return NULL;
+
+    map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        free(region);
+        return NULL;
+    }
+
+    region->base = map;
+    if (huge) {
+        size_t head = (ARENA_HUGE_PAGE - (uintptr_t)map % ARENA_HUGE_PAGE) % ARENA_HUGE_PAGE;
+
+        if (head) munmap(map, head);
+        if (length - head - capacity) munmap(map + head + capacity, length - head - capacity);
+        region->base = map + head;
+
+#ifdef MADV_HUGEPAGE
+        madvise(region->base, capacity, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_POPULATE_WRITE
+        madvise(region->base, capacity, MADV_POPULATE_WRITE);
+#endif
+    }
+
+    region->capacity = capacity;
+    region->used     = false;
+    region->fresh    = true;
+    region->next     = arena.regions;
+    arena.regions    = region;
+    return region;
+}
+
+// unmaps a released region and drops it from the list
+static void
+arenaUnmap(arenaRegion_t *region)
+{
+    for (arenaRegion_t **link = &arena.regions; *link != NULL; link = &(*link)->next) {
+        if (*link == region) {
+            *link = region->next;
+            break;
+        }
+    }
+
+    munmap(region->base, region->capacity);
+    free(region);
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: arenaTake                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Hands out the smallest released region that fits, as long as it isn't     *
+ *  more than twice the size asked for so a small scratch buffer doesn't hold *
+ *  on to the region of a whole image. Maps a new region otherwise            *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  size_t size                                                               *
+ *  bool zero                                                                 *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the start of the region                                                   *
+ ******************************************************************************
+!*/
+static void *
+arenaTake(size_t size, bool zero)
+{
+    arenaRegion_t *best = NULL;
+
+    if (size == 0) size = 1;
+
+    pthread_mutex_lock(&arena.lock);
+    for (arenaRegion_t *region = arena.regions; region != NULL; region = region->next) {
+        if (region->used || region->capacity < size || region->capacity > 2 * size + ARENA_HUGE_PAGE)
+            continue;
+        if (best == NULL || region->capacity < best->capacity)
+            best = region;
+    }
+
+    if (best != NULL) {
+        arena.kept--;
+    } else if ((best = arenaMap(size)) == NULL) {
+        fprintf(stderr, "arena memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    best->used = true;
+    pthread_mutex_unlock(&arena.lock);
+
+    // a region that was used before has to be cleared, a fresh one is zero
+    if (zero && !best->fresh)
+        memset(best->base, 0, size);
+    best->fresh = false;
+
+    return best->base;
+}
+
+void *
+arenaAlloc(size_t size)
+{
+    return arenaTake(size, false);
+}
+
+void *
+arenaCalloc(size_t size)
+{
+    return arenaTake(size, true);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: arenaFree                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Marks the region holding ptr as released. It stays mapped, so the next    *
+ *  buffer of about the same size gets pages that are already faulted in.     *
+ *  When more than ARENA_KEEP regions are released the smallest one is        *
+ *  unmapped, those are the cheapest to map again                             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  void *ptr                                                                 *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+arenaFree(void *ptr)
+{
+    uint8_t *mem = ptr;
+
+    if (mem == NULL)
+        return;
+
+    pthread_mutex_lock(&arena.lock);
+    for (arenaRegion_t *region = arena.regions; region != NULL; region = region->next) {
+        if (region->used && mem >= region->base && mem < region->base + region->capacity) {
+            region->used = false;
+            arena.kept++;
+            break;
+        }
+    }
+
+    while (arena.kept > ARENA_KEEP) {
+        arenaRegion_t *smallest = NULL;
+
+        for (arenaRegion_t *region = arena.regions; region != NULL; region = region->next)
+            if (!region->used && (smallest == NULL || region->capacity < smallest->capacity))
+                smallest = region;
+
+        arenaUnmap(smallest);
+        arena.kept--;
+    }
+    pthread_mutex_unlock(&arena.lock);
+    return;
+}
+
+void
+arenaTrim(void)
+{
+    pthread_mutex_lock(&arena.lock);
+    for (arenaRegion_t *region = arena.regions, *next; region != NULL; region = next) {
+        next = region->next;
+        if (!region->used)
+            arenaUnmap(region);
+    }
+    arena.kept = 0;
+    pthread_mutex_unlock(&arena.lock);
+    return;
+}
@@ -0,0 +1,39 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // int typedefs
+
+// alignment of every buffer, a cache line and the widest vector load
+#define ARENA_ALIGN      64
+
+// regions of at least this size are aligned to and backed by huge pages
+#define ARENA_HUGE_PAGE  (2 << 20)
+
+// number of released regions kept for reuse, the smallest ones beyond that
+// are unmapped
+#define ARENA_KEEP       16
+
+// hands out a buffer of at least size bytes aligned to ARENA_ALIGN, reusing
+// a released region when one fits. Exits when there is no memory left
+void *arenaAlloc(size_t size);
+
+// the same, but zeroed
+void *arenaCalloc(size_t size);
+
+// gives a buffer back for reuse, ptr may point anywhere inside it. NULL is
+// ignored
+void arenaFree(void *ptr);
+
+// unmaps every released region
+void arenaTrim(void);
+
+// bytes to put in front of a prefix of prefix bytes so what follows it
+// starts on an ARENA_ALIGN boundary
+static inline size_t
+arenaPad(size_t prefix)
+{
+    return (ARENA_ALIGN - prefix % ARENA_ALIGN) % ARENA_ALIGN;
+}
+
+#endif//_ARENA_H_
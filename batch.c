@@ -0,0 +1,644 @@
+#include <dirent.h>    // opendir, readdir, closedir
+#include <errno.h>     // errno, EEXIST, EINTR
+#include <pthread.h>   // pthread_create, pthread_join, mutexes and conditions
+#include <strings.h>   // strcasecmp
+#include <time.h>      // clock_gettime
+
+#include "batch.h"
+
+// bounded blocking queue of slots, NULL is pushed to mark the end
+typedef struct batchQueue_s {
+    batchSlot_t *item[BATCH_SLOTS + 1];
+    uint32_t head, count;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} batchQueue_t;
+
+// everything the stages share
+typedef struct batch_s {
+    const char *source;        // directory or "-" for stdin
+    const char *outDir;        // directory the results are written to
+    enum bmpCompression_e compress; // compression of the results
+    bool histogram;            // write the histogram of every result next to it
+    batchQueue_t empty;        // slots ready to be filled
+    batchQueue_t loaded;       // slots holding an image to filter
+    batchQueue_t filtered;     // slots holding an image to write
+    uint32_t images;           // number of images written
+    uint32_t failures;         // number of images that failed
+    statsSink_t *sink;         // where the stats of every image go, NULL for none
+} batch_t;
+
+static void
+queueInit(batchQueue_t *queue)
+{
+    queue->head  = 0;
+    queue->count = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+}
+
+static void
+queueDestroy(batchQueue_t *queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+}
+
+static void
+queuePush(batchQueue_t *queue, batchSlot_t *slot)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == BATCH_SLOTS + 1)
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    queue->item[(queue->head + queue->count++) % (BATCH_SLOTS + 1)] = slot;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static batchSlot_t *
+queuePop(batchQueue_t *queue)
+{
+    batchSlot_t *slot;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    slot = queue->item[queue->head];
+    queue->head = (queue->head + 1) % (BATCH_SLOTS + 1);
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return slot;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: decodeSlot                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Decodes the RLE pixels of the file in the slot's buffer into the spare    *
+ *  buffer behind a copy of the headers and the color table, fixes up the     *
+ *  headers for the uncompressed image and swaps the two buffers. The spare   *
+ *  buffer only grows, like the buffer itself                                 *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  batchSlot_t *slot                                                         *
+ *  size_t done                                                               *
+ *                                                                            *
+ * Return:                                                                    *
+ *  false when the image is broken or not supported                           *
+ ******************************************************************************
+!*/
+static bool
+decodeSlot(batchSlot_t *slot, size_t done)
+{
+    bmpFileHeader_t *bmpFH = &slot->bmpFH;
+    bmpInfoHeader_t *bmpIH = &slot->bmpIH;
+    size_t pad             = arenaPad(bmpFH->OffBits);
+    rleDecoder_t dec;
+    uint8_t *swap, *file;
+    size_t length;
+    FILE *fp;
+    bool decoded;
+
+    if (!bmpRleValid(bmpIH)) {
+        fprintf(stderr, "unsupported RLE bitmap in \"%s\"\n", slot->inName);
+        return false;
+    }
+
+    bmpIH->Compression = compressionRgb;
+    bmpIH->SizeImage   = 0;
+    bmpIH->SizeImage   = bmpImageSize(bmpIH);
+    bmpFH->Size        = bmpFH->OffBits + bmpIH->SizeImage;
+    length             = pad + bmpFH->OffBits + bmpIH->SizeImage;
+
+    if (length > slot->spareCapacity) {
+        arenaFree(slot->spare);
+        slot->spareCapacity = length;
+        slot->spare         = arenaAlloc(slot->spareCapacity);
+    }
+    file = slot->spare + pad;
+
+    fp = (done > bmpFH->OffBits) ? fmemopen(slot->file + bmpFH->OffBits, done - bmpFH->OffBits, "rb") : NULL;
+    if (fp == NULL) {
+        fprintf(stderr, "error reading image data of \"%s\"\n", slot->inName);
+        return false;
+    }
+    rleDecoderInit(&dec, fp, (uint32_t)bmpIH->Width, bmpIH->BitCount);
+    decoded = rleDecodeRows(&dec, file + bmpFH->OffBits, (uint32_t)bmpIH->Height, bmpRowSize(bmpIH));
+    fclose(fp);
+    if (!decoded) {
+        fprintf(stderr, "error decoding RLE image data of \"%s\"\n", slot->inName);
+        return false;
+    }
+
+    memcpy(file, bmpFH, sizeof(bmpFileHeader_t));
+    memcpy(file + sizeof(bmpFileHeader_t), bmpIH, sizeof(bmpInfoHeader_t));
+    memcpy(
+        file + sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t),
+        slot->file + sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t),
+        bmpFH->OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t));
+
+    swap                = slot->buffer;
+    slot->buffer        = slot->spare;
+    slot->spare         = swap;
+    slot->file          = file;
+    length              = slot->capacity;
+    slot->capacity      = slot->spareCapacity;
+    slot->spareCapacity = length;
+    slot->length        = (size_t)bmpFH->OffBits + bmpIH->SizeImage;
+    return true;
+}
+
+uint8_t *
+reserveSlot(batchSlot_t *slot, const bmpFileHeader_t *peek, size_t size)
+{
+    size_t pad = (peek != NULL) ? arenaPad(peek->OffBits) : 0;
+
+    if (pad + size > slot->capacity) {
+        arenaFree(slot->buffer);
+        slot->capacity = pad + size;
+        slot->buffer   = arenaAlloc(slot->capacity);
+    }
+    slot->file = slot->buffer + pad;
+    return slot->file;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: parseSlot                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Checks the headers of the file in the slot's buffer. RLE pixels are       *
+ *  decoded from the buffer into the spare buffer, which then takes its place *
+ *  with headers that describe the uncompressed image. Errors are reported    *
+ *  and leave the slot marked as failed. Adds the header stage to the stats   *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  batchSlot_t *slot                                                         *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true when the image can be filtered                                       *
+ ******************************************************************************
+!*/
+bool
+parseSlot(batchSlot_t *slot)
+{
+    size_t done = slot->length; // bytes of the file
+    uint32_t rows;              // number of scanlines
+    double start;               // start of the stage being timed
+
+    slot->failed = true;
+    if (done < sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t)) {
+        fprintf(stderr, "error reading \"%s\"\n", slot->inName);
+        return false;
+    }
+
+    start = statsNow();
+    memcpy(&slot->bmpFH, slot->file, sizeof(bmpFileHeader_t));
+    memcpy(&slot->bmpIH, slot->file + sizeof(bmpFileHeader_t), sizeof(bmpInfoHeader_t));
+
+    // verify that this is a bmp file by checking the bitmap ID
+    if (slot->bmpFH.Type != 0x4D42) {
+        fprintf(stderr, "bitmap ID check error in \"%s\"\n", slot->inName);
+        return false;
+    }
+
+    if (slot->bmpFH.OffBits < sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t) ||
+        slot->bmpFH.OffBits > done) {
+        fprintf(stderr, "bitmap data offset error in \"%s\"\n", slot->inName);
+        return false;
+    }
+
+    if ((slot->bmpIH.Compression == compressionRle8 || slot->bmpIH.Compression == compressionRle4) &&
+        !decodeSlot(slot, done))
+        return false;
+    done = slot->length;
+
+    // the masks and the palette follow the info header
+    if (!parseFormat(
+            &slot->bmpIH, slot->file + sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t),
+            slot->bmpFH.OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t), &slot->format)) {
+        fprintf(stderr, "unsupported bitmap format in \"%s\"\n", slot->inName);
+        return false;
+    }
+
+    // make sure the whole pixel array is present in the file
+    rows = (slot->bmpIH.Height < 0) ? -(uint32_t)slot->bmpIH.Height : (uint32_t)slot->bmpIH.Height;
+    slot->bmpIH.SizeImage = bmpImageSize(&slot->bmpIH);
+    if ((uint64_t)slot->bmpFH.OffBits + (uint64_t)bmpRowSize(&slot->bmpIH) * rows > done) {
+        fprintf(stderr, "error reading image data of \"%s\"\n", slot->inName);
+        return false;
+    }
+
+    slot->stats.width    = slot->bmpIH.Width;
+    slot->stats.height   = rows;
+    slot->stats.bitCount = slot->bmpIH.BitCount;
+    statsStage(&slot->stats, "header", start, sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t));
+
+    slot->failed = false;
+    return true;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: readSlot                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Reads a whole .bmp file into the slot's buffer with a single read and     *
+ *  checks it with parseSlot. The file header is peeked at first so the file  *
+ *  can be placed in the buffer with its pixels on an ARENA_ALIGN boundary.   *
+ *  Errors are reported and mark the slot as failed so a broken file doesn't  *
+ *  stop the rest of the batch. Starts the stats of the image with the open,  *
+ *  read and header stages                                                    *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  batchSlot_t *slot                                                         *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true when the image can be filtered                                       *
+ ******************************************************************************
+!*/
+bool
+readSlot(batchSlot_t *slot)
+{
+    struct stat inStat;   // size of the input file
+    bmpFileHeader_t peek; // file header read ahead for the pixel offset
+    bool peeked;          // the file is long enough for a file header
+    size_t done = 0;      // bytes read so far
+    double start;         // start of the stage being timed
+    int fd;
+
+    slot->failed = true;
+    slot->length = 0;
+    slot->stats  = (bmpStats_t){ 0 };
+
+    start = statsNow();
+    fd    = open(slot->inName, O_RDONLY);
+    if (fd < 0 || fstat(fd, &inStat) != 0) {
+        fprintf(stderr, "Failed opening file \"%s\"\n", slot->inName);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    statsStage(&slot->stats, "open", start, 0);
+
+    // grow the buffer only when this image is bigger than any before it
+    start  = statsNow();
+    peeked = pread(fd, &peek, sizeof(bmpFileHeader_t), 0) == sizeof(bmpFileHeader_t);
+    reserveSlot(slot, peeked ? &peek : NULL, inStat.st_size);
+
+    while (done < (size_t)inStat.st_size) {
+        ssize_t got = read(fd, slot->file + done, inStat.st_size - done);
+
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        done += got;
+    }
+    close(fd);
+    slot->length = done;
+    statsStage(&slot->stats, "read", start, done);
+
+    return parseSlot(slot);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: writeSlot                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Writes the slot's buffer to its output file and times it as the write     *
+ *  stage. With RLE output the image goes through writeBmp instead so the     *
+ *  pixels are compressed, images with a bit count the compression can't      *
+ *  hold are written uncompressed                                             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  batchSlot_t *slot                                                         *
+ *  enum bmpCompression_e compress                                            *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true when the file was written                                            *
+ ******************************************************************************
+!*/
+bool
+writeSlot(batchSlot_t *slot, enum bmpCompression_e compress)
+{
+    double start = statsNow();
+    size_t done  = 0;
+    int fd       = open(slot->outName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        fprintf(stderr, "Failed opening file \"%s\"\n", slot->outName);
+        return false;
+    }
+
+    if (compress != compressionRgb && slot->bmpIH.BitCount == ((compress == compressionRle8) ? 8 : 4)) {
+        bmpInfoHeader_t bmpIH = slot->bmpIH;
+        FILE *fp = fdopen(fd, "wb");
+
+        bmpIH.Compression = compress;
+        done = (fp != NULL) ? writeBmp(fp, &slot->bmpFH, &bmpIH, slot->file + slot->bmpFH.OffBits) : 0;
+        if (fp == NULL) close(fd);
+        if ((fp != NULL && fclose(fp) != 0) || done == 0) {
+            fprintf(stderr, "error writing \"%s\"\n", slot->outName);
+            return false;
+        }
+
+        statsStage(&slot->stats, "write", start, done);
+        return true;
+    }
+
+    while (done < slot->length) {
+        ssize_t put = write(fd, slot->file + done, slot->length - done);
+
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) break;
+        done += put;
+    }
+
+    if (close(fd) != 0 || done != slot->length) {
+        fprintf(stderr, "error writing \"%s\"\n", slot->outName);
+        return false;
+    }
+
+    statsStage(&slot->stats, "write", start, done);
+    return true;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: filterSlot                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Runs the chain on the image in the slot, the palette of indexed images    *
+ *  first. With histogram set the result is counted into the slot's           *
+ *  histogram in the same pass. Times the ops stage, a failure is reported    *
+ *  and marks the slot as failed                                              *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  batchSlot_t *slot                                                         *
+ *  const opChain_t *chain                                                    *
+ *  bool histogram                                                            *
+ *  threadPool_t *pool                                                        *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true when the chain could be applied                                      *
+ ******************************************************************************
+!*/
+bool
+filterSlot(batchSlot_t *slot, const opChain_t *chain, bool histogram, threadPool_t *pool)
+{
+    double start   = statsNow();
+    uint8_t *extra = slot->file + sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t);
+
+    processPalette(extra, &slot->format, chain);
+    if (histogram)
+        histogramInit(
+            &slot->histogram, (uint32_t)slot->bmpIH.Width, slot->stats.height,
+            (slot->format.layout == layoutIndexed) ? extra + slot->format.palette : NULL,
+            slot->format.colors);
+    if (!processImage(
+            slot->file + slot->bmpFH.OffBits, &slot->bmpIH, &slot->format, chain,
+            histogram ? &slot->histogram : NULL, pool)) {
+        fprintf(stderr, "blur, boxblur, sharpen and edges need a 24 or 32 bit image, autolevels and equalize a 16, 24 or 32 bit one, \"%s\"\n", slot->inName);
+        slot->failed = true;
+    }
+    if (chain->count || histogram)
+        statsStage(&slot->stats, "ops", start, slot->bmpIH.SizeImage);
+
+    return !slot->failed;
+}
+
+void
+freeSlot(batchSlot_t *slot)
+{
+    free(slot->inName);
+    free(slot->outName);
+    arenaFree(slot->buffer);
+    arenaFree(slot->spare);
+    memset(slot, 0, sizeof(batchSlot_t));
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: nextName                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Returns the next input path, either the next .bmp in the directory or the *
+ *  next line on stdin. Empty lines are skipped                               *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  batch_t *batch                                                            *
+ *  DIR *dir                                                                  *
+ *                                                                            *
+ * Return:                                                                    *
+ *  a malloced path, NULL when there are no more images                       *
+ ******************************************************************************
+!*/
+static char *
+nextName(batch_t *batch, DIR *dir)
+{
+    if (dir == NULL) {
+        char *line = NULL;
+        size_t size = 0;
+        ssize_t length;
+
+        while ((length = getline(&line, &size, stdin)) != -1) {
+            while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+                line[--length] = '\0';
+            if (length > 0)
+                return line;
+        }
+
+        free(line);
+        return NULL;
+    }
+
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        size_t length = strlen(entry->d_name);
+        char *path;
+
+        if (length < 4 || strcasecmp(entry->d_name + length - 4, ".bmp") != 0)
+            continue;
+
+        path = malloc(strlen(batch->source) + length + 2);
+        if (!path) {
+            fprintf(stderr, "batch memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+        sprintf(path, "%s/%s", batch->source, entry->d_name);
+        return path;
+    }
+
+    return NULL;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: batchReader / batchWriter                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  The first and last stage of the pipeline, they run on their own threads   *
+ *  so reading image k + 1 and writing image k - 1 overlap with filtering     *
+ *  image k                                                                   *
+ ******************************************************************************
+!*/
+static void *
+batchReader(void *arg)
+{
+    batch_t *batch = arg;
+    DIR *dir = NULL;
+    char *name;
+
+    if (strcmp(batch->source, "-") != 0) {
+        dir = opendir(batch->source);
+        if (dir == NULL) {
+            fprintf(stderr, "Failed opening directory \"%s\"\n", batch->source);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while ((name = nextName(batch, dir)) != NULL) {
+        batchSlot_t *slot = queuePop(&batch->empty);
+        const char *base  = strrchr(name, '/');
+
+        base = (base != NULL) ? base + 1 : name;
+
+        free(slot->inName);
+        free(slot->outName);
+        slot->inName  = name;
+        slot->outName = malloc(strlen(batch->outDir) + strlen(base) + 2);
+        if (!slot->outName) {
+            fprintf(stderr, "batch memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+        sprintf(slot->outName, "%s/%s", batch->outDir, base);
+
+        readSlot(slot);
+        queuePush(&batch->loaded, slot);
+    }
+
+    if (dir != NULL) closedir(dir);
+    queuePush(&batch->loaded, NULL);
+    return NULL;
+}
+
+static void *
+batchWriter(void *arg)
+{
+    batch_t *batch = arg;
+    batchSlot_t *slot;
+
+    while ((slot = queuePop(&batch->filtered)) != NULL) {
+        double start = statsNow();
+
+        if (slot->failed || !writeSlot(slot, batch->compress)) {
+            batch->failures++;
+        } else if (batch->histogram && !histogramSave(slot->outName, slot->inName, &slot->histogram)) {
+            fprintf(stderr, "error writing the histogram of \"%s\"\n", slot->outName);
+            batch->failures++;
+        } else {
+            if (batch->histogram)
+                statsStage(&slot->stats, "histogram", start, 0);
+            batch->images++;
+            statsReport(batch->sink, slot->inName, &slot->stats);
+        }
+
+        queuePush(&batch->empty, slot);
+    }
+
+    return NULL;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: batchRun                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Runs the batch as a three stage pipeline over BATCH_SLOTS reusable image  *
+ *  buffers: a reader thread, the filtering on the calling thread (spread     *
+ *  over the pool) and a writer thread. No buffer is allocated or freed per   *
+ *  image once the slots have grown to the largest image. The stats of every  *
+ *  image are reported from the writer thread, the only one using the sink,   *
+ *  which also writes the histograms. Those are counted in the filter stage   *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *source                                                        *
+ *  const char *outDir                                                        *
+ *  enum bmpCompression_e compress                                            *
+ *  const opChain_t *chain                                                    *
+ *  bool histogram                                                            *
+ *  threadPool_t *pool                                                        *
+ *  bool verbose                                                              *
+ *  statsSink_t *sink                                                         *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the number of images that failed                                          *
+ ******************************************************************************
+!*/
+uint32_t
+batchRun(
+    const char *source, const char *outDir, enum bmpCompression_e compress,
+    const opChain_t *chain, bool histogram, threadPool_t *pool, bool verbose,
+    statsSink_t *sink)
+{
+    batchSlot_t slots[BATCH_SLOTS] = { 0 };
+    batch_t batch = { 0 };
+    pthread_t reader, writer;
+    struct timespec start, end;
+    batchSlot_t *slot;
+
+    if (mkdir(outDir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed creating directory \"%s\"\n", outDir);
+        exit(EXIT_FAILURE);
+    }
+
+    batch.source    = source;
+    batch.outDir    = outDir;
+    batch.compress  = compress;
+    batch.histogram = histogram;
+    batch.sink      = sink;
+    queueInit(&batch.empty);
+    queueInit(&batch.loaded);
+    queueInit(&batch.filtered);
+
+    for (uint32_t slotIdx = 0; slotIdx < BATCH_SLOTS; slotIdx++)
+        queuePush(&batch.empty, &slots[slotIdx]);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (pthread_create(&reader, NULL, batchReader, &batch) != 0 ||
+        pthread_create(&writer, NULL, batchWriter, &batch) != 0) {
+        fprintf(stderr, "Failed creating batch threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the filter stage
+    while ((slot = queuePop(&batch.loaded)) != NULL) {
+        if (!slot->failed)
+            filterSlot(slot, chain, histogram, pool);
+        queuePush(&batch.filtered, slot);
+    }
+    queuePush(&batch.filtered, NULL);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (verbose) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        printf("%u images in %.3f s (%.1f images/s), %u failed\n",
+            batch.images, seconds, (seconds > 0) ? batch.images / seconds : 0.0, batch.failures);
+    }
+
+    for (uint32_t slotIdx = 0; slotIdx < BATCH_SLOTS; slotIdx++)
+        freeSlot(&slots[slotIdx]);
+    queueDestroy(&batch.empty);
+    queueDestroy(&batch.loaded);
+    queueDestroy(&batch.filtered);
+
+    return batch.failures;
+}
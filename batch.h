@@ -0,0 +1,62 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "helper.h"
+
+// number of images in flight, one being read, one filtered and one written
+// plus a spare so a slow stage doesn't stall the others right away
+#define BATCH_SLOTS  4
+
+// structure for holding one image while it moves through the pipeline, the
+// buffer is reused for every image that passes through the slot and only
+// grows when an image doesn't fit. The server keeps one per worker
+typedef struct batchSlot_s {
+    char *inName;              // path of the input image
+    char *outName;             // path of the output image
+    uint8_t *buffer;           // arena buffer holding the file
+    size_t capacity;           // allocated size of buffer
+    uint8_t *file;             // the whole file: headers, color table and pixels, placed
+                               // in buffer so the pixels start on an ARENA_ALIGN boundary
+    size_t length;             // bytes of file in use
+    uint8_t *spare;            // RLE images are decoded into this one and swapped with buffer
+    size_t spareCapacity;      // allocated size of spare
+    bmpFileHeader_t bmpFH;     // header of the image
+    bmpInfoHeader_t bmpIH;     // info header of the image
+    pixelFormat_t format;      // how the pixels are stored
+    bool failed;               // set when the image couldn't be read
+    bmpStats_t stats;          // stages of the image, reported once it is written
+    pixelHistogram_t histogram; // the pixels of the result, when the histograms are asked for
+} batchSlot_t;
+
+// processes every .bmp in a directory, or every path listed on stdin when
+// source is "-", and writes the results into outDir under the same name
+// returns the number of images that failed, sink gets the stats of every
+// image unless it is NULL. compress applies to the images whose bit count
+// the RLE variant can hold, the others are written uncompressed. With
+// histogram set the histogram of every result is written next to it
+uint32_t batchRun(
+    const char *source, const char *outDir, enum bmpCompression_e compress,
+    const opChain_t *chain, bool histogram, threadPool_t *pool, bool verbose,
+    statsSink_t *sink);
+
+// makes room in the slot's buffer for a file of size bytes whose file header
+// is peek, NULL when it is unknown, and returns where the file goes
+uint8_t *reserveSlot(batchSlot_t *slot, const bmpFileHeader_t *peek, size_t size);
+
+// checks the length bytes of the file in the slot and decodes RLE pixels,
+// false when the image can't be filtered, the error is reported
+bool parseSlot(batchSlot_t *slot);
+
+// reads the file inName into the slot and checks it with parseSlot
+bool readSlot(batchSlot_t *slot);
+
+// runs the chain on the slot and counts the result when histogram is set
+bool filterSlot(batchSlot_t *slot, const opChain_t *chain, bool histogram, threadPool_t *pool);
+
+// writes the slot to outName, compressed when the bit count allows it
+bool writeSlot(batchSlot_t *slot, enum bmpCompression_e compress);
+
+// frees the names and the buffers of the slot
+void freeSlot(batchSlot_t *slot);
+
+#endif//_BATCH_H_
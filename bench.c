@@ -0,0 +1,358 @@
+#include <time.h>         // clock_gettime
+#include <sys/resource.h> // getrusage
+#include <sys/wait.h>     // waitpid
+
+#include "helper.h"
+
+// the scalar kernels, saved before selectKernels replaces them
+static pixelKernels_t scalarKernels;
+
+// the operations timed on every image, the chain runs them one at a time
+static const struct {
+    const char *name;
+    enum filterID_e op;
+    float arg;
+} benchOps[] = {
+    { "invert",     invert,     0 },
+    { "sepia",      sepia,      0 },
+    { "greyscale",  greyscale,  0 },
+    { "swap",       swap,       0 },
+    { "blur",       blur,       2 },
+    { "boxblur",    boxblur,    8 },
+    { "sharpen",    sharpen,    1 },
+    { "edges",      edges,      0 },
+    { "gamma",      gammaCurve, 2.2f },
+    { "autolevels", autolevels, 0.1f },
+    { "equalize",   equalize,   0 },
+};
+
+// settings of a benchmark run
+typedef struct benchConfig_s {
+    const char *dir;          // directory the synthetic images are written to
+    uint32_t repeat;          // runs per stage, the fastest one is reported
+    uint32_t threads;         // worker threads for the pixel operations
+} benchConfig_t;
+
+static double
+benchNow(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: generateBmp                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Writes a synthetic width x height .bmp of 24 or 32 bits per pixel. The    *
+ *  pixels are gradients with a bit of xorshift noise so no operation can     *
+ *  take a shortcut on flat or repeating data. One scanline is generated at   *
+ *  a time so even 500 megapixel images need next to no memory                *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *fileName                                                      *
+ *  uint32_t width                                                            *
+ *  uint32_t height                                                           *
+ *  uint16_t bitCount                                                         *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+static void
+generateBmp(const char *fileName, uint32_t width, uint32_t height, uint16_t bitCount)
+{
+    bmpFileHeader_t bmpFH = { 0 };
+    bmpInfoHeader_t bmpIH = { 0 };
+    uint32_t bpp          = bitCount / 8;
+    uint32_t noise        = 2463534242u;
+    uint32_t rowSize;
+    uint8_t *row;
+    FILE *fp;
+
+    bmpIH.Size          = sizeof(bmpInfoHeader_t);
+    bmpIH.Width         = width;
+    bmpIH.Height        = height;
+    bmpIH.Planes        = 1;
+    bmpIH.BitCount      = bitCount;
+    bmpIH.XPelsPerMeter = 2835;
+    bmpIH.YPelsPerMeter = 2835;
+    rowSize             = bmpRowSize(&bmpIH);
+    bmpIH.SizeImage     = rowSize * height;
+
+    bmpFH.Type    = 0x4D42;
+    bmpFH.OffBits = sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t);
+    bmpFH.Size    = bmpFH.OffBits + bmpIH.SizeImage;
+
+    fp  = fopen(fileName, "wb");
+    row = calloc(rowSize, 1);
+    if (fp == NULL || row == NULL) {
+        fprintf(stderr, "Failed creating \"%s\"\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+
+    fwrite(&bmpFH, sizeof(bmpFileHeader_t), 1, fp);
+    fwrite(&bmpIH, sizeof(bmpInfoHeader_t), 1, fp);
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint8_t *pixel = row + (size_t)x * bpp;
+
+            noise ^= noise << 13;
+            noise ^= noise >> 17;
+            noise ^= noise << 5;
+
+            pixel[0] = (uint8_t)((x * 255ull) / width + (noise & 15));
+            pixel[1] = (uint8_t)((y * 255ull) / height + ((noise >> 4) & 15));
+            pixel[2] = (uint8_t)(noise >> 24);
+            if (bpp == 4) pixel[3] = 255;
+        }
+        fwrite(row, rowSize, 1, fp);
+    }
+
+    free(row);
+    fclose(fp);
+    return;
+}
+
+// prints the result of a stage, kernels is NULL for load and save
+static void
+printStage(
+    const char *name, const char *kernelName, double seconds,
+    bmpInfoHeader_t *bmpIH, bool last)
+{
+    uint64_t pixels = (uint64_t)bmpIH->Width * (uint64_t)(bmpIH->Height < 0 ? -bmpIH->Height : bmpIH->Height);
+
+    printf("        { \"name\": \"%s\", ", name);
+    if (kernelName != NULL)
+        printf("\"kernels\": \"%s\", ", kernelName);
+    printf(
+        "\"seconds\": %.6f, \"mb_per_s\": %.1f, \"mpixels_per_s\": %.1f }%s\n",
+        seconds, bmpIH->SizeImage / seconds / 1e6, pixels / seconds / 1e6, last ? "" : ",");
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: benchImage                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Generates one synthetic image and times loading it, every operation with  *
+ *  both the scalar and the selected kernels, and saving it. Every stage is   *
+ *  run repeat times and the fastest run is reported, the operations go       *
+ *  through processImage like they do in bmp. Runs in its own process so the  *
+ *  peak resident memory is that of this image alone                          *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const benchConfig_t *config                                               *
+ *  double megapixels                                                         *
+ *  uint16_t bitCount                                                         *
+ *  bool padded                                                               *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+static void
+benchImage(const benchConfig_t *config, double megapixels, uint16_t bitCount, bool padded)
+{
+    pixelKernels_t selected      = kernels;
+    const pixelKernels_t *sets[] = { &scalarKernels, &selected };
+    bmpFileHeader_t bmpFH;
+    bmpInfoHeader_t bmpIH;
+    pixelFormat_t format;
+    char inName[4096], outName[4096];
+    uint32_t width, height;
+    struct rusage usage;
+    uint8_t *bmpData = NULL;
+    double best, start, elapsed;
+    threadPool_t *pool = NULL;
+
+    // 4:3 images, the width is made a multiple of 4 for unpadded scanlines
+    // and odd for padded ones, 32 bit scanlines never need padding
+    width  = (uint32_t)sqrt(megapixels * 1e6 * 4 / 3);
+    height = (uint32_t)(megapixels * 1e6 / width);
+    width  = padded ? (width | 1) : (width & ~3u);
+    if (width < 4) width = padded ? 5 : 4;
+    if (height < 1) height = 1;
+
+    snprintf(inName, sizeof(inName), "%s/bench_%ux%u_%u.bmp", config->dir, width, height, bitCount);
+    snprintf(outName, sizeof(outName), "%s/bench_%ux%u_%u_out.bmp", config->dir, width, height, bitCount);
+    generateBmp(inName, width, height, bitCount);
+
+    // threads don't survive fork, so every image starts its own pool
+    if (config->threads > 1) pool = poolCreate(config->threads);
+
+    best = 1e30;
+    for (uint32_t run = 0; run < config->repeat; run++) {
+        if (bmpData != NULL) freeBmp(&bmpFH, bmpData);
+        start   = benchNow();
+        bmpData = loadBmp(inName, &bmpFH, &bmpIH, NULL);
+        elapsed = benchNow() - start;
+        if (elapsed < best) best = elapsed;
+    }
+
+    parseFormat(
+        &bmpIH, bmpData - bmpFH.OffBits + sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t),
+        bmpFH.OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t), &format);
+
+    printf("    {\n");
+    printf(
+        "      \"megapixels\": %.2f, \"width\": %u, \"height\": %u, \"bits\": %u, "
+        "\"row_padding\": %u, \"bytes\": %u,\n",
+        width * (double)height / 1e6, width, height, bitCount,
+        bmpRowSize(&bmpIH) - width * (bitCount / 8), bmpIH.SizeImage);
+    printf("      \"stages\": [\n");
+    printStage("load", NULL, best, &bmpIH, false);
+
+    for (uint32_t opIdx = 0; opIdx < sizeof(benchOps) / sizeof(benchOps[0]); opIdx++) {
+        opChain_t chain = { 0 };
+
+        addOp(&chain, benchOps[opIdx].op);
+        chain.arg[0][0] = benchOps[opIdx].arg;
+        compileOps(&chain);
+
+        // the scalar kernels only differ from the selected ones on x86, the
+        // convolutions and lookup tables have no vector kernels of their own
+        for (uint32_t setIdx = (selected.chain == scalarKernels.chain || benchOps[opIdx].op >= blur); setIdx < 2; setIdx++) {
+            kernels = *sets[setIdx];
+
+            best = 1e30;
+            for (uint32_t run = 0; run < config->repeat; run++) {
+                start = benchNow();
+                processImage(bmpData, &bmpIH, &format, &chain, NULL, pool);
+                elapsed = benchNow() - start;
+                if (elapsed < best) best = elapsed;
+            }
+            printStage(benchOps[opIdx].name, kernels.name, best, &bmpIH, false);
+        }
+        kernels = selected;
+    }
+
+    // the histogram on its own and counted in the same pass as sepia, the
+    // difference with sepia above is what the counting adds to a pass
+    for (uint32_t fused = 0; fused < 2; fused++) {
+        opChain_t chain = { 0 };
+        pixelHistogram_t histogram;
+
+        if (fused) addOp(&chain, sepia);
+        compileOps(&chain);
+
+        best = 1e30;
+        for (uint32_t run = 0; run < config->repeat; run++) {
+            start = benchNow();
+            histogramInit(&histogram, width, height, NULL, 0);
+            processImage(bmpData, &bmpIH, &format, &chain, &histogram, pool);
+            elapsed = benchNow() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        printStage(fused ? "sepia+histogram" : "histogram", kernels.name, best, &bmpIH, false);
+    }
+
+    best = 1e30;
+    for (uint32_t run = 0; run < config->repeat; run++) {
+        start = benchNow();
+        saveBmp(outName, &bmpFH, &bmpIH, bmpData, NULL);
+        elapsed = benchNow() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    printStage("save", NULL, best, &bmpIH, true);
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("      ],\n");
+    printf("      \"peak_rss_kb\": %ld\n", usage.ru_maxrss);
+    printf("    }");
+
+    poolDestroy(pool);
+    freeBmp(&bmpFH, bmpData);
+    remove(inName);
+    remove(outName);
+    return;
+}
+
+static void
+benchHelp(void)
+{
+    printf("bmpbench [-d directory] [-r repeat] [-j threads] megapixels...\n\n");
+    printf("Times loading, every operation and saving on synthetic 24 and 32 bit images\n");
+    printf("with padded and unpadded scanlines and prints the results as JSON.\n\n");
+    printf("-d directory: where the synthetic images are written (default /tmp).\n");
+    printf("-r repeat: runs per stage, the fastest one is reported (default 3).\n");
+    printf("-j threads: number of threads for the operations, 0 uses every core (default 1).\n");
+    printf("megapixels: image sizes to run, e.g. 1 16 100 (default 1).\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    benchConfig_t config = { "/tmp", 3, 1 };
+    const char *defaults[] = { "1" };
+    const char **sizes;
+    uint32_t sizeCount;
+    bool first = true;
+    int option;
+
+    while ((option = getopt(argc, argv, "hd:r:j:")) != -1) {
+        switch (option) {
+                   case 'd':    config.dir = optarg;
+            break; case 'r':    config.repeat = atoi(optarg);
+            break; case 'j':    config.threads = atoi(optarg);
+            break; case 'h':    benchHelp();
+                                exit(EXIT_SUCCESS);
+            break; default:     benchHelp();
+                                exit(EXIT_FAILURE);
+        }
+    }
+
+    sizes     = (optind < argc) ? (const char **)argv + optind : defaults;
+    sizeCount = (optind < argc) ? (uint32_t)(argc - optind) : 1;
+    if (config.repeat == 0) config.repeat = 1;
+
+    scalarKernels = kernels;
+    selectKernels();
+
+    if (config.threads == 0) config.threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("{\n");
+    printf("  \"kernels\": \"%s\", \"threads\": %u, \"repeat\": %u,\n", kernels.name, config.threads, config.repeat);
+    printf("  \"images\": [\n");
+
+    for (uint32_t sizeIdx = 0; sizeIdx < sizeCount; sizeIdx++) {
+        double megapixels = atof(sizes[sizeIdx]);
+
+        if (megapixels <= 0) {
+            fprintf(stderr, "invalid size \"%s\"\n", sizes[sizeIdx]);
+            exit(EXIT_FAILURE);
+        }
+
+        for (uint16_t bitCount = 24; bitCount <= 32; bitCount += 8) {
+            for (uint32_t padded = 0; padded < ((bitCount == 24) ? 2 : 1); padded++) {
+                pid_t child;
+                int status;
+
+                if (!first) printf(",\n");
+                first = false;
+                fflush(stdout);
+
+                // a child per image so every image gets its own peak memory
+                child = fork();
+                if (child == 0) {
+                    benchImage(&config, megapixels, bitCount, padded);
+                    fflush(stdout);
+                    _exit(EXIT_SUCCESS);
+                }
+                if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    fprintf(stderr, "benchmark of %s megapixels at %u bits failed\n", sizes[sizeIdx], bitCount);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
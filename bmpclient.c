@@ -0,0 +1,331 @@
+#include <stdio.h>        // printf, fprintf, FILE
+#include <stdlib.h>       // malloc, free, exit, qsort
+#include <stdint.h>       // int typedefs
+#include <stdbool.h>      // true, false
+#include <string.h>       // strlen, strrchr
+#include <unistd.h>       // getopt, close, dup
+#include <time.h>         // clock_gettime
+#include <pthread.h>      // pthread_create, pthread_join
+#include <sys/socket.h>   // socket, connect
+#include <sys/un.h>       // sockaddr_un
+
+// settings of a client run
+typedef struct clientConfig_s {
+    const char *socket;       // path of the server's socket
+    const char *ops;          // operation list sent with every job, NULL for the server's
+    const char *compress;     // compression sent with every job, NULL for the server's
+    const char *outDir;       // the server writes the results there, NULL sends them back
+    bool inlined;             // send the bytes of the images instead of their paths
+    char **files;             // the images
+    uint8_t **data;           // their bytes, when inlined
+    size_t *size;
+    uint32_t fileCount;
+    uint32_t jobs;            // jobs in total, every image repeat times
+    uint32_t connections;     // connections sending jobs at the same time
+} clientConfig_t;
+
+// one connection, it sends the jobs id, id + connections, ...
+typedef struct clientConnection_s {
+    const clientConfig_t *config;
+    uint32_t id;
+    double *latency;          // seconds of every job of this connection
+    uint32_t done;            // jobs answered
+    uint32_t failures;        // jobs answered with an error or not at all
+} clientConnection_t;
+
+static double
+clientNow(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static int
+compareSeconds(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+clientHelp(void)
+{
+    printf("bmpclient - sends jobs to bmp --serve and reports their latency\n\n");
+    printf("Usage:\n");
+    printf("bmpclient -s socket [-n repeat] [-c connections] [-i] [-O list] [-C none|rle8|rle4] [-d directory] image...\n");
+    printf("bmpclient -s socket -q\n\n");
+    printf("-s socket: path of the server's socket.\n");
+    printf("-n repeat: send every image repeat times (default 1).\n");
+    printf("-c connections: connections sending jobs at the same time (default 1).\n");
+    printf("-i: send the bytes of the images instead of their paths.\n");
+    printf("-O list: operation list of the jobs, the server's own by default.\n");
+    printf("-C none|rle8|rle4: compression of the results.\n");
+    printf("-d directory: the server writes the results there, otherwise they are sent back and dropped.\n");
+    printf("-q: stop the server.\n\n");
+}
+
+static int
+clientConnect(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: clientReadFile                                              *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Reads a whole image so the inline jobs time the server and not the disk   *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *path                                                          *
+ *  size_t *size                                                              *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the bytes of the file, NULL when it can't be read                         *
+ ******************************************************************************
+!*/
+static uint8_t *
+clientReadFile(const char *path, size_t *size)
+{
+    FILE *fp = fopen(path, "rb");
+    uint8_t *data = NULL;
+    long length;
+
+    if (fp == NULL)
+        return NULL;
+    if (fseek(fp, 0, SEEK_END) == 0 && (length = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0 &&
+        (data = malloc(length)) != NULL && fread(data, 1, length, fp) == (size_t)length) {
+        *size = length;
+    } else {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: clientRun                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Sends the jobs of one connection one after the other and times each one   *
+ *  from the first byte sent to the last byte of the answer                   *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  void *arg                                                                 *
+ *                                                                            *
+ * Return:                                                                    *
+ *  NULL                                                                      *
+ ******************************************************************************
+!*/
+static void *
+clientRun(void *arg)
+{
+    clientConnection_t *conn      = arg;
+    const clientConfig_t *config  = conn->config;
+    int fd                        = clientConnect(config->socket);
+    int outFd                     = (fd >= 0) ? dup(fd) : -1;
+    FILE *in                      = (fd >= 0) ? fdopen(fd, "rb") : NULL;
+    FILE *out                     = (outFd >= 0) ? fdopen(outFd, "wb") : NULL;
+    char line[4096];
+
+    if (in == NULL || out == NULL) {
+        fprintf(stderr, "Failed connecting to \"%s\"\n", config->socket);
+        conn->failures = (config->jobs - conn->id + config->connections - 1) / config->connections;
+        if (in != NULL) fclose(in);
+        if (out != NULL) fclose(out);
+        return NULL;
+    }
+
+    for (uint32_t job = conn->id; job < config->jobs; job += config->connections) {
+        uint32_t file = job % config->fileCount;
+        double start  = clientNow();
+        double seconds;
+        size_t bytes;
+
+        if (config->ops != NULL) fprintf(out, "ops %s\n", config->ops);
+        if (config->compress != NULL) fprintf(out, "compress %s\n", config->compress);
+        if (config->outDir != NULL) {
+            const char *base = strrchr(config->files[file], '/');
+
+            fprintf(out, "out %s/%s\n", config->outDir, (base != NULL) ? base + 1 : config->files[file]);
+        }
+        if (config->inlined) {
+            fprintf(out, "data %zu\n", config->size[file]);
+            fwrite(config->data[file], 1, config->size[file], out);
+        } else {
+            fprintf(out, "in %s\n\n", config->files[file]);
+        }
+        fflush(out);
+
+        if (fgets(line, sizeof(line), in) == NULL) {
+            fprintf(stderr, "the server closed the connection\n");
+            conn->failures++;
+            break;
+        }
+        if (sscanf(line, "ok %lf %zu", &seconds, &bytes) != 2) {
+            fprintf(stderr, "%s: %s", config->files[file], line);
+            conn->failures++;
+            continue;
+        }
+
+        // the result is dropped, only its arrival is timed
+        while (bytes > 0) {
+            size_t got = fread(line, 1, (bytes < sizeof(line)) ? bytes : sizeof(line), in);
+
+            if (got == 0) break;
+            bytes -= got;
+        }
+        if (bytes != 0) {
+            conn->failures++;
+            break;
+        }
+
+        conn->latency[conn->done++] = clientNow() - start;
+    }
+
+    fclose(in);
+    fclose(out);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    clientConfig_t config = { .connections = 1 };
+    uint32_t repeat       = 1;
+    bool quit             = false;
+    clientConnection_t *conns;
+    pthread_t *threads;
+    double *latency;
+    uint32_t done = 0, failures = 0;
+    double start, seconds;
+    int option;
+
+    while ((option = getopt(argc, argv, "hs:n:c:iO:C:d:q")) != -1) {
+        switch (option) {
+                   case 's':    config.socket = optarg;
+            break; case 'n':    repeat = atoi(optarg);
+            break; case 'c':    config.connections = atoi(optarg);
+            break; case 'i':    config.inlined = true;
+            break; case 'O':    config.ops = optarg;
+            break; case 'C':    config.compress = optarg;
+            break; case 'd':    config.outDir = optarg;
+            break; case 'q':    quit = true;
+            break; case 'h':    clientHelp();
+                                exit(EXIT_SUCCESS);
+            break; default:     clientHelp();
+                                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (config.socket == NULL || (optind >= argc && !quit)) {
+        clientHelp();
+        exit(EXIT_FAILURE);
+    }
+
+    if (quit) {
+        int fd = clientConnect(config.socket);
+        char answer[64];
+        ssize_t got;
+
+        if (fd < 0 || write(fd, "quit\n\n", 6) != 6 || (got = read(fd, answer, sizeof(answer))) <= 0) {
+            fprintf(stderr, "Failed stopping the server at \"%s\"\n", config.socket);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+        return EXIT_SUCCESS;
+    }
+
+    if (repeat == 0) repeat = 1;
+    if (config.connections == 0) config.connections = 1;
+    config.files     = argv + optind;
+    config.fileCount = argc - optind;
+    config.jobs      = config.fileCount * repeat;
+    if (config.connections > config.jobs) config.connections = config.jobs;
+
+    if (config.inlined) {
+        config.data = calloc(config.fileCount, sizeof(uint8_t *));
+        config.size = calloc(config.fileCount, sizeof(size_t));
+        if (config.data == NULL || config.size == NULL) {
+            fprintf(stderr, "client memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+        for (uint32_t file = 0; file < config.fileCount; file++) {
+            config.data[file] = clientReadFile(config.files[file], &config.size[file]);
+            if (config.data[file] == NULL) {
+                fprintf(stderr, "Failed reading file \"%s\"\n", config.files[file]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    conns   = calloc(config.connections, sizeof(clientConnection_t));
+    threads = calloc(config.connections, sizeof(pthread_t));
+    latency = malloc(config.jobs * sizeof(double));
+    if (conns == NULL || threads == NULL || latency == NULL) {
+        fprintf(stderr, "client memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = clientNow();
+    for (uint32_t id = 0; id < config.connections; id++) {
+        conns[id].config  = &config;
+        conns[id].id      = id;
+        conns[id].latency = malloc((config.jobs / config.connections + 1) * sizeof(double));
+        if (conns[id].latency == NULL) {
+            fprintf(stderr, "client memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+        if (pthread_create(&threads[id], NULL, clientRun, &conns[id]) != 0) {
+            fprintf(stderr, "Failed creating client threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // gather the latencies of every connection in one array
+    for (uint32_t id = 0; id < config.connections; id++) {
+        pthread_join(threads[id], NULL);
+        memcpy(latency + done, conns[id].latency, conns[id].done * sizeof(double));
+        free(conns[id].latency);
+        done     += conns[id].done;
+        failures += conns[id].failures;
+    }
+    seconds = clientNow() - start;
+
+    qsort(latency, done, sizeof(double), compareSeconds);
+    printf("%u jobs, %u failed in %.3f s (%.1f jobs/s), latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+        done, failures, seconds, (seconds > 0) ? done / seconds : 0.0,
+        done ? latency[(done - 1) * 50 / 100] * 1e3 : 0.0,
+        done ? latency[(done - 1) * 99 / 100] * 1e3 : 0.0,
+        done ? latency[done - 1] * 1e3 : 0.0);
+
+    if (config.inlined) {
+        for (uint32_t file = 0; file < config.fileCount; file++)
+            free(config.data[file]);
+        free(config.data);
+        free(config.size);
+    }
+    free(latency);
+    free(threads);
+    free(conns);
+
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
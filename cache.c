@@ -0,0 +1,451 @@
+#define _GNU_SOURCE          // copy_file_range
+#include <stdio.h>           // snprintf, sscanf
+#include <stdlib.h>          // malloc, realloc, free, qsort
+#include <string.h>          // memcpy, strlen
+#include <errno.h>           // errno, EEXIST, EINTR
+#include <fcntl.h>           // open, openat, O_ flags
+#include <unistd.h>          // read, write, close, unlink, copy_file_range
+#include <dirent.h>          // opendir, readdir, closedir
+#include <limits.h>          // PATH_MAX
+#include <sys/file.h>        // flock
+#include <sys/ioctl.h>       // ioctl
+#include <sys/mman.h>        // mmap, munmap, madvise
+#include <sys/stat.h>        // fstat, mkdir, utimensat
+#include <linux/fs.h>        // FICLONE
+
+#include "cache.h"
+
+#define PRIME1  0x9E3779B185EBCA87ULL
+#define PRIME2  0xC2B2AE3D27D4EB4FULL
+#define PRIME3  0x165667B19E3779F9ULL
+#define PRIME4  0x85EBCA77C2B2AE63ULL
+#define PRIME5  0x27D4EB2F165667C5ULL
+
+// an entry found by the eviction scan
+typedef struct cacheEntry_s {
+    char name[40];
+    struct timespec used;     // last hit or store, the mtime
+    uint64_t bytes;
+} cacheEntry_t;
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+hashRound(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    return rotl64(acc, 31) * PRIME1;
+}
+
+static inline uint64_t
+hashMerge(uint64_t acc, uint64_t lane)
+{
+    acc ^= hashRound(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: cacheHash                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  The 64 bit xxHash: four lanes take 32 bytes per step, so hashing runs at  *
+ *  several GB/s and costs little next to reading the image. It isn't meant   *
+ *  to withstand crafted collisions, only to tell different inputs apart      *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const void *data                                                          *
+ *  size_t size                                                               *
+ *  uint64_t seed                                                             *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the hash                                                                  *
+ ******************************************************************************
+!*/
+uint64_t
+cacheHash(const void *data, size_t size, uint64_t seed)
+{
+    const uint8_t *p   = data;
+    const uint8_t *end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+
+        do {
+            v1 = hashRound(v1, read64(p));
+            v2 = hashRound(v2, read64(p + 8));
+            v3 = hashRound(v3, read64(p + 16));
+            v4 = hashRound(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = hashMerge(h, v1);
+        h = hashMerge(h, v2);
+        h = hashMerge(h, v3);
+        h = hashMerge(h, v4);
+    } else {
+        h = seed + PRIME5;
+    }
+    h += size;
+
+    for (; end - p >= 8; p += 8)
+        h = rotl64(h ^ hashRound(0, read64(p)), 27) * PRIME1 + PRIME4;
+    if (end - p >= 4) {
+        uint32_t v;
+
+        memcpy(&v, p, sizeof(v));
+        h = rotl64(h ^ (v * PRIME1), 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl64(h ^ (*p * PRIME5), 11) * PRIME1;
+
+    // mix the last bits into every bit
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: cacheCopy                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Copies a file, as a reflink where the filesystem can share the blocks     *
+ *  (btrfs, xfs), else with copy_file_range so the kernel copies without the  *
+ *  bytes passing through here, else with read and write                      *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *from                                                          *
+ *  const char *to                                                            *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the bytes copied, -1 when the copy failed                                 *
+ ******************************************************************************
+!*/
+static int64_t
+cacheCopy(const char *from, const char *to)
+{
+    int in = open(from, O_RDONLY);
+    int out;
+    struct stat inStat;
+    off_t done = 0;
+    bool copied;
+
+    if (in < 0 || fstat(in, &inStat) != 0) {
+        if (in >= 0) close(in);
+        return -1;
+    }
+    out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+
+    if (ioctl(out, FICLONE, in) == 0) {
+        done = inStat.st_size;
+    } else {
+        while (done < inStat.st_size) {
+            ssize_t put = copy_file_range(in, NULL, out, NULL, inStat.st_size - done, 0);
+
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) break;
+            done += put;
+        }
+
+        // across filesystems on older kernels, or where it isn't supported
+        if (done < inStat.st_size && lseek(in, done, SEEK_SET) == done && lseek(out, done, SEEK_SET) == done) {
+            uint8_t buffer[1 << 16];
+            ssize_t got;
+
+            while (done < inStat.st_size && (got = read(in, buffer, sizeof(buffer))) != 0) {
+                ssize_t put = 0;
+
+                if (got < 0 && errno == EINTR) continue;
+                if (got < 0) break;
+                while (put < got) {
+                    ssize_t step = write(out, buffer + put, got - put);
+
+                    if (step < 0 && errno == EINTR) continue;
+                    if (step <= 0) break;
+                    put += step;
+                }
+                if (put < got) break;
+                done += got;
+            }
+        }
+    }
+
+    copied = done == inStat.st_size;
+    close(in);
+    if (close(out) != 0) copied = false;
+    return copied ? (int64_t)done : -1;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: cacheLock                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Locks the counters file of the cache and reads it into the counters,      *
+ *  so runs sharing the cache add up their counts and evict one at a time.    *
+ *  Runs on after a failure, the counters then start from 0                   *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  resultCache_t *cache                                                      *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the locked file for cacheUnlock, -1 when it can't be opened               *
+ ******************************************************************************
+!*/
+static int
+cacheLock(resultCache_t *cache)
+{
+    char path[PATH_MAX];
+    char text[256];
+    ssize_t got;
+    int fd;
+
+    cache->counters = (cacheCounters_t){ 0 };
+    snprintf(path, sizeof(path), "%s/counters", cache->dir);
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -1;
+    while (flock(fd, LOCK_EX) != 0 && errno == EINTR)
+        ;
+
+    got = pread(fd, text, sizeof(text) - 1, 0);
+    if (got > 0) {
+        unsigned long long hits = 0, misses = 0, evictions = 0, entries = 0, bytes = 0;
+
+        text[got] = '\0';
+        sscanf(text, "hits %llu\nmisses %llu\nevictions %llu\nentries %llu\nbytes %llu",
+            &hits, &misses, &evictions, &entries, &bytes);
+        cache->counters = (cacheCounters_t){ hits, misses, evictions, entries, bytes };
+    }
+    return fd;
+}
+
+// writes the counters back and releases the lock
+static void
+cacheUnlock(resultCache_t *cache, int fd)
+{
+    char text[256];
+    int length;
+
+    if (fd < 0)
+        return;
+    length = snprintf(text, sizeof(text), "hits %llu\nmisses %llu\nevictions %llu\nentries %llu\nbytes %llu\n",
+        (unsigned long long)cache->counters.hits, (unsigned long long)cache->counters.misses,
+        (unsigned long long)cache->counters.evictions, (unsigned long long)cache->counters.entries,
+        (unsigned long long)cache->counters.bytes);
+    if (pwrite(fd, text, length, 0) != length || ftruncate(fd, length) != 0)
+        fprintf(stderr, "error writing the counters of the cache \"%s\"\n", cache->dir);
+    close(fd);
+    return;
+}
+
+static int
+compareUsed(const void *a, const void *b)
+{
+    const struct timespec *x = &((const cacheEntry_t *)a)->used;
+    const struct timespec *y = &((const cacheEntry_t *)b)->used;
+
+    if (x->tv_sec != y->tv_sec) return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: cacheEvict                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Adds up the entries of the cache and, beyond the capacity, removes the    *
+ *  least recently used ones. A hit touches the mtime of its entry, so the    *
+ *  mtime orders them. Called with the counters locked                        *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  resultCache_t *cache                                                      *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+static void
+cacheEvict(resultCache_t *cache)
+{
+    DIR *dir = opendir(cache->dir);
+    cacheEntry_t *entries = NULL;
+    uint64_t count = 0, capacity = 0, bytes = 0, remaining;
+    struct dirent *ent;
+
+    if (dir == NULL)
+        return;
+
+    // the entries are the 32 hex digits of their key and .bmp
+    while ((ent = readdir(dir)) != NULL) {
+        struct stat entStat;
+
+        if (strlen(ent->d_name) != 36 || strcmp(ent->d_name + 32, ".bmp") != 0 ||
+            fstatat(dirfd(dir), ent->d_name, &entStat, 0) != 0)
+            continue;
+        if (count == capacity) {
+            cacheEntry_t *grown;
+
+            capacity = capacity ? capacity * 2 : 256;
+            grown    = realloc(entries, capacity * sizeof(cacheEntry_t));
+            if (grown == NULL) break;
+            entries = grown;
+        }
+        memcpy(entries[count].name, ent->d_name, 37);
+        entries[count].used  = entStat.st_mtim;
+        entries[count].bytes = entStat.st_size;
+        bytes += entStat.st_size;
+        count++;
+    }
+
+    remaining = count;
+    if (bytes > cache->capacity) {
+        qsort(entries, count, sizeof(cacheEntry_t), compareUsed);
+        for (uint64_t entIdx = 0; entIdx < count && bytes > cache->capacity; entIdx++) {
+            if (unlinkat(dirfd(dir), entries[entIdx].name, 0) != 0)
+                continue;
+            bytes -= entries[entIdx].bytes;
+            remaining--;
+            cache->counters.evictions++;
+        }
+    }
+    cache->counters.entries = remaining;
+    cache->counters.bytes   = bytes;
+
+    free(entries);
+    closedir(dir);
+    return;
+}
+
+bool
+cacheOpen(resultCache_t *cache, const char *dir, uint64_t capacity)
+{
+    *cache = (resultCache_t){ .dir = dir, .capacity = capacity };
+    return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: cacheKey                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  The key is the hash of the input's bytes, seeded with its size, and the   *
+ *  hash of the description seeded with that. The input is mapped and read    *
+ *  once sequentially, so a miss costs one extra pass over the page cache     *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  resultCache_t *cache                                                      *
+ *  const char *input                                                         *
+ *  const char *description                                                   *
+ *                                                                            *
+ * Return:                                                                    *
+ *  false when the input can't be read                                        *
+ ******************************************************************************
+!*/
+bool
+cacheKey(resultCache_t *cache, const char *input, const char *description)
+{
+    int fd = open(input, O_RDONLY);
+    struct stat inStat;
+    uint64_t content, key;
+    void *map = NULL;
+
+    // a pipe or a device has no size to map and may not be read twice
+    if (fd < 0 || fstat(fd, &inStat) != 0 || !S_ISREG(inStat.st_mode)) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    if (inStat.st_size > 0) {
+        map = mmap(NULL, inStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(map, inStat.st_size, MADV_SEQUENTIAL);
+    }
+
+    content = cacheHash(map, inStat.st_size, inStat.st_size);
+    key     = cacheHash(description, strlen(description), content);
+    if (map != NULL) munmap(map, inStat.st_size);
+    close(fd);
+
+    cache->inputBytes = inStat.st_size;
+    snprintf(cache->key, sizeof(cache->key), "%016llx%016llx", (unsigned long long)content, (unsigned long long)key);
+    return true;
+}
+
+bool
+cacheFetch(resultCache_t *cache, const char *output)
+{
+    char path[PATH_MAX];
+    int fd;
+    bool hit;
+
+    snprintf(path, sizeof(path), "%s/%s.bmp", cache->dir, cache->key);
+
+    // touching the entry makes it the most recently used one, a failed copy
+    // of an entry another run just evicted counts as a miss
+    fd  = cacheLock(cache);
+    hit = cacheCopy(path, output) >= 0 && utimensat(AT_FDCWD, path, NULL, 0) == 0;
+    if (hit)
+        cache->counters.hits++;
+    else
+        cache->counters.misses++;
+    cacheUnlock(cache, fd);
+
+    return hit;
+}
+
+bool
+cacheStore(resultCache_t *cache, const char *output)
+{
+    char path[PATH_MAX];
+    char temp[PATH_MAX];
+    struct stat outStat;
+    bool stored;
+    int fd;
+
+    // copied under a name of its own and renamed so no run sees half an
+    // entry. A result larger than the whole cache would evict every entry
+    // and then itself, it is left out and the cache kept as it is
+    snprintf(path, sizeof(path), "%s/%s.bmp", cache->dir, cache->key);
+    snprintf(temp, sizeof(temp), "%s/.%s.%ld.tmp", cache->dir, cache->key, (long)getpid());
+    stored = stat(output, &outStat) == 0;
+    if (stored && (uint64_t)outStat.st_size <= cache->capacity) {
+        stored = cacheCopy(output, temp) >= 0 && rename(temp, path) == 0;
+        if (!stored) unlink(temp);
+    }
+
+    fd = cacheLock(cache);
+    cacheEvict(cache);
+    cacheUnlock(cache, fd);
+
+    return stored;
+}
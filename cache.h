@@ -0,0 +1,50 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // int typedefs
+#include <stdbool.h> // true, false
+
+// longest description of the operations that goes into a key
+#define CACHE_DESCRIPTION  1024
+
+// counters of a cache, kept in its directory so they add up over runs
+typedef struct cacheCounters_s {
+    uint64_t hits;            // results copied from the cache
+    uint64_t misses;          // results that had to be computed
+    uint64_t evictions;       // entries removed to stay under the size cap
+    uint64_t entries;         // entries and their bytes as of the last store
+    uint64_t bytes;
+} cacheCounters_t;
+
+// a directory of results named after the hash of their input and operations
+typedef struct resultCache_s {
+    const char *dir;          // the directory, created when it doesn't exist
+    uint64_t capacity;        // bytes the entries may take, the least recently
+                              // used ones are evicted beyond it
+    char key[33];             // key of the current image in hex, set by cacheKey
+    uint64_t inputBytes;      // size of the current input
+    cacheCounters_t counters; // totals after the last lookup or store
+} resultCache_t;
+
+// the 64 bit xxHash of size bytes
+uint64_t cacheHash(const void *data, size_t size, uint64_t seed);
+
+// opens the cache in dir, creating the directory, false when that fails
+bool cacheOpen(resultCache_t *cache, const char *dir, uint64_t capacity);
+
+// hashes the input file and the description of everything that shapes the
+// result into the key, false when the input can't be read or isn't a
+// regular file
+bool cacheKey(resultCache_t *cache, const char *input, const char *description);
+
+// copies the entry of the key to output and counts a hit, or counts a miss
+// and returns false when there is no entry
+bool cacheFetch(resultCache_t *cache, const char *output);
+
+// copies output into the cache under the key and evicts the least recently
+// used entries beyond the capacity, false when the copy failed. An output
+// larger than the capacity isn't stored
+bool cacheStore(resultCache_t *cache, const char *output);
+
+#endif//_CACHE_H_
@@ -0,0 +1,382 @@
+#include <stdio.h>   // fprintf
+#include <stdlib.h>  // calloc, free, exit
+#include <string.h>  // memcpy
+#include <math.h>    // exp, ceil, lround
+
+#include "convolve.h"
+#include "arena.h"
+
+#if defined(__x86_64__)
+#define CONVOLVE_X86
+#endif
+
+// channels that are filtered, B, G and R. A fourth byte is copied
+#define CHANNELS  3
+
+// context of a convolution for the thread pool
+typedef struct convolveJob_s {
+    const uint8_t *src;
+    uint8_t *dst;
+    uint32_t rowSize, width, height, bpp;
+    enum convolveMode_e mode;
+    uint32_t radius;              // reach of the filter in pixels
+    uint32_t tileRows;            // rows of a tile, at least twice the radius
+    uint32_t tilesX;              // tiles across a row
+    int32_t weight[2 * CONVOLVE_MAX_RADIUS + 1]; // gaussian and sharpen: the weights of every tap
+    uint64_t scale;               // box: 2^32 divided by the number of pixels in the square
+    int32_t amount;               // sharpen: the amount in 8 bit fixed point
+} convolveJob_t;
+
+static void *
+convolveAlloc(size_t size)
+{
+    void *mem = calloc(1, size);
+
+    if (mem == NULL) {
+        fprintf(stderr, "convolution memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+}
+
+static inline int32_t
+clampIndex(int32_t idx, uint32_t size)
+{
+    return (idx < 0) ? 0 : (idx >= (int32_t)size) ? (int32_t)size - 1 : idx;
+}
+
+static inline uint8_t
+clampByte(int32_t value)
+{
+    return (value < 0) ? 0 : (value > 255) ? 255 : value;
+}
+
+// copies the B, G, R bytes of cols pixels from x0 and radius pixels on either
+// side into pad, repeating the edge pixels past the ends of the row
+static void
+padRow(const convolveJob_t *job, const uint8_t *row, uint32_t x0, uint32_t cols, uint8_t *pad)
+{
+    int32_t first = (int32_t)x0 - (int32_t)job->radius;
+    int32_t last  = (int32_t)(x0 + cols + job->radius);
+
+    // only the ends of the row need clamping
+    if (first >= 0 && last <= (int32_t)job->width && job->bpp == CHANNELS) {
+        memcpy(pad, row + (size_t)first * CHANNELS, (size_t)(last - first) * CHANNELS);
+        return;
+    }
+
+    for (int32_t x = first; x < last; x++, pad += CHANNELS) {
+        const uint8_t *in = row + (size_t)clampIndex(x, job->width) * job->bpp;
+
+        pad[0] = in[0];
+        pad[1] = in[1];
+        pad[2] = in[2];
+    }
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: filterRow                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  The horizontal pass over one padded row. The box keeps a running sum per  *
+ *  channel so every pixel costs one add and one subtract whatever the        *
+ *  radius. The gaussian adds the padded row shifted by every tap, which the  *
+ *  compiler vectorizes, and keeps 8 fraction bits for the vertical pass.     *
+ *  Sobel smooths into plane and differentiates into detail                   *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const convolveJob_t *job                                                  *
+ *  const uint8_t *pad                                                        *
+ *  uint32_t cols                                                             *
+ *  int32_t *plane                                                            *
+ *  int32_t *detail                                                           *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+__attribute__((always_inline)) static inline void
+filterRow(const convolveJob_t *job, const uint8_t *pad, uint32_t cols, int32_t *plane, int32_t *detail)
+{
+    uint32_t span = cols * CHANNELS;
+    uint32_t taps = 2 * job->radius + 1;
+
+    switch (job->mode) {
+        case convolveBox:
+            for (uint32_t c = 0; c < CHANNELS; c++) {
+                int32_t sum = 0;
+
+                for (uint32_t tap = 0; tap < taps; tap++)
+                    sum += pad[tap * CHANNELS + c];
+                plane[c] = sum;
+
+                for (uint32_t x = 1; x < cols; x++) {
+                    sum += pad[(x + taps - 1) * CHANNELS + c] - pad[(x - 1) * CHANNELS + c];
+                    plane[x * CHANNELS + c] = sum;
+                }
+            }
+            break;
+
+        case convolveGaussian: case convolveSharpen:
+            for (uint32_t idx = 0; idx < span; idx++)
+                plane[idx] = 1 << (CONVOLVE_SHIFT - 9);
+
+            for (uint32_t tap = 0; tap < taps; tap++) {
+                const uint8_t *in = pad + tap * CHANNELS;
+                int32_t weight    = job->weight[tap];
+
+                for (uint32_t idx = 0; idx < span; idx++)
+                    plane[idx] += weight * in[idx];
+            }
+
+            for (uint32_t idx = 0; idx < span; idx++)
+                plane[idx] >>= CONVOLVE_SHIFT - 8;
+            break;
+
+        case convolveSobel:
+            for (uint32_t idx = 0; idx < span; idx++) {
+                plane[idx]  = pad[idx] + 2 * pad[idx + CHANNELS] + pad[idx + 2 * CHANNELS];
+                detail[idx] = pad[idx + 2 * CHANNELS] - pad[idx];
+            }
+            break;
+    }
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: convolveTile                                                *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Filters one tile. The rows of the tile and radius halo rows above and     *
+ *  below it are filtered horizontally into a plane, then every output row    *
+ *  combines the 2 * radius + 1 plane rows around it. The box does that with  *
+ *  a running sum down the columns again, so it stays O(1) per pixel          *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const convolveJob_t *job                                                  *
+ *  uint32_t chunk                                                            *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+__attribute__((always_inline)) static inline void
+convolveTile(const convolveJob_t *job, uint32_t chunk)
+{
+    uint32_t radius = job->radius;
+    uint32_t taps   = 2 * radius + 1;
+    uint32_t x0     = (chunk % job->tilesX) * CONVOLVE_TILE_WIDTH;
+    uint32_t y0     = (chunk / job->tilesX) * job->tileRows;
+    uint32_t cols   = (job->width - x0 < CONVOLVE_TILE_WIDTH) ? job->width - x0 : CONVOLVE_TILE_WIDTH;
+    uint32_t rows   = (job->height - y0 < job->tileRows) ? job->height - y0 : job->tileRows;
+    uint32_t span   = cols * CHANNELS;
+    uint32_t halo   = rows + 2 * radius;
+    size_t padSize  = ((size_t)(cols + 2 * radius) * CHANNELS + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    size_t area     = (size_t)halo * span;
+    size_t planes   = (job->mode == convolveSobel) ? 2 : 1;
+
+    // one scratch buffer from the arena per tile, carved into the pieces
+    uint8_t *pad    = arenaAlloc(padSize + (planes * area + 2 * span) * sizeof(int32_t));
+    int32_t *plane  = (int32_t *)(pad + padSize);
+    int32_t *detail = (planes == 2) ? plane + area : NULL;
+    int32_t *sum    = plane + planes * area;
+    int32_t *value  = sum + span;
+
+    memset(sum, 0, (size_t)span * sizeof(int32_t));
+
+    // horizontal pass over the tile and its halo
+    for (uint32_t idx = 0; idx < halo; idx++) {
+        int32_t y = clampIndex((int32_t)(y0 + idx) - (int32_t)radius, job->height);
+
+        padRow(job, job->src + (size_t)y * job->rowSize, x0, cols, pad);
+        filterRow(job, pad, cols, plane + (size_t)idx * span, detail ? detail + (size_t)idx * span : NULL);
+    }
+
+    // the box starts with the sum of the first 2 * radius + 1 rows
+    if (job->mode == convolveBox)
+        for (uint32_t idx = 0; idx < taps; idx++)
+            for (uint32_t col = 0; col < span; col++)
+                sum[col] += plane[(size_t)idx * span + col];
+
+    // vertical pass, row y of the tile is centered on plane row y + radius
+    for (uint32_t y = 0; y < rows; y++) {
+        const uint8_t *in = job->src + (size_t)(y0 + y) * job->rowSize + (size_t)x0 * job->bpp;
+        uint8_t *out      = job->dst + (size_t)(y0 + y) * job->rowSize + (size_t)x0 * job->bpp;
+        const int32_t *top = plane + (size_t)y * span;
+
+        switch (job->mode) {
+            case convolveBox:
+                for (uint32_t col = 0; col < span; col++)
+                    value[col] = (int32_t)(((uint64_t)sum[col] * job->scale + (1ull << 31)) >> 32);
+
+                if (y + 1 < rows)
+                    for (uint32_t col = 0; col < span; col++)
+                        sum[col] += top[(size_t)taps * span + col] - top[col];
+                break;
+
+            case convolveGaussian: case convolveSharpen:
+                for (uint32_t col = 0; col < span; col++)
+                    sum[col] = 1 << (CONVOLVE_SHIFT + 7);
+
+                for (uint32_t tap = 0; tap < taps; tap++) {
+                    const int32_t *row = top + (size_t)tap * span;
+                    int32_t weight     = job->weight[tap];
+
+                    for (uint32_t col = 0; col < span; col++)
+                        sum[col] += weight * row[col];
+                }
+
+                if (job->mode == convolveGaussian) {
+                    for (uint32_t col = 0; col < span; col++)
+                        value[col] = sum[col] >> (CONVOLVE_SHIFT + 8);
+                    break;
+                }
+
+                // the original plus amount times what the blur took away
+                for (uint32_t x = 0; x < cols; x++) {
+                    for (uint32_t c = 0; c < CHANNELS; c++) {
+                        int32_t original = in[x * job->bpp + c];
+                        int32_t blurred  = (sum[x * CHANNELS + c] - (1 << (CONVOLVE_SHIFT + 7))
+                                         + (1 << (CONVOLVE_SHIFT - 1))) >> CONVOLVE_SHIFT;
+
+                        value[x * CHANNELS + c] = original + ((((original << 8) - blurred) * job->amount + (1 << 15)) >> 16);
+                    }
+                }
+                break;
+
+            case convolveSobel: {
+                const int32_t *diff = detail + (size_t)y * span;
+
+                for (uint32_t col = 0; col < span; col++) {
+                    int32_t gx = abs(diff[col] + 2 * diff[span + col] + diff[2 * span + col]);
+                    int32_t gy = abs(top[2 * span + col] - top[col]);
+
+                    // the larger plus 3/8 of the smaller is within 7% of the hypotenuse
+                    value[col] = (gx > gy) ? gx + (3 * gy >> 3) : gy + (3 * gx >> 3);
+                }
+            } break;
+        }
+
+        for (uint32_t x = 0; x < cols; x++)
+            for (uint32_t c = 0; c < CHANNELS; c++)
+                out[x * job->bpp + c] = clampByte(value[x * CHANNELS + c]);
+
+        // the fourth byte isn't filtered
+        if (job->bpp == 4)
+            for (uint32_t x = 0; x < cols; x++)
+                out[x * 4 + 3] = in[x * 4 + 3];
+    }
+
+    arenaFree(pad);
+    return;
+}
+
+// pool task filtering one tile, the loops are vectorized with SSE2
+static void
+convolveTask(void *ctx, uint32_t chunk)
+{
+    convolveTile(ctx, chunk);
+}
+
+#ifdef CONVOLVE_X86
+// the same compiled for AVX2, which doubles the width of the vectors and
+// multiplies 32 bit lanes in one instruction instead of four
+__attribute__((target("avx2"))) static void
+convolveTaskAvx2(void *ctx, uint32_t chunk)
+{
+    convolveTile(ctx, chunk);
+}
+#endif//CONVOLVE_X86
+
+/*!
+ ******************************************************************************
+ * Function Name: convolvePixels                                              *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Works out the reach and the fixed point weights of the filter and runs    *
+ *  the tiles over the pool. The tiles are CONVOLVE_TILE_WIDTH pixels wide    *
+ *  and CONVOLVE_TILE_ROWS high, or twice the radius when that is more so     *
+ *  the halo never outgrows the tile. The gaussian weights are rounded to     *
+ *  CONVOLVE_SHIFT bits and what rounding lost goes to the center tap, so a   *
+ *  flat area stays exactly the same. The tiles run with AVX2 when the cpu    *
+ *  has it                                                                    *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const uint8_t *src                                                        *
+ *  uint8_t *dst                                                              *
+ *  uint32_t rowSize                                                          *
+ *  uint32_t width                                                            *
+ *  uint32_t height                                                           *
+ *  uint32_t bpp                                                              *
+ *  enum convolveMode_e mode                                                  *
+ *  float arg                                                                 *
+ *  threadPool_t *pool                                                        *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+convolvePixels(
+    const uint8_t *src, uint8_t *dst, uint32_t rowSize, uint32_t width, uint32_t height,
+    uint32_t bpp, enum convolveMode_e mode, float arg, threadPool_t *pool)
+{
+    convolveJob_t *job = convolveAlloc(sizeof(convolveJob_t));
+    poolTask_f task    = convolveTask;
+    double sigma       = (mode == convolveSharpen) ? 1.0 : arg;
+    double raw[2 * CONVOLVE_MAX_RADIUS + 1];
+    double rawTotal    = 0.0;
+    int32_t total      = 0;
+    uint32_t tiles;
+
+    job->src     = src;
+    job->dst     = dst;
+    job->rowSize = rowSize;
+    job->width   = width;
+    job->height  = height;
+    job->bpp     = bpp;
+    job->mode    = mode;
+
+    switch (mode) {
+        case convolveBox:
+            job->radius = (uint32_t)arg;
+            job->scale  = (uint64_t)llround(4294967296.0 / ((2.0 * job->radius + 1) * (2.0 * job->radius + 1)));
+            break;
+
+        case convolveGaussian: case convolveSharpen:
+            job->radius = (uint32_t)ceil(3.0 * sigma);
+            for (uint32_t tap = 0; tap < 2 * job->radius + 1; tap++) {
+                double x = (double)tap - job->radius;
+
+                raw[tap]  = exp(-x * x / (2.0 * sigma * sigma));
+                rawTotal += raw[tap];
+            }
+            for (uint32_t tap = 0; tap < 2 * job->radius + 1; tap++) {
+                job->weight[tap] = (int32_t)lround(raw[tap] / rawTotal * (1 << CONVOLVE_SHIFT));
+                total += job->weight[tap];
+            }
+            job->weight[job->radius] += (1 << CONVOLVE_SHIFT) - total;
+            job->amount = (int32_t)lroundf(arg * 256.0f);
+            break;
+
+        case convolveSobel:
+            job->radius = 1;
+            break;
+    }
+
+    job->tileRows = (2 * job->radius > CONVOLVE_TILE_ROWS) ? 2 * job->radius : CONVOLVE_TILE_ROWS;
+    job->tilesX   = (width + CONVOLVE_TILE_WIDTH - 1) / CONVOLVE_TILE_WIDTH;
+    tiles         = job->tilesX * ((height + job->tileRows - 1) / job->tileRows);
+
+#ifdef CONVOLVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        task = convolveTaskAvx2;
+#endif
+
+    poolRun(pool, tiles, task, job);
+
+    free(job);
+    return;
+}
@@ -0,0 +1,36 @@
+#ifndef _CONVOLVE_H_
+#define _CONVOLVE_H_
+
+#include <stdint.h>  // int typedefs
+
+#include "threadpool.h"
+
+// size of the tiles the convolutions are done in, in pixels. A tile and the
+// halo rows around it are filtered into a buffer of about 100KB per plane,
+// small enough to stay in L2 between the two passes
+#define CONVOLVE_TILE_WIDTH  128
+#define CONVOLVE_TILE_ROWS   64
+
+// number of fraction bits in the gaussian weights
+#define CONVOLVE_SHIFT       14
+
+// largest blur radius and sigma, larger ones are done faster with a box
+#define CONVOLVE_MAX_RADIUS  100
+#define CONVOLVE_MAX_SIGMA   32.0f
+
+// neighborhood filters
+enum convolveMode_e {
+    convolveBox      = 0,   // mean of a square of 2 * arg + 1 pixels
+    convolveGaussian = 1,   // gaussian with a sigma of arg pixels
+    convolveSharpen  = 2,   // unsharp mask adding arg times the detail a gaussian of 1 pixel removes
+    convolveSobel    = 3,   // gradient magnitude, arg is unused
+};
+
+// filters the B, G and R bytes of a width x height pixel array into dst,
+// a fourth byte per pixel is copied. The pixels past the edges repeat the
+// edge pixels. bpp is 3 or 4
+void convolvePixels(
+    const uint8_t *src, uint8_t *dst, uint32_t rowSize, uint32_t width, uint32_t height,
+    uint32_t bpp, enum convolveMode_e mode, float arg, threadPool_t *pool);
+
+#endif//_CONVOLVE_H_
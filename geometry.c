@@ -0,0 +1,821 @@
+#include <stdio.h>   // fprintf
+#include <stdlib.h>  // calloc, free, exit
+#include <string.h>  // memcpy
+#include <math.h>    // sin, tan, floor, ceil, lround
+
+#include "geometry.h"
+#include "arena.h"
+
+// copies one pixel, bpp is a constant after inlining so this becomes a
+// single load and store for the common pixel sizes
+static inline void
+copyPixel(uint8_t *dst, const uint8_t *src, uint32_t bpp)
+{
+    switch (bpp) {
+                case 1: dst[0] = src[0];
+        break;  case 2: memcpy(dst, src, 2);
+        break;  case 3: memcpy(dst, src, 3);
+        break;  case 4: memcpy(dst, src, 4);
+        break;  default: memcpy(dst, src, bpp);
+        break;
+    }
+}
+
+// swaps two pixels of bpp bytes
+static inline void
+swapPixel(uint8_t *a, uint8_t *b, uint32_t bpp)
+{
+    uint8_t tmp[4];
+
+    if (bpp > sizeof(tmp)) {
+        for (uint32_t byteIdx = 0; byteIdx < bpp; byteIdx++) {
+            uint8_t t = a[byteIdx];
+            a[byteIdx] = b[byteIdx];
+            b[byteIdx] = t;
+        }
+        return;
+    }
+
+    copyPixel(tmp, a, bpp);
+    copyPixel(a, b, bpp);
+    copyPixel(b, tmp, bpp);
+}
+
+// rotates one tile of the destination, see rotate90
+static inline void
+rotateTile(
+    const uint8_t *src, uint32_t srcRowSize, uint32_t width, uint32_t height,
+    uint8_t *dst, uint32_t dstRowSize, uint32_t bpp, bool clockwise,
+    uint32_t tileX, uint32_t tileY)
+{
+    // the destination is height pixels wide and width pixels high
+    uint32_t endX = (tileX + TILE_SIZE < height) ? tileX + TILE_SIZE : height;
+    uint32_t endY = (tileY + TILE_SIZE < width) ? tileY + TILE_SIZE : width;
+
+    for (uint32_t y = tileY; y < endY; y++) {
+        uint8_t *out = dst + (size_t)y * dstRowSize + (size_t)tileX * bpp;
+
+        // clockwise: dst(x, y) = src(y, height - 1 - x), else dst(x, y) = src(width - 1 - y, x)
+        if (clockwise) {
+            const uint8_t *in = src + (size_t)(height - 1 - tileX) * srcRowSize + (size_t)y * bpp;
+
+            for (uint32_t x = tileX; x < endX; x++, out += bpp, in -= srcRowSize)
+                copyPixel(out, in, bpp);
+        } else {
+            const uint8_t *in = src + (size_t)tileX * srcRowSize + (size_t)(width - 1 - y) * bpp;
+
+            for (uint32_t x = tileX; x < endX; x++, out += bpp, in += srcRowSize)
+                copyPixel(out, in, bpp);
+        }
+    }
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: rotate90                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Rotates the pixel array by 90 degrees into a new array with the width and *
+ *  height swapped. A plain transposition walks down a column of the source   *
+ *  for every destination row, which misses the cache on every pixel of a     *
+ *  wide image. The destination is filled in TILE_SIZE x TILE_SIZE tiles so   *
+ *  the source rows a tile reads stay in the cache while it is being written  *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const uint8_t *src                                                        *
+ *  uint32_t srcRowSize                                                       *
+ *  uint32_t width                                                            *
+ *  uint32_t height                                                           *
+ *  uint8_t *dst                                                              *
+ *  uint32_t dstRowSize                                                       *
+ *  uint32_t bpp                                                              *
+ *  bool clockwise                                                            *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+rotate90(
+    const uint8_t *src, uint32_t srcRowSize, uint32_t width, uint32_t height,
+    uint8_t *dst, uint32_t dstRowSize, uint32_t bpp, bool clockwise)
+{
+    for (uint32_t tileY = 0; tileY < width; tileY += TILE_SIZE) {
+        for (uint32_t tileX = 0; tileX < height; tileX += TILE_SIZE) {
+            // give the compiler a constant pixel size for the common formats
+            switch (bpp) {
+                        case 1: rotateTile(src, srcRowSize, width, height, dst, dstRowSize, 1, clockwise, tileX, tileY);
+                break;  case 2: rotateTile(src, srcRowSize, width, height, dst, dstRowSize, 2, clockwise, tileX, tileY);
+                break;  case 3: rotateTile(src, srcRowSize, width, height, dst, dstRowSize, 3, clockwise, tileX, tileY);
+                break;  case 4: rotateTile(src, srcRowSize, width, height, dst, dstRowSize, 4, clockwise, tileX, tileY);
+                break;  default: rotateTile(src, srcRowSize, width, height, dst, dstRowSize, bpp, clockwise, tileX, tileY);
+                break;
+            }
+        }
+    }
+
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: rotate180                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Rotates the pixel array by 180 degrees in place by swapping every pixel   *
+ *  of the top half with its mirror in the bottom half, the middle scanline   *
+ *  of an odd height is reversed on its own. No extra buffer is needed        *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *data                                                             *
+ *  uint32_t rowSize                                                          *
+ *  uint32_t width                                                            *
+ *  uint32_t height                                                           *
+ *  uint32_t bpp                                                              *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+rotate180(uint8_t *data, uint32_t rowSize, uint32_t width, uint32_t height, uint32_t bpp)
+{
+    for (uint32_t y = 0; y < height / 2; y++) {
+        uint8_t *top    = data + (size_t)y * rowSize;
+        uint8_t *bottom = data + (size_t)(height - 1 - y) * rowSize + (size_t)(width - 1) * bpp;
+
+        for (uint32_t x = 0; x < width; x++, top += bpp, bottom -= bpp)
+            swapPixel(top, bottom, bpp);
+    }
+
+    if (height % 2)
+        flipColumns(data + (size_t)(height / 2) * rowSize, rowSize, width, 1, bpp);
+
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: flipRows                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Flips the image vertically in place by swapping scanlines from the top    *
+ *  and the bottom, a small stack buffer carries the bytes across             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *data                                                             *
+ *  uint32_t rowSize                                                          *
+ *  uint32_t height                                                           *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+flipRows(uint8_t *data, uint32_t rowSize, uint32_t height)
+{
+    uint8_t tmp[1024];
+
+    for (uint32_t y = 0; y < height / 2; y++) {
+        uint8_t *top    = data + (size_t)y * rowSize;
+        uint8_t *bottom = data + (size_t)(height - 1 - y) * rowSize;
+
+        for (uint32_t done = 0; done < rowSize; done += sizeof(tmp)) {
+            uint32_t size = (rowSize - done < sizeof(tmp)) ? rowSize - done : sizeof(tmp);
+
+            memcpy(tmp, top + done, size);
+            memcpy(top + done, bottom + done, size);
+            memcpy(bottom + done, tmp, size);
+        }
+    }
+
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: flipColumns                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Flips the image horizontally in place by reversing the pixels of every    *
+ *  scanline, the padding stays at the end of the scanline                    *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *data                                                             *
+ *  uint32_t rowSize                                                          *
+ *  uint32_t width                                                            *
+ *  uint32_t height                                                           *
+ *  uint32_t bpp                                                              *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+flipColumns(uint8_t *data, uint32_t rowSize, uint32_t width, uint32_t height, uint32_t bpp)
+{
+    if (width < 2)
+        return;
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t *left  = data + (size_t)y * rowSize;
+        uint8_t *right = left + (size_t)(width - 1) * bpp;
+
+        for (; left < right; left += bpp, right -= bpp)
+            swapPixel(left, right, bpp);
+    }
+
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Resampling                                                                 *
+ ******************************************************************************
+ * Resizing and rotating by an arbitrary angle are done in separable passes,  *
+ * every pass resamples either the rows or the columns only. The weights of   *
+ * a pass are worked out once in a plan, as RESAMPLE_SHIFT fixed point, so    *
+ * the passes themselves are integer multiply and adds. The passes are split  *
+ * over the thread pool by output row                                         *
+ ******************************************************************************
+!*/
+
+// the weights of a pass, every output sample reads count source samples
+// from start on, the weights of sample idx start at weight[idx * taps]
+typedef struct resamplePlan_s {
+    uint32_t taps;            // weights per output sample
+    int32_t *start;           // first source sample of every output sample
+    uint32_t *count;          // weights used by every output sample
+    int16_t *weight;          // the weights, summing to 1 << RESAMPLE_SHIFT
+} resamplePlan_t;
+
+// what a pass does: the plan is indexed by the output column or row, for a
+// shear every row (or column) has one plan entry whose window slides along
+typedef enum resamplePass_e {
+    passColumns,              // resample along the rows, plan per column
+    passRows,                 // resample along the columns, plan per row
+    shearColumns,             // shift every row, plan per row
+    shearRows,                // shift every column, plan per column
+} resamplePass_t;
+
+// context of a resampling pass for the thread pool
+typedef struct resampleJob_s {
+    resamplePass_t pass;
+    const resamplePlan_t *plan;
+    const uint8_t *src;
+    uint32_t srcRowSize, srcWidth, srcHeight;
+    uint8_t *dst;
+    uint32_t dstRowSize, dstWidth, dstHeight;
+    uint32_t bpp;
+    const int16_t *spread;    // shearRows: the weights of every tap, per byte of a row
+} resampleJob_t;
+
+// half way of the fixed point weights, for rounding
+#define RESAMPLE_HALF  (1 << (RESAMPLE_SHIFT - 1))
+
+static inline double
+kernelSupport(enum resampleMode_e mode)
+{
+    return (mode == resampleLanczos) ? 3.0 : (mode == resampleBilinear) ? 1.0 : 0.5;
+}
+
+static double
+kernelWeight(enum resampleMode_e mode, double x)
+{
+    x = fabs(x);
+
+    if (mode == resampleBilinear)
+        return (x < 1.0) ? 1.0 - x : 0.0;
+
+    // sinc(x) * sinc(x / 3)
+    if (x < 1e-9) return 1.0;
+    if (x >= 3.0) return 0.0;
+    return 3.0 * sin(M_PI * x) * sin(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+}
+
+static void *
+resampleAlloc(size_t size)
+{
+    void *mem = calloc(1, size);
+
+    if (mem == NULL) {
+        fprintf(stderr, "resampling memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: planCreate                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Allocates a plan for samples output samples of which the kernel reaches   *
+ *  at most scale times its support, scale is above 1 when downscaling so     *
+ *  the kernel averages every source sample that lands on an output sample    *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  resamplePlan_t *plan                                                      *
+ *  uint32_t samples                                                          *
+ *  enum resampleMode_e mode                                                  *
+ *  double scale                                                              *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+static void
+planCreate(resamplePlan_t *plan, uint32_t samples, enum resampleMode_e mode, double scale)
+{
+    plan->taps   = (mode == resampleNearest) ? 1 : (uint32_t)ceil(2.0 * kernelSupport(mode) * scale) + 1;
+    plan->start  = resampleAlloc(samples * sizeof(int32_t));
+    plan->count  = resampleAlloc(samples * sizeof(uint32_t));
+    plan->weight = resampleAlloc((size_t)samples * plan->taps * sizeof(int16_t));
+    return;
+}
+
+static void
+planDestroy(resamplePlan_t *plan)
+{
+    free(plan->start);
+    free(plan->count);
+    free(plan->weight);
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: planSample                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Works out the weights of one output sample centered on center, in source  *
+ *  samples. With clip the samples outside 0 - size - 1 are left out and the  *
+ *  others weighted up, so the edges of a resized image don't darken. Without *
+ *  clip the window is kept whole and the pass skips what falls outside, so   *
+ *  the edges of a rotated image fade into the zeroed background              *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  resamplePlan_t *plan                                                      *
+ *  uint32_t idx                                                              *
+ *  enum resampleMode_e mode                                                  *
+ *  double center                                                             *
+ *  double scale                                                              *
+ *  int32_t size                                                              *
+ *  bool clip                                                                 *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+static void
+planSample(
+    resamplePlan_t *plan, uint32_t idx, enum resampleMode_e mode,
+    double center, double scale, int32_t size, bool clip)
+{
+    int16_t *weight = plan->weight + (size_t)idx * plan->taps;
+    double raw[plan->taps];
+    double sum = 0.0;
+    int32_t first, last, total = 0;
+    uint32_t biggest = 0;
+
+    if (mode == resampleNearest) {
+        first = (int32_t)floor(center + 0.5);
+        if (clip) first = (first < 0) ? 0 : (first >= size) ? size - 1 : first;
+        plan->start[idx] = first;
+        plan->count[idx] = 1;
+        weight[0]        = 1 << RESAMPLE_SHIFT;
+        return;
+    }
+
+    first = (int32_t)floor(center - kernelSupport(mode) * scale) + 1;
+    last  = first + (int32_t)plan->taps;
+    if (clip) {
+        if (first < 0) first = 0;
+        if (last > size) last = size;
+        if (last <= first) { // far outside, use the nearest edge sample
+            first = (center < 0) ? 0 : size - 1;
+            last  = first + 1;
+        }
+    }
+
+    for (int32_t tap = first; tap < last; tap++) {
+        raw[tap - first] = kernelWeight(mode, (tap - center) / scale);
+        sum += raw[tap - first];
+    }
+
+    // round to fixed point and give what rounding lost to the biggest weight
+    for (int32_t tap = 0; tap < last - first; tap++) {
+        weight[tap] = (int16_t)lround(raw[tap] / sum * (1 << RESAMPLE_SHIFT));
+        total += weight[tap];
+        if (weight[tap] > weight[biggest]) biggest = tap;
+    }
+    weight[biggest] += (1 << RESAMPLE_SHIFT) - total;
+
+    plan->start[idx] = first;
+    plan->count[idx] = last - first;
+    return;
+}
+
+// rounds a fixed point sum back to a byte
+static inline uint8_t
+resampleByte(int32_t sum)
+{
+    sum = (sum + RESAMPLE_HALF) >> RESAMPLE_SHIFT;
+    return (sum < 0) ? 0 : (sum > 255) ? 255 : sum;
+}
+
+// weighs the pixels at src, src + stride, ... into one output pixel, bpp is
+// a constant after inlining
+static inline void
+resamplePixel(
+    uint8_t *dst, const uint8_t *src, size_t stride,
+    const int16_t *weight, uint32_t count, uint32_t bpp)
+{
+    int32_t sum[4] = { 0 };
+
+    if (bpp > 4) {
+        for (uint32_t byteIdx = 0; byteIdx < bpp; byteIdx++) {
+            int32_t wide = 0;
+
+            for (uint32_t tap = 0; tap < count; tap++)
+                wide += weight[tap] * src[tap * stride + byteIdx];
+            dst[byteIdx] = resampleByte(wide);
+        }
+        return;
+    }
+
+    for (uint32_t tap = 0; tap < count; tap++, src += stride)
+        for (uint32_t byteIdx = 0; byteIdx < bpp; byteIdx++)
+            sum[byteIdx] += weight[tap] * src[byteIdx];
+
+    for (uint32_t byteIdx = 0; byteIdx < bpp; byteIdx++)
+        dst[byteIdx] = resampleByte(sum[byteIdx]);
+}
+
+// stores a row of rounded fixed point sums as bytes
+static inline void
+resampleStore(uint8_t *out, const int32_t *sum, uint32_t size)
+{
+    for (uint32_t byteIdx = 0; byteIdx < size; byteIdx++) {
+        int32_t value = sum[byteIdx] >> RESAMPLE_SHIFT;
+        out[byteIdx]  = (value < 0) ? 0 : (value > 255) ? 255 : value;
+    }
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: resampleRow                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Produces output row y of a pass. Everything but resampling along the      *
+ *  rows weighs stretches of whole source rows into a row of sums, which the  *
+ *  compiler turns into vector multiply and adds                              *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const resampleJob_t *job                                                  *
+ *  uint32_t y                                                                *
+ *  int32_t *sum                                                              *
+ *  uint32_t bpp                                                              *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+static inline void
+resampleRow(const resampleJob_t *job, uint32_t y, int32_t *sum, uint32_t bpp)
+{
+    const resamplePlan_t *plan = job->plan;
+    const uint8_t *src         = job->src;
+    uint8_t *out               = job->dst + (size_t)y * job->dstRowSize;
+    uint32_t rowBytes          = job->dstWidth * bpp;
+
+    switch (job->pass) {
+        case passColumns: {
+            const uint8_t *row = src + (size_t)y * job->srcRowSize;
+
+            for (uint32_t x = 0; x < job->dstWidth; x++, out += bpp)
+                resamplePixel(
+                    out, row + (size_t)plan->start[x] * bpp, bpp,
+                    plan->weight + (size_t)x * plan->taps, plan->count[x], bpp);
+        } break;
+
+        case passRows: {
+            const int16_t *weight = plan->weight + (size_t)y * plan->taps;
+
+            for (uint32_t byteIdx = 0; byteIdx < rowBytes; byteIdx++)
+                sum[byteIdx] = RESAMPLE_HALF;
+
+            for (uint32_t tap = 0; tap < plan->count[y]; tap++) {
+                const uint8_t *row = src + (size_t)(plan->start[y] + tap) * job->srcRowSize;
+                int32_t w          = weight[tap];
+
+                for (uint32_t byteIdx = 0; byteIdx < rowBytes; byteIdx++)
+                    sum[byteIdx] += w * row[byteIdx];
+            }
+
+            resampleStore(out, sum, rowBytes);
+        } break;
+
+        case shearColumns: {
+            // the whole row moves by the same amount, so this weighs the
+            // source row shifted by every tap, skipping what falls outside
+            const uint8_t *row    = src + (size_t)y * job->srcRowSize;
+            const int16_t *weight = plan->weight + (size_t)y * plan->taps;
+            int32_t width         = job->dstWidth;
+
+            for (uint32_t byteIdx = 0; byteIdx < rowBytes; byteIdx++)
+                sum[byteIdx] = RESAMPLE_HALF;
+
+            for (int32_t tap = 0; tap < (int32_t)plan->count[y]; tap++) {
+                int32_t shift = plan->start[y] + tap;  // source x of output x 0
+                int32_t from  = (shift < 0) ? -shift : 0;
+                int32_t to    = ((int32_t)job->srcWidth - shift < width) ? (int32_t)job->srcWidth - shift : width;
+                int32_t *acc  = sum + from * bpp;
+                int32_t w     = weight[tap];
+
+                if (from >= to)
+                    continue;
+
+                row = src + (size_t)y * job->srcRowSize + (size_t)(from + shift) * bpp;
+                for (int32_t byteIdx = 0; byteIdx < (to - from) * (int32_t)bpp; byteIdx++)
+                    acc[byteIdx] += w * row[byteIdx];
+            }
+
+            resampleStore(out, sum, rowBytes);
+        } break;
+
+        case shearRows: {
+            // neighbouring columns mostly start on the same source row, a run
+            // of them weighs stretches of whole source rows like passRows
+            // with the weights of every column spread over its bytes
+            int32_t width = job->dstWidth;
+
+            for (uint32_t byteIdx = 0; byteIdx < rowBytes; byteIdx++)
+                sum[byteIdx] = RESAMPLE_HALF;
+
+            for (int32_t x = 0, end; x < width; x = end) {
+                int32_t first = plan->start[x];
+                int32_t *acc  = sum + x * bpp;
+
+                for (end = x + 1; end < width && plan->start[end] == first; end++);
+                first += (int32_t)y;
+
+                for (int32_t tap = 0; tap < (int32_t)plan->taps; tap++) {
+                    const uint8_t *row;
+                    const int16_t *weight;
+
+                    if (first + tap < 0 || first + tap >= (int32_t)job->srcHeight)
+                        continue;
+
+                    row    = src + (size_t)(first + tap) * job->srcRowSize + (size_t)x * bpp;
+                    weight = job->spread + (size_t)tap * rowBytes + (size_t)x * bpp;
+                    for (int32_t byteIdx = 0; byteIdx < (end - x) * (int32_t)bpp; byteIdx++)
+                        acc[byteIdx] += weight[byteIdx] * row[byteIdx];
+                }
+            }
+
+            resampleStore(out, sum, rowBytes);
+        } break;
+    }
+}
+
+// pool task running a chunk of RESAMPLE_ROWS output rows of a pass
+static void
+resampleTask(void *ctx, uint32_t chunk)
+{
+    const resampleJob_t *job = ctx;
+    uint32_t end             = (chunk + 1) * RESAMPLE_ROWS;
+    int32_t *sum             = NULL;
+
+    if (end > job->dstHeight) end = job->dstHeight;
+    if (job->pass != passColumns)
+        sum = arenaAlloc((size_t)job->dstWidth * job->bpp * sizeof(int32_t));
+
+    for (uint32_t y = chunk * RESAMPLE_ROWS; y < end; y++) {
+        // give the compiler a constant pixel size for the common formats
+        switch (job->bpp) {
+                    case 1: resampleRow(job, y, sum, 1);
+            break;  case 2: resampleRow(job, y, sum, 2);
+            break;  case 3: resampleRow(job, y, sum, 3);
+            break;  case 4: resampleRow(job, y, sum, 4);
+            break;  default: resampleRow(job, y, sum, job->bpp);
+            break;
+        }
+    }
+
+    arenaFree(sum);
+    return;
+}
+
+// runs a pass spread over the pool
+static void
+resampleRun(resampleJob_t *job, threadPool_t *pool)
+{
+    poolRun(pool, (job->dstHeight + RESAMPLE_ROWS - 1) / RESAMPLE_ROWS, resampleTask, job);
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: resamplePixels                                              *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Resizes the pixel array in two passes through a temporary array, one      *
+ *  resamples the rows to the new width and one the columns to the new        *
+ *  height. Resampling the rows goes pixel by pixel while the columns are     *
+ *  done over whole rows at once, so the rows are resampled while there are   *
+ *  the fewest of them: last when shrinking the height, first otherwise       *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const uint8_t *src                                                        *
+ *  uint32_t srcRowSize                                                       *
+ *  uint32_t srcWidth                                                         *
+ *  uint32_t srcHeight                                                        *
+ *  uint8_t *dst                                                              *
+ *  uint32_t dstRowSize                                                       *
+ *  uint32_t dstWidth                                                         *
+ *  uint32_t dstHeight                                                        *
+ *  uint32_t bpp                                                              *
+ *  enum resampleMode_e mode                                                  *
+ *  threadPool_t *pool                                                        *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+resamplePixels(
+    const uint8_t *src, uint32_t srcRowSize, uint32_t srcWidth, uint32_t srcHeight,
+    uint8_t *dst, uint32_t dstRowSize, uint32_t dstWidth, uint32_t dstHeight,
+    uint32_t bpp, enum resampleMode_e mode, threadPool_t *pool)
+{
+    double scaleX = (double)srcWidth / dstWidth;
+    double scaleY = (double)srcHeight / dstHeight;
+    resamplePlan_t columns, rows;
+    resampleJob_t job;
+    uint8_t *temp;
+
+    planCreate(&columns, dstWidth, mode, (scaleX > 1.0) ? scaleX : 1.0);
+    for (uint32_t x = 0; x < dstWidth; x++)
+        planSample(
+            &columns, x, mode, (x + 0.5) * scaleX - 0.5,
+            (scaleX > 1.0) ? scaleX : 1.0, srcWidth, true);
+
+    planCreate(&rows, dstHeight, mode, (scaleY > 1.0) ? scaleY : 1.0);
+    for (uint32_t y = 0; y < dstHeight; y++)
+        planSample(
+            &rows, y, mode, (y + 0.5) * scaleY - 0.5,
+            (scaleY > 1.0) ? scaleY : 1.0, srcHeight, true);
+
+    if (dstHeight < srcHeight) {
+        temp = arenaAlloc((size_t)srcWidth * bpp * dstHeight);
+
+        job = (resampleJob_t){
+            passRows, &rows, src, srcRowSize, srcWidth, srcHeight,
+            temp, srcWidth * bpp, srcWidth, dstHeight, bpp, NULL };
+        resampleRun(&job, pool);
+
+        job = (resampleJob_t){
+            passColumns, &columns, temp, srcWidth * bpp, srcWidth, dstHeight,
+            dst, dstRowSize, dstWidth, dstHeight, bpp, NULL };
+        resampleRun(&job, pool);
+    } else {
+        temp = arenaAlloc((size_t)dstWidth * bpp * srcHeight);
+
+        job = (resampleJob_t){
+            passColumns, &columns, src, srcRowSize, srcWidth, srcHeight,
+            temp, dstWidth * bpp, dstWidth, srcHeight, bpp, NULL };
+        resampleRun(&job, pool);
+
+        job = (resampleJob_t){
+            passRows, &rows, temp, dstWidth * bpp, dstWidth, srcHeight,
+            dst, dstRowSize, dstWidth, dstHeight, bpp, NULL };
+        resampleRun(&job, pool);
+    }
+
+    arenaFree(temp);
+    planDestroy(&columns);
+    planDestroy(&rows);
+    return;
+}
+
+void
+rotatedSize(
+    uint32_t width, uint32_t height, double angle,
+    uint32_t *newWidth, uint32_t *newHeight)
+{
+    double c = fabs(cos(angle * M_PI / 180.0));
+    double s = fabs(sin(angle * M_PI / 180.0));
+
+    // the small margin keeps rounding noise from adding a row or column
+    *newWidth  = (uint32_t)ceil(width * c + height * s - 1e-6);
+    *newHeight = (uint32_t)ceil(width * s + height * c - 1e-6);
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: rotatePixels                                                *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Rotates the pixel array with three shears (Paeth): the rows are shifted   *
+ *  by -tan(angle / 2) times their distance to the center, then the columns   *
+ *  by sin(angle) and then the rows again. Every shear moves pixels along     *
+ *  one axis only, by the same fraction for a whole row or column, so each    *
+ *  is a one dimensional resampling pass with one set of weights per row or   *
+ *  column. Every pass maps the center of its input on the center of its      *
+ *  output, pixels that fall outside the image stay zero                      *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const uint8_t *src                                                        *
+ *  uint32_t srcRowSize                                                       *
+ *  uint32_t srcWidth                                                         *
+ *  uint32_t srcHeight                                                        *
+ *  uint8_t *dst                                                              *
+ *  uint32_t dstRowSize                                                       *
+ *  uint32_t dstWidth                                                         *
+ *  uint32_t dstHeight                                                        *
+ *  uint32_t bpp                                                              *
+ *  double angle                                                              *
+ *  enum resampleMode_e mode                                                  *
+ *  threadPool_t *pool                                                        *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+rotatePixels(
+    const uint8_t *src, uint32_t srcRowSize, uint32_t srcWidth, uint32_t srcHeight,
+    uint8_t *dst, uint32_t dstRowSize, uint32_t dstWidth, uint32_t dstHeight,
+    uint32_t bpp, double angle, enum resampleMode_e mode, threadPool_t *pool)
+{
+    double radians = angle * M_PI / 180.0;
+    double shearX  = -tan(radians / 2.0);
+    double shearY  = sin(radians);
+    uint32_t width1, height2;
+    resamplePlan_t plan1, plan2, plan3;
+    resampleJob_t job;
+    uint8_t *step1, *step2;
+    int16_t *spread;
+
+    // the first shear widens the image, the second one makes it as high as
+    // the end result
+    width1  = srcWidth + (uint32_t)ceil(fabs(shearX) * (srcHeight - 1) - 1e-6);
+    height2 = dstHeight;
+
+    // row y moves by shearX * (y - center), output x reads input x - shift
+    planCreate(&plan1, srcHeight, mode, 1.0);
+    for (uint32_t y = 0; y < srcHeight; y++)
+        planSample(
+            &plan1, y, mode,
+            (srcWidth - 1) / 2.0 - (width1 - 1) / 2.0 - shearX * (y - (srcHeight - 1) / 2.0),
+            1.0, srcWidth, false);
+
+    planCreate(&plan2, width1, mode, 1.0);
+    for (uint32_t x = 0; x < width1; x++)
+        planSample(
+            &plan2, x, mode,
+            (srcHeight - 1) / 2.0 - (height2 - 1) / 2.0 - shearY * (x - (width1 - 1) / 2.0),
+            1.0, srcHeight, false);
+
+    planCreate(&plan3, height2, mode, 1.0);
+    for (uint32_t y = 0; y < height2; y++)
+        planSample(
+            &plan3, y, mode,
+            (width1 - 1) / 2.0 - (dstWidth - 1) / 2.0 - shearX * (y - (height2 - 1) / 2.0),
+            1.0, width1, false);
+
+    // the column shear wants the weights of a tap for a whole row at once
+    spread = arenaAlloc((size_t)plan2.taps * width1 * bpp * sizeof(int16_t));
+    for (uint32_t tap = 0; tap < plan2.taps; tap++)
+        for (uint32_t x = 0; x < width1; x++)
+            for (uint32_t byteIdx = 0; byteIdx < bpp; byteIdx++)
+                spread[((size_t)tap * width1 + x) * bpp + byteIdx] = plan2.weight[(size_t)x * plan2.taps + tap];
+
+    step1 = arenaAlloc((size_t)width1 * bpp * srcHeight);
+    step2 = arenaAlloc((size_t)width1 * bpp * height2);
+
+    job = (resampleJob_t){
+        shearColumns, &plan1, src, srcRowSize, srcWidth, srcHeight,
+        step1, width1 * bpp, width1, srcHeight, bpp, NULL };
+    resampleRun(&job, pool);
+
+    job = (resampleJob_t){
+        shearRows, &plan2, step1, width1 * bpp, width1, srcHeight,
+        step2, width1 * bpp, width1, height2, bpp, spread };
+    resampleRun(&job, pool);
+
+    job = (resampleJob_t){
+        shearColumns, &plan3, step2, width1 * bpp, width1, height2,
+        dst, dstRowSize, dstWidth, dstHeight, bpp, NULL };
+    resampleRun(&job, pool);
+
+    arenaFree(spread);
+    arenaFree(step1);
+    arenaFree(step2);
+    planDestroy(&plan1);
+    planDestroy(&plan2);
+    planDestroy(&plan3);
+    return;
+}
@@ -0,0 +1,58 @@
+#ifndef _GEOMETRY_H_
+#define _GEOMETRY_H_
+
+#include <stdint.h>  // int typedefs
+#include <stdbool.h> // true, false
+
+#include "threadpool.h"
+
+// side of the square tiles the 90 degree rotations are done in, in pixels
+#define TILE_SIZE    64
+
+// output rows handed to a worker at once by the resampling passes
+#define RESAMPLE_ROWS 16
+
+// number of fraction bits in the resampling weights
+#define RESAMPLE_SHIFT 14
+
+// interpolation used when resizing or rotating by an arbitrary angle
+enum resampleMode_e {
+    resampleNearest  = 0,
+    resampleBilinear = 1,
+    resampleLanczos  = 2,   // lanczos with 3 lobes
+};
+
+// rotates a width x height pixel array by 90 degrees into dst, which is
+// height x width. clockwise is meant in stored row order, row 0 on top
+void rotate90(
+    const uint8_t *src, uint32_t srcRowSize, uint32_t width, uint32_t height,
+    uint8_t *dst, uint32_t dstRowSize, uint32_t bpp, bool clockwise);
+
+// rotates a pixel array by 180 degrees in place
+void rotate180(uint8_t *data, uint32_t rowSize, uint32_t width, uint32_t height, uint32_t bpp);
+
+// mirrors the order of the scanlines in place
+void flipRows(uint8_t *data, uint32_t rowSize, uint32_t height);
+
+// mirrors the pixels within every scanline in place
+void flipColumns(uint8_t *data, uint32_t rowSize, uint32_t width, uint32_t height, uint32_t bpp);
+
+// resamples a srcWidth x srcHeight pixel array into a dstWidth x dstHeight one
+void resamplePixels(
+    const uint8_t *src, uint32_t srcRowSize, uint32_t srcWidth, uint32_t srcHeight,
+    uint8_t *dst, uint32_t dstRowSize, uint32_t dstWidth, uint32_t dstHeight,
+    uint32_t bpp, enum resampleMode_e mode, threadPool_t *pool);
+
+// size of the pixel array that holds a width x height image rotated by angle degrees
+void rotatedSize(
+    uint32_t width, uint32_t height, double angle,
+    uint32_t *newWidth, uint32_t *newHeight);
+
+// rotates a pixel array clockwise by -45 - 45 degrees into a zeroed pixel
+// array of rotatedSize, in stored row order with row 0 on top
+void rotatePixels(
+    const uint8_t *src, uint32_t srcRowSize, uint32_t srcWidth, uint32_t srcHeight,
+    uint8_t *dst, uint32_t dstRowSize, uint32_t dstWidth, uint32_t dstHeight,
+    uint32_t bpp, double angle, enum resampleMode_e mode, threadPool_t *pool);
+
+#endif//_GEOMETRY_H_
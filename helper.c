@@ -1,191 +1,2093 @@
 #include "helper.h"
 
+// records the size of the input image in stats
+static void
+statsHeader(bmpStats_t *stats, bmpInfoHeader_t *bmpIH)
+{
+    if (stats == NULL)
+        return;
+
+    stats->width    = bmpIH->Width;
+    stats->height   = (bmpIH->Height < 0) ? -bmpIH->Height : bmpIH->Height;
+    stats->bitCount = bmpIH->BitCount;
+    return;
+}
+
+// whether all the rows the filters go over, whatever SizeImage says, fit
+// the 32 bit sizes of a bmp and, when size isn't 0, the size bytes of the file
+static bool
+pixelArrayFits(bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, uint64_t size)
+{
+    uint32_t rows   = (bmpIH->Height < 0) ? -(uint32_t)bmpIH->Height : (uint32_t)bmpIH->Height;
+    uint64_t pixels = (uint64_t)bmpRowSize(bmpIH) * rows;
+
+    return pixels <= UINT32_MAX && (size == 0 || bmpFH->OffBits + pixels <= size);
+}
+
 /*!
  ******************************************************************************
  * Function Name: loadBmp                                                     *
  ******************************************************************************
  * Summary:                                                                   *
- *  Opens a file pointer to the .bmp image fills in the structs with the info *
- *  info from the .bmp image and ordens the pixel array in RGB order          *
+ *  Opens a file pointer to the .bmp image fills in the structs with the info *
+ *  info from the .bmp image and ordens the pixel array in RGB order          *
+ *  Everything between the headers and the pixel array (the palette) is kept  *
+ *  in front of the pixel array so saveBmp can write it back, use freeBmp to  *
+ *  free it. The buffer comes from the arena and is padded in front so the    *
+ *  pixel array starts on an ARENA_ALIGN boundary. RLE8 and RLE4 pixels are   *
+ *  decoded while they are read and the headers are changed to the            *
+ *  uncompressed image. The open, header and read stages are timed into stats *
+ *  when it isn't NULL                                                        *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  char *fileName                                                            *
+ *  bmpFileHeader_t *bmpFH                                                    *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  bmpStats_t *stats                                                         *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  The Pixel array location                                                  *
+ ******************************************************************************
+!*/
+uint8_t *
+loadBmp(char *fileName, bmpFileHeader_t *bmpFH ,bmpInfoHeader_t *bmpIH, bmpStats_t *stats)
+{
+    FILE *fp;           // The file pointer
+    uint8_t *bmpimg;    // pointer to store the image data
+    bool compressed;    // the pixels are RLE8 or RLE4 compressed
+    struct stat inStat; // the size of a regular file bounds the pixel array
+    bool readFailed;    // the file ended before the palette or the pixels did
+    double start;       // start of the stage being timed
+    
+    // open filename in read binary mode & check if it openend correctly
+    start = statsNow();
+    fp = fopen(fileName, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed opening file \"%s\"\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    statsStage(stats, "open", start, 0);
+
+    // read the bmp file header
+    start = statsNow();
+    fread(bmpFH, sizeof(bmpFileHeader_t), 1, fp);
+    
+    // verify that this is a bmp file by checking the bitmap ID
+    if (bmpFH->Type != 0x4D42) {
+        fprintf(stderr, "bitmap ID check error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // read the bmp info header
+    fread(bmpIH, sizeof(bmpInfoHeader_t), 1, fp);
+    compressed = bmpIH->Compression == compressionRle8 || bmpIH->Compression == compressionRle4;
+    if (compressed && !bmpRleValid(bmpIH)) {
+        fprintf(stderr, "unsupported RLE bitmap: %d bit, compression %d\n", bmpIH->BitCount, bmpIH->Compression);
+        exit(EXIT_FAILURE);
+    }
+
+    // compressed pixels are decoded, the image is uncompressed from here on
+    if (compressed) {
+        bmpIH->Compression = compressionRgb;
+        bmpIH->SizeImage   = 0;
+    }
+    bmpIH->SizeImage = bmpImageSize(bmpIH);
+
+    if (bmpFH->OffBits < sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t)) {
+        fprintf(stderr, "bitmap data offset error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the rows are checked against the file before anything is allocated for them
+    if (compressed || fstat(fileno(fp), &inStat) != 0 || !S_ISREG(inStat.st_mode))
+        inStat.st_size = 0;
+    if (!pixelArrayFits(bmpFH, bmpIH, inStat.st_size)) {
+        fprintf(stderr, "error reading image data\n");
+        exit(EXIT_FAILURE);
+    }
+    if (compressed)
+        bmpFH->Size = bmpFH->OffBits + bmpIH->SizeImage;
+    statsHeader(stats, bmpIH);
+    statsStage(stats, "header", start, sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t));
+
+    // allocate enough memory for the headers, the palette and the bitmap image data
+    // with the padding that aligns the pixel array in front of them
+    start  = statsNow();
+    bmpimg = arenaAlloc(arenaPad(bmpFH->OffBits) + bmpFH->OffBits + bmpIH->SizeImage);
+    bmpimg += arenaPad(bmpFH->OffBits);
+
+    // read in the palette and the bitmap image data after it
+    readFailed = fread(
+        bmpimg + sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t), 1,
+        bmpFH->OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t), fp)
+        != bmpFH->OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t);
+    bmpimg += bmpFH->OffBits;
+    if (compressed) {
+        rleDecoder_t dec;
+
+        rleDecoderInit(&dec, fp, (uint32_t)bmpIH->Width, bmpIH->BitCount);
+        if (!rleDecodeRows(&dec, bmpimg, (uint32_t)bmpIH->Height, bmpRowSize(bmpIH))) {
+            fprintf(stderr, "error decoding RLE image data\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (!readFailed) {
+        readFailed = fread(bmpimg, 1, bmpIH->SizeImage, fp) != bmpIH->SizeImage;
+    }
+
+    // make sure the whole bitmap image data was read, a pipe has no size to
+    // check it against up front and the row sweep goes over all of it
+    if (readFailed) {
+        fprintf(stderr, "error reading image data\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    fclose(fp); // Closes the stream. All buffers are flushed
+    statsStage(stats, "read", start, bmpFH->OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t) + bmpIH->SizeImage);
+    return bmpimg;
+}
+
+// copies width pixels from pixel x on of a scanline to the start of dst. The
+// bits of 1 and 4 bit pixels are shifted up to the first byte and the unused
+// bits of the last byte are cleared. dst may be src or lie before it
+static void
+cropRow(uint8_t *dst, const uint8_t *src, uint32_t x, uint32_t width, uint32_t bitCount)
+{
+    uint64_t first = (uint64_t)x * bitCount;                           // first bit of the pixels
+    uint32_t bytes = (uint32_t)(((uint64_t)width * bitCount + 7) / 8);  // bytes of the pixels
+    uint32_t span  = (uint32_t)((first % 8 + (uint64_t)width * bitCount + 7) / 8);
+    uint32_t shift = (uint32_t)(first % 8);
+
+    src += first / 8;
+    if (shift == 0) {
+        memmove(dst, src, bytes);
+    } else {
+        for (uint32_t byte = 0; byte < bytes; byte++)
+            dst[byte] = (uint8_t)(src[byte] << shift | ((byte + 1 < span) ? src[byte + 1] >> (8 - shift) : 0));
+    }
+    if ((uint64_t)width * bitCount % 8)
+        dst[bytes - 1] &= (uint8_t)(0xFF << (8 - (uint64_t)width * bitCount % 8));
+}
+
+// turns the headers into those of the rectangle and returns the scanline of
+// the pixel array the rectangle starts at, bottom-up images start at the
+// bottom so that is the lowest row of the rectangle
+static uint32_t
+cropHeader(bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, const bmpRect_t *rect)
+{
+    uint32_t rows  = (bmpIH->Height < 0) ? -(uint32_t)bmpIH->Height : (uint32_t)bmpIH->Height;
+    uint32_t first = (bmpIH->Height < 0) ? rect->y : rows - rect->y - rect->height;
+
+    bmpIH->Width     = (int32_t)rect->width;
+    bmpIH->Height    = (bmpIH->Height < 0) ? -(int32_t)rect->height : (int32_t)rect->height;
+    bmpIH->SizeImage = bmpRowSize(bmpIH) * rect->height;
+    bmpFH->Size      = bmpFH->OffBits + bmpIH->SizeImage;
+    return first;
+}
+
+// reads size bytes at offset, pread may stop short on large reads
+static bool
+readAt(int fd, uint8_t *buffer, uint64_t size, uint64_t offset)
+{
+    while (size > 0) {
+        ssize_t got = pread(fd, buffer, size, (off_t)offset);
+
+        if (got <= 0)
+            return false;
+        buffer += got;
+        offset += got;
+        size   -= got;
+    }
+    return true;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: loadBmpRegion                                               *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Loads only a rectangle of the image, like loadBmp does the whole of it.   *
+ *  The scanlines of the rectangle are found from OffBits and the row size,   *
+ *  so only the bytes of the rectangle are read from the file: one read when  *
+ *  it spans whole scanlines, otherwise one per scanline. The bits of 1 and 4 *
+ *  bit pixels are shifted to the start of their row. The headers and the     *
+ *  returned image are those of the rectangle, the palette is kept. RLE       *
+ *  scanlines can only be found by decoding the ones before them, so those    *
+ *  images are loaded whole and cut in place                                  *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  char *fileName                                                            *
+ *  bmpFileHeader_t *bmpFH                                                    *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  const bmpRect_t *rect                                                     *
+ *  bmpStats_t *stats                                                         *
+ *                                                                            *
+ * Return:                                                                    *
+ *  The Pixel array location                                                  *
+ ******************************************************************************
+!*/
+uint8_t *
+loadBmpRegion(
+    char *fileName, bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH,
+    const bmpRect_t *rect, bmpStats_t *stats)
+{
+    const size_t headers = sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t);
+    uint8_t *bmpimg;    // pointer to store the image data
+    uint8_t *line;      // the bytes of a scanline of 1 and 4 bit pixels before they are shifted
+    uint32_t rowSize;   // bytes per scanline of the file
+    uint32_t cropSize;  // bytes per scanline of the rectangle
+    uint32_t first;     // scanline of the file the rectangle starts at
+    uint64_t firstBit;  // bit of a scanline the rectangle starts at
+    uint32_t span;      // bytes of a scanline that hold the rectangle
+    uint64_t total;     // bytes read
+    bool failed = false;
+    double start;       // start of the stage being timed
+    int fd;             // the file descriptor
+
+    // open filename read only & check if it openend correctly
+    start = statsNow();
+    fd    = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed opening file \"%s\"\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    statsStage(stats, "open", start, 0);
+
+    // read the headers and verify that this is a bmp file
+    start = statsNow();
+    if (!readAt(fd, (uint8_t *)bmpFH, sizeof(bmpFileHeader_t), 0) || bmpFH->Type != 0x4D42) {
+        fprintf(stderr, "bitmap ID check error.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!readAt(fd, (uint8_t *)bmpIH, sizeof(bmpInfoHeader_t), sizeof(bmpFileHeader_t)) || bmpFH->OffBits < headers) {
+        fprintf(stderr, "error reading bitmap info header\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (bmpIH->Compression == compressionRle8 || bmpIH->Compression == compressionRle4) {
+        uint32_t decodedSize;
+
+        close(fd);
+        bmpimg      = loadBmp(fileName, bmpFH, bmpIH, stats);
+        decodedSize = bmpRowSize(bmpIH);
+        if (!rectInside(rect, bmpIH)) {
+            fprintf(stderr, "crop %u,%u,%u,%u is outside the %dx%d image\n",
+                rect->x, rect->y, rect->width, rect->height, bmpIH->Width, bmpIH->Height);
+            exit(EXIT_FAILURE);
+        }
+        first    = cropHeader(bmpFH, bmpIH, rect);
+        cropSize = bmpRowSize(bmpIH);
+        for (uint32_t row = 0; row < rect->height; row++) {
+            uint8_t *dst = bmpimg + (size_t)row * cropSize;
+            uint32_t bytes = (uint32_t)(((uint64_t)rect->width * bmpIH->BitCount + 7) / 8);
+
+            cropRow(dst, bmpimg + (size_t)(first + row) * decodedSize, rect->x, rect->width, bmpIH->BitCount);
+            memset(dst + bytes, 0, cropSize - bytes);
+        }
+        return bmpimg;
+    }
+
+    bmpIH->SizeImage = bmpImageSize(bmpIH);
+    if (!pixelArrayFits(bmpFH, bmpIH, 0)) {
+        fprintf(stderr, "error reading image data\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!rectInside(rect, bmpIH)) {
+        fprintf(stderr, "crop %u,%u,%u,%u is outside the %dx%d image\n",
+            rect->x, rect->y, rect->width, rect->height, bmpIH->Width, bmpIH->Height);
+        exit(EXIT_FAILURE);
+    }
+    statsHeader(stats, bmpIH);
+    statsStage(stats, "header", start, headers);
+
+    start    = statsNow();
+    rowSize  = bmpRowSize(bmpIH);
+    firstBit = (uint64_t)rect->x * bmpIH->BitCount;
+    span     = (uint32_t)((firstBit % 8 + (uint64_t)rect->width * bmpIH->BitCount + 7) / 8);
+    first    = cropHeader(bmpFH, bmpIH, rect);
+    cropSize = bmpRowSize(bmpIH);
+
+    // the palette goes in front of the pixel array like loadBmp keeps it
+    bmpimg  = arenaAlloc(arenaPad(bmpFH->OffBits) + bmpFH->OffBits + bmpIH->SizeImage);
+    bmpimg += arenaPad(bmpFH->OffBits);
+    failed  = !readAt(fd, bmpimg + headers, bmpFH->OffBits - headers, headers);
+    bmpimg += bmpFH->OffBits;
+    total   = bmpFH->OffBits - headers;
+
+    if (cropSize == rowSize && rect->x == 0) {
+        // whole scanlines follow each other in the file
+        failed |= !readAt(fd, bmpimg, bmpIH->SizeImage, bmpFH->OffBits + (uint64_t)first * rowSize);
+        total  += bmpIH->SizeImage;
+    } else {
+        uint32_t bytes = (uint32_t)(((uint64_t)rect->width * bmpIH->BitCount + 7) / 8);
+
+        line = (firstBit % 8) ? arenaAlloc(span) : NULL;
+        for (uint32_t row = 0; row < rect->height && !failed; row++) {
+            uint8_t *dst    = bmpimg + (size_t)row * cropSize;
+            uint64_t offset = bmpFH->OffBits + (uint64_t)(first + row) * rowSize + firstBit / 8;
+
+            failed = !readAt(fd, (line != NULL) ? line : dst, span, offset);
+            if (line != NULL)
+                cropRow(dst, line, (uint32_t)(firstBit % 8) / bmpIH->BitCount, rect->width, bmpIH->BitCount);
+            else
+                cropRow(dst, dst, 0, rect->width, bmpIH->BitCount);
+            memset(dst + bytes, 0, cropSize - bytes);
+            total += span;
+        }
+        arenaFree(line);
+    }
+
+    if (failed) {
+        fprintf(stderr, "error reading image data\n");
+        exit(EXIT_FAILURE);
+    }
+
+    close(fd);
+    statsStage(stats, "read", start, total);
+    return bmpimg;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: writeBmp                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Writes the headers, the palette loadBmp kept in front of the pixel array  *
+ *  and the pixels. With RLE8 or RLE4 in Compression the rows are compressed  *
+ *  one at the time, bottom row first so a top-down image is stored           *
+ *  bottom-up as RLE requires, and the sizes in the headers are patched once  *
+ *  the compressed size is known. The headers passed in are left as they are  *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  FILE *fp                                                                  *
+ *  bmpFileHeader_t *bmpFH                                                    *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  uint8_t *bmpData                                                          *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  the number of bytes written, 0 when writing failed                        *
+ ******************************************************************************
+!*/
+uint64_t
+writeBmp(FILE *fp, bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, uint8_t *bmpData)
+{
+    bmpFileHeader_t fileHeader = *bmpFH;
+    bmpInfoHeader_t infoHeader = *bmpIH;
+    uint32_t rowSize = bmpRowSize(bmpIH);
+    uint32_t rows    = (bmpIH->Height < 0) ? -(uint32_t)bmpIH->Height : (uint32_t)bmpIH->Height;
+    uint64_t pixels  = 0;
+    bool compress    = bmpIH->Compression == compressionRle8 || bmpIH->Compression == compressionRle4;
+
+    if (compress)
+        infoHeader.Height = (int32_t)rows;
+
+    // write the bmp file header and the bmp info header
+    if (fwrite(&fileHeader, 1, sizeof(bmpFileHeader_t), fp) != sizeof(bmpFileHeader_t) ||
+        fwrite(&infoHeader, 1, sizeof(bmpInfoHeader_t), fp) != sizeof(bmpInfoHeader_t))
+        return 0;
+    
+    // write the palette loadBmp kept in front of the pixel array
+    if (fwrite(
+            bmpData - bmpFH->OffBits + sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t), 1,
+            bmpFH->OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t), fp) !=
+        bmpFH->OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t))
+        return 0;
+    
+    // write the bmp pixel array
+    if (!compress)
+        return (fwrite(bmpData, 1, bmpIH->SizeImage, fp) == bmpIH->SizeImage)
+             ? (uint64_t)bmpFH->OffBits + bmpIH->SizeImage : 0;
+
+    for (uint32_t row = 0; row < rows; row++) {
+        uint32_t stored = (bmpIH->Height < 0) ? rows - 1 - row : row;
+        uint64_t size   = rleEncodeRows(
+            fp, bmpData + (size_t)stored * rowSize, 1, rowSize, (uint32_t)bmpIH->Width, bmpIH->BitCount);
+
+        if (size == 0)
+            return 0;
+        pixels += size;
+    }
+    pixels += rleEncodeEnd(fp);
+
+    // now that the compressed size is known fill it in
+    infoHeader.SizeImage = (uint32_t)pixels;
+    fileHeader.Size      = (uint32_t)(bmpFH->OffBits + pixels);
+    if (fseek(fp, 0, SEEK_SET) != 0 ||
+        fwrite(&fileHeader, 1, sizeof(bmpFileHeader_t), fp) != sizeof(bmpFileHeader_t) ||
+        fwrite(&infoHeader, 1, sizeof(bmpInfoHeader_t), fp) != sizeof(bmpInfoHeader_t))
+        return 0;
+
+    return bmpFH->OffBits + pixels;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: saveBmp                                                     *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Writes the image with writeBmp, the whole write is timed into stats when  *
+ *  it isn't NULL                                                             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  char *fileName                                                            *
+ *  bmpFileHeader_t *bmpFH                                                    *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  uint8_t *bmpData                                                          *
+ *  bmpStats_t *stats                                                         *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  none                                                                      *
+ ******************************************************************************
+!*/
+void 
+saveBmp(
+    char *fileName, bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, 
+    uint8_t *bmpData, bmpStats_t *stats)
+{
+    double start = statsNow();
+    uint64_t written;
+    FILE *fp;
+    
+    // open filename in write binary mode & check if it openend correctly
+    fp = fopen(fileName, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed opening file \"%s\"\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    
+    written = writeBmp(fp, bmpFH, bmpIH, bmpData);
+    if (fclose(fp) != 0 || written == 0) { // Closes the stream. All buffers are flushed
+        fprintf(stderr, "error writing \"%s\"\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    statsStage(stats, "write", start, written);
+    return;
+}
+
+// gives a pixel array returned by loadBmp or rotate back to the arena
+void
+freeBmp(bmpFileHeader_t *bmpFH, uint8_t *bmpData)
+{
+    arenaFree(bmpData - bmpFH->OffBits);
+    return;
+}
+
+// the mapping whose temporary output an exit removes, see mapBmp
+static bmpMap_t *pendingMap = NULL;
+
+static void
+removePendingMap(void)
+{
+    if (pendingMap != NULL && pendingMap->temp != NULL)
+        unlink(pendingMap->temp);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: mapBmp                                                      *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Maps the input .bmp read only, creates the output file with ftruncate and *
+ *  maps it shared. The input is copied once into the output mapping so the   *
+ *  filters can edit the output pages directly and nothing has to be written  *
+ *  back with stdio. Pipes, devices, an output that is the input itself and   *
+ *  RLE compressed images can't be mapped, for those NULL is returned and the *
+ *  caller falls back on loadBmp/saveBmp. Copying into the output mapping is  *
+ *  timed as the read stage. The output is created under a temporary name     *
+ *  next to it, which unmapBmp renames once the image is done. An exit before *
+ *  that removes the temporary file, so a run that fails on the format or the *
+ *  options leaves an existing output as it was. The rename replaces the      *
+ *  directory entry, so an output that is a symlink or a device, has other    *
+ *  hard links, another owner or an ACL is left to saveBmp, which writes      *
+ *  through it. An existing output keeps its mode                             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  char *inName                                                              *
+ *  char *outName                                                             *
+ *  bmpFileHeader_t *bmpFH                                                    *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  bmpMap_t *bmpMap                                                          *
+ *  bmpStats_t *stats                                                         *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  The pixel array location inside the output mapping or NULL                *
+ ******************************************************************************
+!*/
+uint8_t *
+mapBmp(
+    char *inName, char *outName, bmpFileHeader_t *bmpFH, 
+    bmpInfoHeader_t *bmpIH, bmpMap_t *bmpMap, bmpStats_t *stats)
+{
+    const size_t chunk = 8 << 20; // copy in 8MiB steps so the input pages can be dropped
+    double start = statsNow();    // start of the stage being timed
+    struct stat inStat;           // info about the input file
+    struct stat outStat;          // info about an already existing output file
+    uint8_t *inMap;               // read only mapping of the input file
+    size_t length;                // bytes of the input that make up the bmp
+    size_t copied;                // bytes already copied into the output
+    int inFd, outFd;              // file descriptors
+
+    bmpMap->base   = NULL;
+    bmpMap->length = 0;
+    bmpMap->temp   = NULL;
+
+    // only regular files can be mapped
+    if (stat(inName, &inStat) != 0 || !S_ISREG(inStat.st_mode))
+        return NULL;
+
+    // an existing output has to be a plain regular file that isn't the input
+    // itself, lstat so a symlink isn't replaced by the rename
+    if (lstat(outName, &outStat) == 0) {
+        if (!S_ISREG(outStat.st_mode) || outStat.st_nlink > 1 || outStat.st_uid != geteuid())
+            return NULL;
+        if (outStat.st_dev == inStat.st_dev && outStat.st_ino == inStat.st_ino)
+            return NULL;
+        if (lgetxattr(outName, "system.posix_acl_access", NULL, 0) > 0)
+            return NULL;
+    } else {
+        outStat.st_mode = 0;
+    }
+
+    if ((size_t)inStat.st_size < sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t))
+        return NULL; // let loadBmp report the broken file
+
+    // open and map the input file
+    inFd = open(inName, O_RDONLY);
+    if (inFd < 0) {
+        fprintf(stderr, "Failed opening file \"%s\"\n", inName);
+        exit(EXIT_FAILURE);
+    }
+
+    inMap = mmap(NULL, inStat.st_size, PROT_READ, MAP_PRIVATE, inFd, 0);
+    close(inFd); // the mapping keeps its own reference to the file
+    if (inMap == MAP_FAILED)
+        return NULL;
+
+    // compressed pixels can't be edited in place, loadBmp decodes them
+    memcpy(bmpIH, inMap + sizeof(bmpFileHeader_t), sizeof(bmpInfoHeader_t));
+    if (bmpIH->Compression == compressionRle8 || bmpIH->Compression == compressionRle4) {
+        munmap(inMap, inStat.st_size);
+        return NULL;
+    }
+
+    madvise(inMap, inStat.st_size, MADV_SEQUENTIAL);
+    statsStage(stats, "open", start, 0);
+
+    // read the headers straight from the mapping
+    start = statsNow();
+    memcpy(bmpFH, inMap, sizeof(bmpFileHeader_t));
+    
+    // verify that this is a bmp file by checking the bitmap ID
+    if (bmpFH->Type != 0x4D42) {
+        fprintf(stderr, "bitmap ID check error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(bmpIH, inMap + sizeof(bmpFileHeader_t), sizeof(bmpInfoHeader_t));
+    bmpIH->SizeImage = bmpImageSize(bmpIH);
+
+    // make sure the whole pixel array is present in the file
+    length = (size_t)bmpFH->OffBits + bmpIH->SizeImage;
+    if (!pixelArrayFits(bmpFH, bmpIH, inStat.st_size)) {
+        fprintf(stderr, "error reading image data\n");
+        exit(EXIT_FAILURE);
+    }
+    statsHeader(stats, bmpIH);
+    statsStage(stats, "header", start, sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t));
+
+    // create the output file with its final size under a temporary name and map it
+    start = statsNow();
+    bmpMap->name = outName;
+    bmpMap->temp = malloc(strlen(outName) + 32);
+    if (bmpMap->temp == NULL) {
+        fprintf(stderr, "memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(bmpMap->temp, "%s.%ld.tmp", outName, (long)getpid());
+    outFd = open(bmpMap->temp, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (outFd < 0) {
+        // a directory we can't create files in, saveBmp may still write the output
+        munmap(inMap, inStat.st_size);
+        free(bmpMap->temp);
+        bmpMap->temp = NULL;
+        return NULL;
+    }
+    if (pendingMap == NULL)
+        atexit(removePendingMap);
+    pendingMap = bmpMap;
+    if (outStat.st_mode != 0)
+        fchmod(outFd, outStat.st_mode & 07777);
+
+    if (ftruncate(outFd, length) != 0) {
+        fprintf(stderr, "Failed resizing file \"%s\"\n", outName);
+        exit(EXIT_FAILURE);
+    }
+
+    bmpMap->base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, outFd, 0);
+    close(outFd);
+    if (bmpMap->base == MAP_FAILED) {
+        fprintf(stderr, "Failed mapping file \"%s\"\n", outName);
+        exit(EXIT_FAILURE);
+    }
+    bmpMap->length = length;
+
+    // copy the headers, color table and pixels over, dropping the input pages 
+    // behind us so only one copy of the image stays resident
+    for (copied = 0; copied < length; copied += chunk) {
+        size_t size = (length - copied < chunk) ? length - copied : chunk;
+
+        memcpy(bmpMap->base + copied, inMap + copied, size);
+        madvise(inMap + copied, size, MADV_DONTNEED);
+    }
+
+    munmap(inMap, inStat.st_size);
+
+    // the copied header gets the real size of the pixel array
+    memcpy(bmpMap->base + sizeof(bmpFileHeader_t), bmpIH, sizeof(bmpInfoHeader_t));
+    statsStage(stats, "read", start, length - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t));
+    return bmpMap->base + bmpFH->OffBits;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: unmapBmp                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Releases the output mapping made by mapBmp and renames the output to its  *
+ *  real name. The pages are shared with the file so the kernel writes the    *
+ *  edited image back on its own, the write stage only times handing the      *
+ *  dirty pages over to it                                                    *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  bmpMap_t *bmpMap                                                          *
+ *  bmpStats_t *stats                                                         *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  none                                                                      *
+ ******************************************************************************
+!*/
+void
+unmapBmp(bmpMap_t *bmpMap, bmpStats_t *stats)
+{
+    double start = statsNow();
+
+    if (bmpMap->base != NULL)
+        munmap(bmpMap->base, bmpMap->length);
+    if (bmpMap->temp != NULL && rename(bmpMap->temp, bmpMap->name) != 0) {
+        fprintf(stderr, "Failed renaming file \"%s\" to \"%s\"\n", bmpMap->temp, bmpMap->name);
+        exit(EXIT_FAILURE);
+    }
+    statsStage(stats, "write", start, bmpMap->length);
+
+    pendingMap = NULL;
+    free(bmpMap->temp);
+    bmpMap->base   = NULL;
+    bmpMap->length = 0;
+    bmpMap->temp   = NULL;
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: streamBmp                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Copies the headers and color table to the output as they are and then     *
+ *  reads the pixel array in bands of whole scanlines. Every band is passed   *
+ *  through the point operations and written out before the next one is read  *
+ *  so memory use is bound by maxMem instead of by the image size. The row    *
+ *  padding is left untouched and the sign of Height only decides the order   *
+ *  of the rows, which doesn't matter for per pixel operations. RLE input is  *
+ *  decoded a band at the time and with compress set to RLE8 or RLE4 every    *
+ *  band is compressed on its way out, the sizes in the output headers are    *
+ *  patched at the end. The read, ops and write stages of every band add up   *
+ *  in stats. The histogram, when asked for, is counted band by band in the   *
+ *  same pass as the operations                                               *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  char *inName                                                              *
+ *  char *outName                                                             *
+ *  size_t maxMem                                                             *
+ *  enum bmpCompression_e compress                                            *
+ *  const opChain_t *chain                                                    *
+ *  pixelHistogram_t *histogram                                               *
+ *  threadPool_t *pool                                                        *
+ *  bmpStats_t *stats                                                         *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  none                                                                      *
+ ******************************************************************************
+!*/
+void
+streamBmp(
+    char *inName, char *outName, size_t maxMem, enum bmpCompression_e compress,
+    const opChain_t *chain, pixelHistogram_t *histogram, threadPool_t *pool,
+    bmpStats_t *stats)
+{
+    FILE *in, *out;           // the file pointers
+    bmpFileHeader_t bmpFH;    // header of the input file
+    bmpInfoHeader_t bmpIH;    // info header of the input file
+    bmpFileHeader_t outFH;    // header of the output file
+    bmpInfoHeader_t outIH;    // info header of the output file
+    pixelFormat_t format;     // how the pixels are stored
+    rleDecoder_t dec;         // decoder of RLE input
+    bool compressed;          // the input is RLE8 or RLE4
+    uint8_t *band;            // buffer holding one band of scanlines
+    uint32_t rowSize;         // bytes per scanline including padding
+    uint32_t rows;            // number of scanlines in the image
+    uint32_t bandRows;        // number of scanlines per band
+    uint32_t done;            // number of scanlines processed
+    uint64_t pixels = 0;      // bytes of the compressed output pixels
+    size_t gap;               // bytes between the info header and the pixels
+    double start;             // start of the stage being timed
+
+    // open filename in read binary mode & check if it openend correctly
+    start = statsNow();
+    in    = fopen(inName, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Failed opening file \"%s\"\n", inName);
+        exit(EXIT_FAILURE);
+    }
+    statsStage(stats, "open", start, 0);
+
+    start = statsNow();
+
+    // read the headers and verify that this is a bmp file
+    if (fread(&bmpFH, sizeof(bmpFileHeader_t), 1, in) != 1 || bmpFH.Type != 0x4D42) {
+        fprintf(stderr, "bitmap ID check error.\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    if (fread(&bmpIH, sizeof(bmpInfoHeader_t), 1, in) != 1 ||
+        bmpFH.OffBits < sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t)) {
+        fprintf(stderr, "error reading bitmap info header\n");
+        exit(EXIT_FAILURE);
+    }
+    statsHeader(stats, &bmpIH);
+    statsStage(stats, "header", start, sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t));
+
+    // compressed input is decoded, from here on it is an uncompressed image
+    compressed = bmpIH.Compression == compressionRle8 || bmpIH.Compression == compressionRle4;
+    if (compressed && !bmpRleValid(&bmpIH)) {
+        fprintf(stderr, "unsupported RLE bitmap: %d bit, compression %d\n", bmpIH.BitCount, bmpIH.Compression);
+        exit(EXIT_FAILURE);
+    }
+    if (compressed) {
+        bmpIH.Compression = compressionRgb;
+        bmpIH.SizeImage   = 0;
+    }
+
+    rowSize  = bmpRowSize(&bmpIH);
+    rows     = (bmpIH.Height < 0) ? -(uint32_t)bmpIH.Height : (uint32_t)bmpIH.Height;
+
+    // RLE rows are stored bottom-up and are written in the order they are read
+    if (compress != compressionRgb &&
+        (bmpIH.Height < 0 || bmpIH.BitCount != ((compress == compressionRle8) ? 8 : 4))) {
+        fprintf(stderr, "can't compress a %d bit %s image as RLE%d\n", bmpIH.BitCount,
+            (bmpIH.Height < 0) ? "top-down" : "bottom-up", (compress == compressionRle8) ? 8 : 4);
+        exit(EXIT_FAILURE);
+    }
+
+    // work out how many scanlines fit in the memory cap
+    if (maxMem < rowSize) {
+        fprintf(stderr, "max-mem of %zu bytes can't hold a scanline of %u bytes\n", maxMem, rowSize);
+        exit(EXIT_FAILURE);
+    }
+    bandRows = (maxMem / rowSize < rows) ? maxMem / rowSize : rows;
+    if (bandRows == 0) bandRows = 1;
+
+    // the band buffer is also used to pass the header gap (color table) through
+    gap  = bmpFH.OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t);
+    band = arenaAlloc(((size_t)bandRows * rowSize > gap) ? (size_t)bandRows * rowSize : gap);
+
+    start = statsNow();
+    if (fread(band, 1, gap, in) != gap) {
+        fprintf(stderr, "error reading color table\n");
+        exit(EXIT_FAILURE);
+    }
+    statsStage(stats, "read", start, gap);
+    rleDecoderInit(&dec, in, (uint32_t)bmpIH.Width, bmpIH.BitCount);
+
+    // indexed images only need their palette edited, the pixels pass as is
+    if (!parseFormat(&bmpIH, band, gap, &format)) {
+        fprintf(stderr, "unsupported bitmap format: %d bit, compression %d\n", bmpIH.BitCount, bmpIH.Compression);
+        exit(EXIT_FAILURE);
+    }
+    processPalette(band, &format, chain);
+    if (histogram != NULL)
+        histogramInit(
+            histogram, (uint32_t)bmpIH.Width, rows,
+            (format.layout == layoutIndexed) ? band + format.palette : NULL, format.colors);
+
+    // open filename in write binary mode & check if it openend correctly
+    start = statsNow();
+    out   = fopen(outName, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Failed opening file \"%s\"\n", outName);
+        exit(EXIT_FAILURE);
+    }
+
+    // the sizes of compressed output are patched once all bands are written,
+    // bitfields images keep their compression when they aren't compressed
+    outFH = bmpFH;
+    outIH = bmpIH;
+    outIH.Compression = (compress != compressionRgb || compressed) ? compress : bmpIH.Compression;
+    outIH.SizeImage   = (compress == compressionRgb) ? rowSize * rows : 0;
+    outFH.Size        = bmpFH.OffBits + outIH.SizeImage;
+
+    fwrite(&outFH, 1, sizeof(bmpFileHeader_t), out);
+    fwrite(&outIH, 1, sizeof(bmpInfoHeader_t), out);
+    fwrite(band, 1, gap, out);
+    statsStage(stats, "write", start, bmpFH.OffBits);
+
+    // read, edit and write the pixel array one band at the time
+    for (done = 0; done < rows; done += bandRows) {
+        uint32_t count = (rows - done < bandRows) ? rows - done : bandRows;
+        bmpInfoHeader_t bandIH = bmpIH;
+        bool failed;
+
+        start  = statsNow();
+        failed = compressed ? !rleDecodeRows(&dec, band, count, rowSize)
+                            : fread(band, rowSize, count, in) != count;
+        if (failed) {
+            fprintf(stderr, "error reading image data\n");
+            exit(EXIT_FAILURE);
+        }
+        statsStage(stats, "read", start, (uint64_t)count * rowSize);
+
+        start = statsNow();
+        // the band is an image of its own, gamma only needs the one pixel
+        bandIH.Height = (int32_t)count;
+        processImage(band, &bandIH, &format, chain, histogram, pool);
+        statsStage(stats, "ops", start, (uint64_t)count * rowSize);
+
+        start = statsNow();
+        if (compress != compressionRgb) {
+            uint64_t size = rleEncodeRows(out, band, count, rowSize, (uint32_t)bmpIH.Width, bmpIH.BitCount);
+
+            failed  = size == 0;
+            pixels += size;
+        } else {
+            failed = fwrite(band, rowSize, count, out) != count;
+        }
+        if (failed) {
+            fprintf(stderr, "error writing image data\n");
+            exit(EXIT_FAILURE);
+        }
+        statsStage(stats, "write", start, (uint64_t)count * rowSize);
+    }
+
+    arenaFree(band);
+    fclose(in);
+    start = statsNow();
+
+    // finish the compressed pixels and fill in their size
+    if (compress != compressionRgb) {
+        pixels += rleEncodeEnd(out);
+        outIH.SizeImage = (uint32_t)pixels;
+        outFH.Size      = (uint32_t)(bmpFH.OffBits + pixels);
+        if (fseek(out, 0, SEEK_SET) != 0 ||
+            fwrite(&outFH, 1, sizeof(bmpFileHeader_t), out) != sizeof(bmpFileHeader_t) ||
+            fwrite(&outIH, 1, sizeof(bmpInfoHeader_t), out) != sizeof(bmpInfoHeader_t)) {
+            fprintf(stderr, "error writing \"%s\", RLE output needs a seekable file\n", outName);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    fclose(out); // Closes the stream. All buffers are flushed
+    statsStage(stats, "write", start, 0);
+    return;
+}
+
+// work shared by the processRows chunks
+typedef struct rowJob_s {
+    uint8_t *rows;                // first scanline
+    uint32_t count;               // number of scanlines
+    uint32_t rowSize;             // bytes per scanline including padding
+    uint32_t rowBytes;            // bytes per scanline without padding
+    uint32_t chunkRows;           // scanlines per chunk
+    uint32_t width;               // pixels per scanline
+    uint32_t bitCount;            // bits per pixel
+    const pixelFormat_t *format;  // how the pixels are stored
+    const opChain_t *chain;       // operations to apply
+    const pixelHistogram_t *histogram; // holds the palette, NULL when nothing is counted
+    pixelHistogram_t *partial;    // the histogram of every worker
+} rowJob_t;
+
+static void
+processChunk(void *ctx, uint32_t chunk)
+{
+    rowJob_t *job  = ctx;
+    uint32_t first = chunk * job->chunkRows;
+    uint32_t last  = (first + job->chunkRows < job->count) ? first + job->chunkRows : job->count;
+    pixelHistogram_t *partial = (job->partial != NULL) ? &job->partial[poolWorker()] : NULL;
+
+    for (uint32_t row = first; row < last; row++) {
+        uint8_t *line = job->rows + (size_t)row * job->rowSize;
+
+        // the lookup table goes before the matrices, indexed images have none
+        if (job->chain->lut != NULL) {
+            switch (job->format->layout) {
+                       case layoutBgr24:   lutApply(line, job->width, 3, job->chain->lut);
+                break; case layoutBgrx32:  lutApply(line, job->width, 4, job->chain->lut);
+                break; case layoutIndexed:
+                break; default:            lutApplyPacked(line, job->width, job->format, job->chain->lut);
+            }
+        }
+
+        switch ((job->chain->count != 0) ? job->format->layout : layoutIndexed) {
+                   case layoutBgr24:   applyOps(line, job->rowBytes, job->chain);
+            break; case layoutBgrx32:  kernels.chain32(line, job->rowBytes, job->chain);
+            break; case layoutRgb555:  kernels.chain555(line, job->rowBytes, job->chain);
+            break; case layoutRgb565:  kernels.chain565(line, job->rowBytes, job->chain);
+            break; case layoutMasks:   applyOpsPackedScalar(line, job->rowBytes, job->format, job->chain);
+            break; default:            break;
+        }
+
+        // count the row while it is still in the cache from the operations
+        if (partial != NULL)
+            histogramRow(partial, line, job->width, job->bitCount, job->format, job->histogram);
+    }
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: processRows                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Splits the scanlines into chunks of about CHUNK_BYTES and runs the point  *
+ *  operations on them with the thread pool. Chunks always hold whole         *
+ *  scanlines so no pixel is split between two workers, and the operations    *
+ *  only touch the pixel bytes of a scanline, never the padding. Every row is *
+ *  handed to the kernel of its pixel format, after the lookup table of the   *
+ *  chain if it has one. Indexed images are left alone since processPalette   *
+ *  edits their colors. With a histogram every worker counts the rows it just *
+ *  edited into a histogram of its own, so there is no second pass over the   *
+ *  pixels and no contention on the counts, and those are added to the        *
+ *  histogram at the end                                                      *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *rows                                                             *
+ *  uint32_t count                                                            *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  const pixelFormat_t *format                                               *
+ *  const opChain_t *chain                                                    *
+ *  pixelHistogram_t *histogram                                               *
+ *  threadPool_t *pool                                                        *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+processRows(
+    uint8_t *rows, uint32_t count, bmpInfoHeader_t *bmpIH, const pixelFormat_t *format,
+    const opChain_t *chain, pixelHistogram_t *histogram, threadPool_t *pool)
+{
+    uint32_t workers = poolSize(pool);
+    rowJob_t job;
+
+    job.rows      = rows;
+    job.count     = count;
+    job.rowSize   = bmpRowSize(bmpIH);
+    job.rowBytes  = (uint32_t)(((uint64_t)(uint32_t)bmpIH->Width * bmpIH->BitCount + 7) / 8);
+    job.chunkRows = (job.rowSize < CHUNK_BYTES) ? CHUNK_BYTES / job.rowSize : 1;
+    job.width     = (uint32_t)bmpIH->Width;
+    job.bitCount  = bmpIH->BitCount;
+    job.format    = format;
+    job.chain     = chain;
+    job.histogram = histogram;
+    job.partial   = NULL;
+
+    if (count == 0 || (histogram == NULL && ((chain->count == 0 && chain->lut == NULL) || format->layout == layoutIndexed)))
+        return;
+
+    if (histogram != NULL) {
+        job.partial = arenaAlloc(workers * sizeof(pixelHistogram_t));
+        for (uint32_t worker = 0; worker < workers; worker++)
+            histogramInit(&job.partial[worker], 0, 0, NULL, 0);
+    }
+
+    poolRun(pool, (count + job.chunkRows - 1) / job.chunkRows, processChunk, &job);
+
+    if (histogram != NULL) {
+        for (uint32_t worker = 0; worker < workers; worker++)
+            histogramMerge(histogram, &job.partial[worker]);
+        arenaFree(job.partial);
+    }
+    return;
+}
+
+// true for the operations convolvePixels runs
+static inline bool
+opConvolves(enum filterID_e op)
+{
+    return op >= blur && op <= edges;
+}
+
+// true for the operations applied as a lookup table
+static inline bool
+opLooksUp(enum filterID_e op)
+{
+    return op >= gammaCurve && op <= equalize;
+}
+
+bool
+chainConvolves(const opChain_t *chain)
+{
+    for (uint32_t opIdx = 0; opIdx < chain->count; opIdx++)
+        if (opConvolves(chain->op[opIdx]))
+            return true;
+
+    return false;
+}
+
+bool
+chainWholeImage(const opChain_t *chain)
+{
+    for (uint32_t opIdx = 0; opIdx < chain->count; opIdx++)
+        if (opConvolves(chain->op[opIdx]) || chain->op[opIdx] == autolevels || chain->op[opIdx] == equalize)
+            return true;
+
+    return false;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: processImage                                                *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Cuts the chain at every neighborhood operation and lookup table. The      *
+ *  point operations in between still run fused in one pass with processRows, *
+ *  every blur, sharpen or edge detection is a tiled convolvePixels from the  *
+ *  image into a second pixel array. The two arrays swap roles after every    *
+ *  convolution and the result is copied back when it ends up in the second   *
+ *  one, so the image can live in a mapping or a batch buffer. A lookup table *
+ *  is built once for the whole image and applied at the start of the next    *
+ *  pass, gamma straight after a table is folded into it. autolevels and      *
+ *  equalize need the histogram of the image so far, which the pass before    *
+ *  counts while it edits the pixels, so a chain that starts with one of them *
+ *  reads the image once more than one without. The histogram is counted by   *
+ *  the last processRows                                                      *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *bmpData                                                          *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  const pixelFormat_t *format                                               *
+ *  const opChain_t *chain                                                    *
+ *  pixelHistogram_t *histogram                                               *
+ *  threadPool_t *pool                                                        *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  false when the image can't be convolved or stretched                      *
+ ******************************************************************************
+!*/
+bool
+processImage(
+    uint8_t *bmpData, bmpInfoHeader_t *bmpIH, const pixelFormat_t *format,
+    const opChain_t *chain, pixelHistogram_t *histogram, threadPool_t *pool)
+{
+    uint32_t rows    = (bmpIH->Height < 0) ? -(uint32_t)bmpIH->Height : (uint32_t)bmpIH->Height;
+    uint32_t rowSize = bmpRowSize(bmpIH);
+    uint8_t *image   = bmpData;   // the pixel array holding the image so far
+    uint8_t *spare   = NULL;      // the other pixel array
+    opChain_t points = { 0 };     // the point operations since the last cut
+    channelLut_t lut;             // lookup table of the next pass
+    channelLut_t next;            // gamma table folded into lut
+    pixelHistogram_t counts;      // the image so far, for autolevels and equalize
+    bool cuts = false;            // the chain has to be cut
+
+    for (uint32_t opIdx = 0; opIdx < chain->count; opIdx++)
+        cuts |= opConvolves(chain->op[opIdx]) || opLooksUp(chain->op[opIdx]);
+
+    // gamma on indexed images is done to the palette by processPalette
+    if (!cuts || format->layout == layoutIndexed) {
+        if (chainWholeImage(chain))
+            return false;
+        processRows(bmpData, rows, bmpIH, format, chain, histogram, pool);
+        return true;
+    }
+
+    if (chainConvolves(chain)) {
+        if (format->layout != layoutBgr24 && format->layout != layoutBgrx32)
+            return false;
+        spare = arenaAlloc((size_t)rowSize * rows);
+    }
+
+    for (uint32_t opIdx = 0; opIdx <= chain->count; opIdx++) {
+        static const enum convolveMode_e modes[] = {
+            [blur] = convolveGaussian, [boxblur] = convolveBox,
+            [sharpen] = convolveSharpen, [edges] = convolveSobel,
+        };
+        enum filterID_e op = (opIdx < chain->count) ? chain->op[opIdx] : none;
+        bool stretch       = op == autolevels || op == equalize;
+        uint8_t *swap;
+
+        if (opIdx < chain->count && !opConvolves(op) && !opLooksUp(op)) {
+            points.op[points.count] = op;
+            memcpy(points.arg[points.count], chain->arg[opIdx], sizeof(chain->arg[0]));
+            points.matrix[points.count++] = chain->matrix[opIdx];
+            continue;
+        }
+
+        if (op == gammaCurve && points.count == 0) {
+            lutGamma(&next, chain->arg[opIdx][0]);
+            if (points.lut == NULL)
+                lut = next;
+            else
+                lutCompose(&lut, &next);
+            points.lut = &lut;
+            continue;
+        }
+
+        if (stretch)
+            histogramInit(&counts, (uint32_t)bmpIH->Width, rows, NULL, 0);
+        processRows(
+            image, rows, bmpIH, format, &points,
+            (opIdx == chain->count) ? histogram : stretch ? &counts : NULL, pool);
+        points.count = 0;
+        points.lut   = NULL;
+        if (opIdx == chain->count)
+            break;
+
+        switch (op) {
+            case gammaCurve:
+                lutGamma(&lut, chain->arg[opIdx][0]);
+                points.lut = &lut;
+                break;
+
+            case autolevels:
+                lutLevels(&lut, &counts, chain->arg[opIdx][0]);
+                points.lut = &lut;
+                break;
+
+            case equalize:
+                lutEqualize(&lut, &counts);
+                points.lut = &lut;
+                break;
+
+            default:
+                convolvePixels(
+                    image, spare, rowSize, (uint32_t)bmpIH->Width, rows, format->bytes,
+                    modes[op], chain->arg[opIdx][0], pool);
+                swap  = image;
+                image = spare;
+                spare = swap;
+                break;
+        }
+    }
+
+    // only the pixels are copied, the padding of the image stays as it is
+    if (image != bmpData) {
+        uint32_t rowBytes = (uint32_t)bmpIH->Width * format->bytes;
+
+        for (uint32_t row = 0; row < rows; row++)
+            memcpy(bmpData + (size_t)row * rowSize, image + (size_t)row * rowSize, rowBytes);
+        spare = image;
+    }
+
+    arenaFree(spare);
+    return true;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: processRegion                                               *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Runs the chain on the pixels inside a rectangle only. When the rectangle  *
+ *  spans whole scanlines those are an image of their own and are edited in   *
+ *  place, otherwise the rectangle is copied out into a pixel array of its    *
+ *  own, run through processImage and copied back, so only its pixels are     *
+ *  touched. Convolutions see the edges of the rectangle as the edges of the  *
+ *  image. Indexed images share one palette over the whole image, their       *
+ *  pixels can only be counted                                                *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *bmpData                                                          *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  const pixelFormat_t *format                                               *
+ *  const bmpRect_t *rect                                                     *
+ *  const opChain_t *chain                                                    *
+ *  pixelHistogram_t *histogram                                               *
+ *  threadPool_t *pool                                                        *
+ *                                                                            *
+ * Return:                                                                    *
+ *  false when processImage fails or the palette would have to change         *
+ ******************************************************************************
+!*/
+bool
+processRegion(
+    uint8_t *bmpData, bmpInfoHeader_t *bmpIH, const pixelFormat_t *format,
+    const bmpRect_t *rect, const opChain_t *chain, pixelHistogram_t *histogram,
+    threadPool_t *pool)
+{
+    uint32_t rowSize = bmpRowSize(bmpIH);
+    bmpFileHeader_t regionFH  = { 0 };
+    bmpInfoHeader_t regionIH  = *bmpIH;
+    uint32_t first   = cropHeader(&regionFH, &regionIH, rect);
+    uint32_t regionSize;          // bytes per scanline of the rectangle
+    uint8_t *region;              // the pixels of the rectangle
+    bool done;
+
+    if (format->layout == layoutIndexed && chain->count != 0)
+        return false;
+
+    if (rect->x == 0 && rect->width == (uint32_t)bmpIH->Width)
+        return processImage(bmpData + (size_t)first * rowSize, &regionIH, format, chain, histogram, pool);
+
+    regionSize = bmpRowSize(&regionIH);
+    region     = arenaAlloc((size_t)regionSize * rect->height);
+    for (uint32_t row = 0; row < rect->height; row++)
+        cropRow(region + (size_t)row * regionSize, bmpData + (size_t)(first + row) * rowSize, rect->x, rect->width, bmpIH->BitCount);
+
+    done = processImage(region, &regionIH, format, chain, histogram, pool);
+
+    // indexed pixels don't change, the others go back where they came from
+    for (uint32_t row = 0; done && format->layout != layoutIndexed && row < rect->height; row++)
+        memcpy(
+            bmpData + (size_t)(first + row) * rowSize + (size_t)rect->x * format->bytes,
+            region + (size_t)row * regionSize, (size_t)rect->width * format->bytes);
+
+    arenaFree(region);
+    return done;
+}
+
+bool
+rectInside(const bmpRect_t *rect, bmpInfoHeader_t *bmpIH)
+{
+    uint32_t rows = (bmpIH->Height < 0) ? -(uint32_t)bmpIH->Height : (uint32_t)bmpIH->Height;
+
+    return rect->width != 0 && rect->height != 0 &&
+           (uint64_t)rect->x + rect->width <= (uint32_t)bmpIH->Width &&
+           (uint64_t)rect->y + rect->height <= rows;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: processPalette                                              *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  The pixels of an indexed image are only references into the palette, so   *
+ *  the point operations are applied to the at most 256 palette entries       *
+ *  instead of to every pixel. The entries are B, G, R and a reserved byte,   *
+ *  just like 32 bit pixels, so the palette goes through processImage as a    *
+ *  one row 32 bit image, gamma included. autolevels and equalize need the    *
+ *  pixels, processImage refuses those                                        *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *extra                                                            *
+ *  const pixelFormat_t *format                                               *
+ *  const opChain_t *chain                                                    *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+processPalette(uint8_t *extra, const pixelFormat_t *format, const opChain_t *chain)
+{
+    bmpInfoHeader_t paletteIH = { .Width = (int32_t)format->colors, .Height = 1, .BitCount = 32 };
+    pixelFormat_t bgrx        = { .layout = layoutBgrx32, .bytes = 4 };
+
+    if (format->layout != layoutIndexed || chain->count == 0 || chainWholeImage(chain))
+        return;
+
+    processImage(extra + format->palette, &paletteIH, &bgrx, chain, NULL, NULL);
+    return;
+}
+
+// checks a color mask is one run of bits and returns its position
+static bool
+parseMask(uint32_t mask, uint32_t bitCount, uint8_t *shift, uint8_t *bits)
+{
+    if (mask == 0 || (bitCount < 32 && mask >> bitCount))
+        return false;
+
+    *shift = (uint8_t)__builtin_ctz(mask);
+    *bits  = (uint8_t)__builtin_popcount(mask);
+
+    // a single run shifted down is one less than a power of two
+    return ((mask >> *shift) & ((mask >> *shift) + 1)) == 0;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: parseFormat                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Works out how the pixels are stored from the bit count, the compression   *
+ *  and the bytes that follow the 40 byte info header, which hold the color   *
+ *  masks of bitfields images (in the larger V4 and V5 headers as well) and   *
+ *  the palette. Uncompressed 16 bit images are 555 and 32 bit ones BGRX, the *
+ *  common masks get their own layout and anything else goes through the      *
+ *  generic masks kernel, which also takes fields wider than 8 bits           *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  const uint8_t *extra                                                      *
+ *  size_t extraSize                                                          *
+ *  pixelFormat_t *format                                                     *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  false when the format isn't supported                                     *
+ ******************************************************************************
+!*/
+bool
+parseFormat(
+    bmpInfoHeader_t *bmpIH, const uint8_t *extra, size_t extraSize,
+    pixelFormat_t *format)
+{
+    uint32_t mask[3];
+
+    *format = (pixelFormat_t){ 0 };
+
+    if (bmpIH->Size < sizeof(bmpInfoHeader_t) || bmpIH->Width <= 0 || bmpIH->Planes != 1)
+        return false;
+
+    if (bmpIH->Compression != compressionRgb && bmpIH->Compression != compressionBitfields &&
+        bmpIH->Compression != compressionAlphaBitfields)
+        return false;
+
+    switch (bmpIH->BitCount) {
+    case 1: case 4: case 8:
+        if (bmpIH->Compression != compressionRgb)
+            return false;
+
+        // the palette follows the whole info header, ClrUsed of 0 means all colors
+        format->layout  = layoutIndexed;
+        format->palette = bmpIH->Size - sizeof(bmpInfoHeader_t);
+        format->colors  = (bmpIH->ClrUsed && bmpIH->ClrUsed < (1u << bmpIH->BitCount))
+                        ? bmpIH->ClrUsed : (1u << bmpIH->BitCount);
+        if (format->palette > extraSize)
+            return false;
+        if (format->colors > (extraSize - format->palette) / 4)
+            format->colors = (extraSize - format->palette) / 4;
+        return true;
+
+    case 24:
+        format->layout = layoutBgr24;
+        format->bytes  = 3;
+        return bmpIH->Compression == compressionRgb;
+
+    case 16: case 32:
+        format->bytes = bmpIH->BitCount / 8;
+
+        if (bmpIH->Compression == compressionRgb) {
+            mask[0] = (bmpIH->BitCount == 16) ? 0x001F : 0x0000FF;
+            mask[1] = (bmpIH->BitCount == 16) ? 0x03E0 : 0x00FF00;
+            mask[2] = (bmpIH->BitCount == 16) ? 0x7C00 : 0xFF0000;
+        } else {
+            // the masks are stored red, green, blue right after the 40 byte header
+            if (extraSize < 12)
+                return false;
+            memcpy(&mask[2], extra, 4);
+            memcpy(&mask[1], extra + 4, 4);
+            memcpy(&mask[0], extra + 8, 4);
+        }
+
+        for (int c = 0; c < 3; c++)
+            if (!parseMask(mask[c], bmpIH->BitCount, &format->shift[c], &format->bits[c]))
+                return false;
+        if ((mask[0] & mask[1]) || (mask[0] & mask[2]) || (mask[1] & mask[2]))
+            return false;
+
+        if (bmpIH->BitCount == 32 && mask[0] == 0xFF && mask[1] == 0xFF00 && mask[2] == 0xFF0000)
+            format->layout = layoutBgrx32;
+        else if (bmpIH->BitCount == 16 && mask[0] == 0x1F && mask[1] == 0x03E0 && mask[2] == 0x7C00)
+            format->layout = layoutRgb555;
+        else if (bmpIH->BitCount == 16 && mask[0] == 0x1F && mask[1] == 0x07E0 && mask[2] == 0xF800)
+            format->layout = layoutRgb565;
+        else
+            format->layout = layoutMasks;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: bmpRowSize                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Calculates the size of one scanline, every scanline is padded to a        *
+ *  multiple of 4 bytes                                                       *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  the number of bytes in one scanline                                       *
+ ******************************************************************************
+!*/
+uint32_t
+bmpRowSize(bmpInfoHeader_t *bmpIH)
+{
+    uint64_t bits = (uint64_t)(uint32_t)bmpIH->Width * bmpIH->BitCount;
+
+    return (uint32_t)(((bits + 31) / 32) * 4);
+}
+
+// SizeImage of RLE images, for uncompressed ones the size of the rows. Their
+// SizeImage may be 0 or wrong and the filters go over every row either way
+uint32_t
+bmpImageSize(bmpInfoHeader_t *bmpIH)
+{
+    uint32_t rows = (bmpIH->Height < 0) ? -(uint32_t)bmpIH->Height : (uint32_t)bmpIH->Height;
+
+    if (bmpIH->Compression == compressionRle8 || bmpIH->Compression == compressionRle4)
+        return bmpIH->SizeImage;
+
+    return bmpRowSize(bmpIH) * rows;
+}
+
+// parses the compression of the output
+bool
+parseCompress(const char *str, enum bmpCompression_e *compress)
+{
+    static const struct { const char *name; enum bmpCompression_e compress; } names[] = {
+        { "none", compressionRgb }, { "rle8", compressionRle8 }, { "rle4", compressionRle4 },
+    };
+
+    for (uint32_t nameIdx = 0; nameIdx < sizeof(names) / sizeof(names[0]); nameIdx++) {
+        if (strcmp(str, names[nameIdx].name) == 0) {
+            *compress = names[nameIdx].compress;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// RLE images are always stored bottom-up, RLE8 with 8 and RLE4 with 4 bits
+bool
+bmpRleValid(bmpInfoHeader_t *bmpIH)
+{
+    if (bmpIH->Height <= 0 || bmpIH->Width <= 0)
+        return false;
+
+    return (bmpIH->Compression == compressionRle8 && bmpIH->BitCount == 8) ||
+           (bmpIH->Compression == compressionRle4 && bmpIH->BitCount == 4);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: parseSize                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Parses a size in bytes with an optional K, M or G suffix                  *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *str                                                           *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  the size in bytes, 0 if the size couldn't be parsed                       *
+ ******************************************************************************
+!*/
+size_t
+parseSize(const char *str)
+{
+    char *end;                               // first character after the number
+    unsigned long long size = strtoull(str, &end, 10);
+
+    if (end == str) return 0;
+
+    switch (*end) {
+                case 'k': case 'K': size <<= 10; end++;
+        break;  case 'm': case 'M': size <<= 20; end++;
+        break;  case 'g': case 'G': size <<= 30; end++;
+        break;  default:
+        break;
+    }
+
+    return (*end == '\0') ? (size_t)size : 0;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: parseResize                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Parses a WIDTHxHEIGHT size, either one may be 0 to keep the aspect ratio  *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *str                                                           *
+ *  uint32_t *width                                                           *
+ *  uint32_t *height                                                          *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true if the size could be parsed                                          *
+ ******************************************************************************
+!*/
+bool
+parseResize(const char *str, uint32_t *width, uint32_t *height)
+{
+    char *end;                               // first character after a number
+
+    *width = strtoul(str, &end, 10);
+    if (end == str || (*end != 'x' && *end != 'X'))
+        return false;
+
+    str     = end + 1;
+    *height = strtoul(str, &end, 10);
+    if (end == str || *end != '\0')
+        return false;
+
+    return (*width != 0 || *height != 0) && *width <= 0xFFFF && *height <= 0xFFFF;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: parseRect                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Parses a rectangle as x,y,width,height in pixels, x and y count from the  *
+ *  top left corner of the image                                              *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *str                                                           *
+ *  bmpRect_t *rect                                                           *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true if the rectangle could be parsed and isn't empty                     *
+ ******************************************************************************
+!*/
+bool
+parseRect(const char *str, bmpRect_t *rect)
+{
+    uint32_t *fields[] = { &rect->x, &rect->y, &rect->width, &rect->height };
+    char *end;                               // first character after a number
+
+    for (uint32_t field = 0; field < 4; field++) {
+        unsigned long value = strtoul(str, &end, 10);
+
+        if (end == str || *str == '-' || value > 0x7FFFFFFF || *end != ((field < 3) ? ',' : '\0'))
+            return false;
+        *fields[field] = (uint32_t)value;
+        str = end + 1;
+    }
+
+    return rect->width != 0 && rect->height != 0;
+}
+
+// parses the name of a resampling mode
+bool
+parseResample(const char *str, enum resampleMode_e *mode)
+{
+    static const char *names[] = { "nearest", "bilinear", "lanczos" };
+
+    for (uint32_t modeIdx = 0; modeIdx < sizeof(names) / sizeof(names[0]); modeIdx++) {
+        if (strcmp(str, names[modeIdx]) == 0) {
+            *mode = modeIdx;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: reverseBmp                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Reverses the values of the bmp's pixel array with the fastest kernel the  *
+ *  cpu supports, see selectKernels                                           *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *bmpimg                                                           *
+ *  uint32_t SizeImage                                                        *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  the edited image                                                          *
+ ******************************************************************************
+!*/
+uint8_t *
+reverseBmp(uint8_t *bmpimg, uint32_t SizeImage)
+{
+    kernels.invert(bmpimg, SizeImage);
+    return bmpimg;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: applyFilter                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Applies the selected filter with the fastest kernel the cpu supports, see *
+ *  selectKernels                                                             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *bmpimg                                                           *
+ *  uint32_t SizeImage                                                        *
+ *  enum filterID_e filterID                                                  *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  the edited image                                                          *
+ ******************************************************************************
+!*/
+uint8_t *
+applyFilter(uint8_t *bmpimg, uint32_t SizeImage, enum filterID_e filterID)
+{
+    opChain_t chain = { 0 };
+
+    if (addOp(&chain, filterID) && compileOps(&chain))
+        applyOps(bmpimg, SizeImage, &chain);
+
+    return bmpimg;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: applyOps                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Applies a chain of operations in a single pass, every pixel is loaded,    *
+ *  put through all operations and stored once. A chain of only inverts       *
+ *  works on single bytes so it also handles images that aren't 24 bit        *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint8_t *bmpimg                                                           *
+ *  uint32_t SizeImage                                                        *
+ *  const opChain_t *chain                                                    *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  the edited image                                                          *
+ ******************************************************************************
+!*/
+uint8_t *
+applyOps(uint8_t *bmpimg, uint32_t SizeImage, const opChain_t *chain)
+{
+    uint32_t inverts = 0; // number of inverts in the chain
+
+    for (uint32_t opIdx = 0; opIdx < chain->count; opIdx++)
+        inverts += (chain->op[opIdx] == invert);
+
+    if (inverts == chain->count) {
+        if (inverts % 2) kernels.invert(bmpimg, SizeImage);
+    } else {
+        kernels.chain(bmpimg, SizeImage, chain);
+    }
+
+    return bmpimg;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: reverseBmpScalar                                            *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Reverses the values of the bmp's pixel array, one byte at the time. This  *
+ *  is the reference for the vector kernels in simd.c                         *
  *                                                                            *
  * Parameters:                                                                *
- *  char *fileName                                                            *
- *  bmpFileHeader_t *bmpFH                                                    *
- *  bmpInfoHeader_t *bmpIH                                                    *
+ *  uint8_t *bmpimg                                                           *
+ *  uint32_t SizeImage                                                        *
  *                                                                            * 
  * Return:                                                                    *
- *  The Pixel array location                                                  *
+ *  the edited image                                                          *
  ******************************************************************************
 !*/
 uint8_t *
-loadBmp(char *fileName, bmpFileHeader_t *bmpFH ,bmpInfoHeader_t *bmpIH)
+reverseBmpScalar(uint8_t *bmpimg, uint32_t SizeImage)
 {
-    FILE *fp;           // The file pointer
-    uint8_t *bmpimg;    // pointer to store the image data
-    
-    // open filename in read binary mode & check if it openend correctly
-    fp = fopen(fileName, "rb");
-    if (fp == NULL) {
-        fprintf(stderr, "Failed opening file \"%s\"\n", fileName);
-        exit(EXIT_FAILURE);
-    }
-
-    // read the bmp file header
-    fread(bmpFH, sizeof(bmpFileHeader_t), 1, fp);
-    
-    // verify that this is a bmp file by checking the bitmap ID
-    if (bmpFH->Type != 0x4D42) {
-        fprintf(stderr, "bitmap ID check error.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // read the bmp info header
-    fread(bmpIH, sizeof(bmpInfoHeader_t), 1, fp);
-
-    // move file point to the beginning of bitmap data
-    fseek(fp, bmpFH->OffBits, SEEK_SET);
+    uint32_t imgIdx = 0; // image index counter
     
-    // allocate enough memory for the bitmap image data
-    bmpimg = (malloc(bmpIH->SizeImage));
-
-    // verify memory allocation
-    if (!bmpimg) {
-        fprintf(stderr, "bmpimg memory allocation failure\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // read in the bitmap image data
-    fread(bmpimg, bmpIH->SizeImage, 1, fp);
-
-    // make sure the bitmap image data was read
-    if (bmpimg == NULL) {
-        fprintf(stderr, "error reading image data\n");
-        exit(EXIT_FAILURE);
+    // go trough the image and invert every pixel byte
+    for (imgIdx = 0; imgIdx < SizeImage; imgIdx++) {
+        bmpimg[imgIdx] = ~bmpimg[imgIdx];
     }
     
-    fclose(fp); // Closes the stream. All buffers are flushed
     return bmpimg;
 }
 
 /*!
  ******************************************************************************
- * Function Name: saveBmp                                                     *
+ * Function Name: applyFilterScalar                                           *
  ******************************************************************************
  * Summary:                                                                   *
+ *  Applies the selected filter one pixel at the time                         *
  *                                                                            *
  * Parameters:                                                                *
- *  char *fileName                                                            *
- *  bmpFileHeader_t *bmpFH                                                    *
- *  bmpInfoHeader_t *bmpIH                                                    *
+ *  uint8_t *bmpimg                                                           *
+ *  uint32_t SizeImage                                                        *
+ *  enum filterID_e filterID                                                  *
  *                                                                            * 
  * Return:                                                                    *
- *  none                                                                      *
+ *  the edited image                                                          *
  ******************************************************************************
 !*/
-void 
-saveBmp(
-    char *fileName, bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, 
-    uint8_t *bmpData)
+uint8_t *
+applyFilterScalar(uint8_t *bmpimg, uint32_t SizeImage, enum filterID_e filterID)
 {
-    FILE *fp;
-    
-    // open filename in write binary mode & check if it openend correctly
-    fp = fopen(fileName, "wb");
-    if (fp == NULL) {
-        fprintf(stderr, "Failed opening file \"%s\"\n", fileName);
-        exit(EXIT_FAILURE);
-    }
-    
-    // write the bmp file header
-    fwrite(bmpFH, 1, sizeof(bmpFileHeader_t), fp);
-    
-    // write the bmp info header
-    fwrite(bmpIH, 1, sizeof(bmpInfoHeader_t), fp);
-    
-    // write the bmp pixel array
-    fwrite(bmpData, 1, bmpIH->SizeImage, fp);
+    opChain_t chain = { 0 };
+
+    if (addOp(&chain, filterID) && compileOps(&chain))
+        applyOpsScalar(bmpimg, SizeImage, &chain);
     
-    fclose(fp); // Closes the stream. All buffers are flushed
-    return;
+    return bmpimg;
 }
 
 /*!
  ******************************************************************************
- * Function Name: reverseBmp                                                  *
+ * Function Name: applyOpsScalar                                              *
  ******************************************************************************
  * Summary:                                                                   *
- *  Reverses the values of the bmp's pixel array                              *
+ *  Applies a chain of operations one pixel at the time with the fixed point  *
+ *  matrices from compileOps, integer math only. This is the reference for    *
+ *  the fused vector kernels in simd.c, they give the exact same result       *
  *                                                                            *
  * Parameters:                                                                *
  *  uint8_t *bmpimg                                                           *
  *  uint32_t SizeImage                                                        *
+ *  const opChain_t *chain                                                    *
  *                                                                            * 
  * Return:                                                                    *
  *  the edited image                                                          *
  ******************************************************************************
 !*/
+// puts one pixel, held as B, G, R in 0 - 255, through every matrix of the chain
+static inline void
+chainPixel(int32_t in[3], const opChain_t *chain)
+{
+    int32_t out[3];      // the channels after the current operation
+
+    for (uint32_t opIdx = 0; opIdx < chain->count; opIdx++) {
+        const colorMatrix_t *matrix = &chain->matrix[opIdx];
+
+        for (int c = 0; c < 3; c++) {
+            out[c] = (matrix->weight[c][0] * in[0] + matrix->weight[c][1] * in[1]
+                    + matrix->weight[c][2] * in[2] + matrix->bias[c] * (1 << (MATRIX_SHIFT - 1)))
+                    >> MATRIX_SHIFT;
+            out[c] = (out[c] < 0) ? 0 : (out[c] > 255) ? 255 : out[c];
+        }
+
+        in[0] = out[0];
+        in[1] = out[1];
+        in[2] = out[2];
+    }
+}
+
 uint8_t *
-reverseBmp(uint8_t *bmpimg, uint32_t SizeImage)
+applyOpsScalar(uint8_t *bmpimg, uint32_t SizeImage, const opChain_t *chain)
 {
     uint32_t imgIdx = 0; // image index counter
-    
-    // go trough the image and invert every pixel byte
-    for (imgIdx = 0; imgIdx < SizeImage; imgIdx++) {
-        bmpimg[imgIdx] = ~bmpimg[imgIdx];
+    int32_t in[3];       // the color channels of the current pixel, B, G, R
+
+    for (imgIdx = 0; imgIdx + 2 < SizeImage; imgIdx += 3) {
+        in[0] = bmpimg[imgIdx];
+        in[1] = bmpimg[imgIdx + 1];
+        in[2] = bmpimg[imgIdx + 2];
+
+        chainPixel(in, chain);
+
+        bmpimg[imgIdx]     = (uint8_t)in[0];
+        bmpimg[imgIdx + 1] = (uint8_t)in[1];
+        bmpimg[imgIdx + 2] = (uint8_t)in[2];
     }
-    
+
     return bmpimg;
 }
 
 /*!
  ******************************************************************************
- * Function Name: applyFilter                                                 *
+ * Function Name: applyOpsPackedScalar                                        *
  ******************************************************************************
  * Summary:                                                                   *
- *  Applies the selected filter                                               *
+ *  Applies a chain of operations to little endian 16 or 32 bit pixels with   *
+ *  the B, G and R fields of the format. Every field is widened to 8 bits     *
+ *  with fieldWiden, put through the chain like applyOpsScalar does and       *
+ *  rounded back to its width with fieldNarrow, so a field that isn't changed *
+ *  comes back the same. The bits outside the fields, like alpha, are kept.   *
+ *  This is the reference for the 32, 555 and 565 kernels in simd.c           *
  *                                                                            *
  * Parameters:                                                                *
  *  uint8_t *bmpimg                                                           *
  *  uint32_t SizeImage                                                        *
- *  enum filterID_e filterID                                                  *
- *                                                                            * 
+ *  const pixelFormat_t *format                                               *
+ *  const opChain_t *chain                                                    *
+ *                                                                            *
  * Return:                                                                    *
  *  the edited image                                                          *
  ******************************************************************************
 !*/
 uint8_t *
-applyFilter(uint8_t *bmpimg, uint32_t SizeImage, enum filterID_e filterID)
+applyOpsPackedScalar(
+    uint8_t *bmpimg, uint32_t SizeImage, const pixelFormat_t *format, 
+    const opChain_t *chain)
 {
-    uint32_t imgIdx   = 0; // image index counter
-    uint8_t greyColor = 0; // temp file for the greyscale value
-    
-    switch (filterID) {
-                case none:
-        break;    case sepia:
-        
-        for (imgIdx = 0; imgIdx < SizeImage; imgIdx += 3) {
-            bmpimg[imgIdx + 2]    // Red
-                = (uint8_t)fmin((bmpimg[imgIdx + 2] * 0.393) + (bmpimg[imgIdx] * 0.769) + (bmpimg[imgIdx + 1] * 0.189), 255.0);
-            bmpimg[imgIdx + 1]    // Green
-                = (uint8_t)fmin((bmpimg[imgIdx + 2] * 0.349) + (bmpimg[imgIdx] * 0.686) + (bmpimg[imgIdx + 1] * 0.168), 255.0);
-            bmpimg[imgIdx]        // Blue
-                = (uint8_t)fmin((bmpimg[imgIdx + 2] * 0.272) + (bmpimg[imgIdx] * 0.534) + (bmpimg[imgIdx + 1] * 0.131), 255.0);
-        }
-        
-        break;    case greyscale:
-        
-        for (imgIdx = 0; imgIdx < SizeImage; imgIdx += 3) {
-            greyColor = (uint8_t)fmin(((bmpimg[imgIdx] + bmpimg[imgIdx + 1] + bmpimg[imgIdx + 2]) / 3), 255.0);
-            bmpimg[imgIdx] = bmpimg[imgIdx + 1] = bmpimg[imgIdx + 2] = greyColor;
+    uint32_t keep = 0xFFFFFFFF; // bits of the pixel that aren't a color field
+    uint32_t max[3];            // largest value of every field
+    uint32_t field[3];          // the fields of the current pixel
+    int32_t in[3];              // its color channels widened to 8 bits, B, G, R
+
+    for (int c = 0; c < 3; c++) {
+        max[c] = (1u << format->bits[c]) - 1;
+        keep  &= ~(max[c] << format->shift[c]);
+    }
+
+    for (uint32_t imgIdx = 0; imgIdx + format->bytes <= SizeImage; imgIdx += format->bytes) {
+        uint32_t pixel = 0;
+
+        for (uint32_t byte = 0; byte < format->bytes; byte++)
+            pixel |= (uint32_t)bmpimg[imgIdx + byte] << (8 * byte);
+
+        for (int c = 0; c < 3; c++) {
+            field[c] = (pixel >> format->shift[c]) & max[c];
+            in[c]    = (int32_t)fieldWiden(field[c], format->bits[c]);
         }
-        
-        break;    default:
-        break;
+
+        chainPixel(in, chain);
+
+        pixel &= keep;
+        for (int c = 0; c < 3; c++)
+            pixel |= fieldNarrow((uint32_t)in[c], field[c], format->bits[c]) << format->shift[c];
+
+        for (uint32_t byte = 0; byte < format->bytes; byte++)
+            bmpimg[imgIdx + byte] = (uint8_t)(pixel >> (8 * byte));
     }
-    
+
     return bmpimg;
 }
 
+/*!
+ ******************************************************************************
+ * Function Name: addOp                                                       *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Appends an operation to the end of the chain                              *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  opChain_t *chain                                                          *
+ *  enum filterID_e filterID                                                  *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  false if the operation is unknown or the chain is full                    *
+ ******************************************************************************
+!*/
+bool
+addOp(opChain_t *chain, enum filterID_e filterID)
+{
+    if (filterID == none)
+        return true;
+    if (filterID > equalize || chain->count >= MAX_OPS)
+        return false;
+
+    chain->arg[chain->count][0] = chain->arg[chain->count][1] = chain->arg[chain->count][2] = 0;
+    chain->op[chain->count++] = filterID;
+    return true;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: parseOps                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Appends a comma separated list of operations to the chain. The names are  *
+ *  invert, sepia, greyscale, swap (red and blue), brightness=offset,         *
+ *  contrast=factor, tint=RRGGBB, blur=sigma, boxblur=radius,                 *
+ *  sharpen=amount, edges, gamma=value, autolevels or autolevels=clip and     *
+ *  equalize                                                                  *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *list                                                          *
+ *  opChain_t *chain                                                          *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  false on an unknown name, a bad argument or when the chain is full        *
+ ******************************************************************************
+!*/
+bool
+parseOps(const char *list, opChain_t *chain)
+{
+    static const struct { const char *name; enum filterID_e filterID; } names[] = {
+        { "invert",     invert     },
+        { "sepia",      sepia      },
+        { "greyscale",  greyscale  },
+        { "grayscale",  greyscale  },
+        { "swap",       swap       },
+        { "brightness", brightness },
+        { "contrast",   contrast   },
+        { "tint",       tint       },
+        { "blur",       blur       },
+        { "boxblur",    boxblur    },
+        { "sharpen",    sharpen    },
+        { "edges",      edges      },
+        { "sobel",      edges      },
+        { "gamma",      gammaCurve },
+        { "autolevels", autolevels },
+        { "levels",     autolevels },
+        { "equalize",   equalize   },
+    };
+
+    while (*list != '\0') {
+        size_t length = strcspn(list, ",");
+        size_t nameLength = strcspn(list, ",=");
+        const char *value = (nameLength < length) ? list + nameLength + 1 : NULL;
+        enum filterID_e filterID = none;
+        float *arg;
+        char *end;
+
+        for (size_t nameIdx = 0; nameIdx < sizeof(names) / sizeof(names[0]); nameIdx++) {
+            if (strlen(names[nameIdx].name) == nameLength && strncmp(list, names[nameIdx].name, nameLength) == 0)
+                filterID = names[nameIdx].filterID;
+        }
+
+        if (filterID == none || !addOp(chain, filterID))
+            return false;
+        arg = chain->arg[chain->count - 1];
+
+        // brightness, contrast, tint, blur, boxblur, sharpen and gamma take a
+        // value, autolevels may take one and clips 0.1% of the pixels without
+        if (filterID != autolevels &&
+            (value != NULL) != ((filterID >= brightness && filterID <= sharpen) || filterID == gammaCurve))
+            return false;
+
+        switch (filterID) {
+                    case brightness:
+                arg[0] = strtof(value, &end);
+                if (end != list + length || arg[0] < -255 || arg[0] > 255) return false;
+            break;  case contrast:
+                arg[0] = strtof(value, &end);
+                if (end != list + length || arg[0] < 0 || arg[0] >= 7.9f) return false;
+            break;  case tint: {
+                unsigned long color = strtoul(value, &end, 16);
+                if (end != list + length || end - value != 6) return false;
+                arg[0] = (color & 0xFF) / 255.0f;           // blue
+                arg[1] = ((color >> 8) & 0xFF) / 255.0f;    // green
+                arg[2] = ((color >> 16) & 0xFF) / 255.0f;   // red
+            }
+            break;  case blur:
+                arg[0] = strtof(value, &end);
+                if (end != list + length || arg[0] < 0.1f || arg[0] > CONVOLVE_MAX_SIGMA) return false;
+            break;  case boxblur:
+                arg[0] = strtof(value, &end);
+                if (end != list + length || arg[0] != floorf(arg[0]) || arg[0] < 1 || arg[0] > CONVOLVE_MAX_RADIUS) return false;
+            break;  case sharpen:
+                arg[0] = strtof(value, &end);
+                if (end != list + length || arg[0] < 0 || arg[0] > 10) return false;
+            break;  case gammaCurve:
+                arg[0] = strtof(value, &end);
+                if (end != list + length || arg[0] < 0.1f || arg[0] > 10) return false;
+            break;  case autolevels:
+                arg[0] = (value != NULL) ? strtof(value, &end) : 0.1f;
+                if (value != NULL && (end != list + length || arg[0] < 0 || arg[0] >= 50)) return false;
+            break;  default:
+            break;
+        }
+
+        list += length;
+        if (*list == ',') list++;
+    }
+
+    return true;
+}
+
+// color matrices of the presets, rows are the output and columns the input
+// channels in B, G, R order. A new preset only needs a row in this table
+static const float presets[][3][3] = {
+    [sepia] = {
+        { 0.131f, 0.534f, 0.272f },
+        { 0.168f, 0.686f, 0.349f },
+        { 0.189f, 0.769f, 0.393f },
+    },
+    [greyscale] = {
+        { 0.114f, 0.587f, 0.299f },
+        { 0.114f, 0.587f, 0.299f },
+        { 0.114f, 0.587f, 0.299f },
+    },
+    [swap] = {
+        { 0.0f, 0.0f, 1.0f },
+        { 0.0f, 1.0f, 0.0f },
+        { 1.0f, 0.0f, 0.0f },
+    },
+};
+
+/*!
+ ******************************************************************************
+ * Function Name: compileOps                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Simplifies the chain before it is run: two inverts in a row cancel out    *
+ *  and a greyscale directly after a greyscale doesn't change anything. Then  *
+ *  every operation is turned into a color matrix and converted to fixed      *
+ *  point once, so no floating point is left for the per pixel work. The      *
+ *  neighborhood operations and lookup tables get the identity, processImage  *
+ *  runs them apart                                                           *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  opChain_t *chain                                                          *
+ *                                                                            * 
+ * Return:                                                                    *
+ *  false if a weight doesn't fit the fixed point format                      *
+ ******************************************************************************
+!*/
+bool
+compileOps(opChain_t *chain)
+{
+    uint32_t count = 0; // number of operations kept
+
+    for (uint32_t opIdx = 0; opIdx < chain->count; opIdx++) {
+        enum filterID_e op = chain->op[opIdx];
+
+        if (count > 0 && op == invert && chain->op[count - 1] == invert) {
+            count--;
+            continue;
+        }
+        if (count > 0 && op == greyscale && chain->op[count - 1] == greyscale)
+            continue;
+
+        chain->op[count] = op;
+        if (count != opIdx)
+            memcpy(chain->arg[count], chain->arg[opIdx], sizeof(chain->arg[0]));
+        count++;
+    }
+    chain->count = count;
+
+    for (uint32_t opIdx = 0; opIdx < chain->count; opIdx++) {
+        const float *arg = chain->arg[opIdx];
+        float weight[3][3] = { { 0 } };
+        float offset[3] = { 0 };
+
+        switch (chain->op[opIdx]) {
+                    case sepia: case greyscale: case swap:
+            memcpy(weight, presets[chain->op[opIdx]], sizeof(weight));
+            break;  case invert:
+            for (int c = 0; c < 3; c++) { weight[c][c] = -1.0f; offset[c] = 255.0f; }
+            break;  case brightness:
+            for (int c = 0; c < 3; c++) { weight[c][c] = 1.0f; offset[c] = arg[0]; }
+            break;  case contrast:
+            for (int c = 0; c < 3; c++) { weight[c][c] = arg[0]; offset[c] = 128.0f * (1.0f - arg[0]); }
+            break;  case tint:
+            for (int c = 0; c < 3; c++) weight[c][c] = arg[c];
+            break;  case blur: case boxblur: case sharpen: case edges:
+                    case gammaCurve: case autolevels: case equalize:
+            for (int c = 0; c < 3; c++) weight[c][c] = 1.0f;
+            break;  default:
+            break;
+        }
+
+        for (int c = 0; c < 3; c++) {
+            long bias = 2 * lroundf(offset[c]) + 1;
+
+            for (int in = 0; in < 3; in++) {
+                long fixed = lroundf(weight[c][in] * (1 << MATRIX_SHIFT));
+
+                if (fixed < INT16_MIN || fixed > INT16_MAX)
+                    return false;
+                chain->matrix[opIdx].weight[c][in] = (int16_t)fixed;
+            }
+
+            if (bias < INT16_MIN || bias > INT16_MAX)
+                return false;
+            chain->matrix[opIdx].bias[c] = (int16_t)bias;
+        }
+    }
+
+    return true;
+}
+
 /*!
  ******************************************************************************
  * Function Name: endianess                                                   *
@@ -229,7 +2131,7 @@ help(void)
 {
     printf("bmp - bmp\n\n");
     printf("Usage:\n");
-    printf("bmp [(-h|--help)] [(-v|--verbose)] [(-i|--invert)] [(-r|--rotate) integer] [(-o|--outputfile) string] [(-f|--filter) integer]\n\n");
+    printf("bmp [(-h|--help)] [(-v|--verbose)] [(-i|--invert)] [(-r|--rotate) degrees] [--flip h|v] [--resize WIDTHxHEIGHT] [--resample mode] [(-o|--outputfile) string] [(-j|--threads) integer] [(-m|--max-mem) size] [(-f|--filter) integer] [--ops list] [(-b|--batch) directory (-d|--outdir) directory] [--stats json|prometheus] [--stats-file path] [--compress none|rle8|rle4] [--histogram] [--crop x,y,w,h] [--roi x,y,w,h] [--serve socket] [--cache directory] [--cache-size size]\n\n");
     printf("Usage example:\n");
     printf("bmp -i input.bmp -r90 -o output.bmp -f1\n");
     printf("This line will invert the image rotate it by 90* and than apply the sepia filter to it.\n\n");
@@ -237,13 +2139,42 @@ help(void)
     printf("-h or --help: Displays this information.\n");
     printf("-v or --verbose: Verbose mode.\n");
     printf("-i or --invert: invert.\n");
-    printf("-r or --rotate integer: Rotate in orders of 90.\n");
+    printf("-r or --rotate degrees: Rotate clockwise, negative is counter clockwise.\n");
+    printf("--flip h|v: mirror the image left to right (h) or top to bottom (v).\n");
+    printf("--resize WIDTHxHEIGHT: scale the image, a 0 keeps the aspect ratio (e.g. 320x0).\n");
+    printf("--resample mode: nearest, bilinear (default) or lanczos, used by --resize and -r.\n");
+    printf("--crop x,y,w,h: only read and keep the w by h pixels at x,y, counted from the top left.\n");
+    printf("--roi x,y,w,h: only apply the operations to the w by h pixels at x,y, after the geometry.\n");
     printf("-o or --outputfile string: outputfile.\n");
+    printf("-j or --threads integer: number of threads, 0 uses every core (default 1).\n");
+    printf("-m or --max-mem size: stream the image in bands using at most size bytes (e.g. 64M).\n");
     printf("-f or --filter integer: apply filter to the image.\n");
     printf("filter codes are:\n");
     printf("1 = sepia\n");
     printf("2 = greyscale\n");
-    printf("NOTE: No 2 filters can be applied at the same time\n\n");
+    printf("-b or --batch directory: process every .bmp in directory, \"-\" reads a list of paths from stdin.\n");
+    printf("-d or --outdir directory: output directory for batch mode.\n");
+    printf("--cache directory: copy the result from the cache when the same input had the same operations,\n");
+    printf("            store it there otherwise.\n");
+    printf("--cache-size size: evict the least recently used results beyond size bytes (default 1G).\n");
+    printf("--serve socket: run as a server taking jobs on the Unix domain socket, -j sets the number of workers.\n");
+    printf("--stats json|prometheus: time open, header, read, every operation and write of every image,\n");
+    printf("            json prints one line per image, prometheus the totals of the run at the end.\n");
+    printf("--stats-file path: append the json lines to path or write the prometheus text file to path.\n");
+    printf("--compress none|rle8|rle4: RLE compress the output, rle8 needs an 8 bit and rle4 a 4 bit image.\n");
+    printf("            RLE input is always decoded.\n");
+    printf("--histogram or --stats-pixels: write the histograms, min, max and mean of every channel and the\n");
+    printf("            luminance percentiles of the output as JSON next to it, out.bmp gets out.json.\n");
+    printf("--ops list: comma separated operations applied in one pass after -i and -f,\n");
+    printf("            e.g. --ops invert,sepia,greyscale\n");
+    printf("operations are:\n");
+    printf("invert, sepia, greyscale, swap (red and blue),\n");
+    printf("brightness=offset (-255 - 255), contrast=factor (0 - 7.9), tint=RRGGBB,\n");
+    printf("blur=sigma (0.1 - 32), boxblur=radius (1 - 100), sharpen=amount (0 - 10), edges,\n");
+    printf("gamma=value (0.1 - 10, above 1 brightens), autolevels or autolevels=clip percent (0 - 49.9,\n");
+    printf("default 0.1) stretches every channel to 0 - 255, equalize flattens the histogram of every channel\n");
+    printf("blur, boxblur, sharpen and edges need a 24 or 32 bit image and the whole image in memory,\n");
+    printf("autolevels and equalize a 16, 24 or 32 bit image and the whole image in memory\n\n");
     
     return;
 }
@@ -258,14 +2189,13 @@ help(void)
  * Parameters:                                                                *
  *  bmpFileHeader_t *bmpFH                                                    *
  *  bmpInfoHeader_t *bmpIH                                                    *
- *  uint8_t *bmpData                                                          *
  *                                                                            * 
  * Return:                                                                    *
  *  None                                                                      *
  ******************************************************************************
 !*/
 void 
-bmpDump(bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, uint8_t *bmpData)
+bmpDump(bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH)
 {
     printf("bitmap file header:\n");
     printf("Type\t\t = 0x%X\n", bmpFH->Type);
@@ -286,42 +2216,226 @@ bmpDump(bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, uint8_t *bmpData)
     printf("YPelsPerMeter\t = %d\n", bmpIH->YPelsPerMeter);
     printf("ClrUsed\t\t = 0x%X\n", bmpIH->ClrUsed);
     printf("ClrImportant\t = 0x%X\n", bmpIH->ClrImportant);
-    printf("\n\n");
-    
-    // prints the pixel array in hex format
-    printf("Pixel Array:\n ");
-    for (uint32_t i = 0; i < bmpIH->SizeImage; i++) {
-        printf("%X", bmpData[i]);
-        if (bmpData[i] == 0) printf("%X", 0);;
-        if (((i + 1) % 32) == 0) printf("\n");
-        printf(" ");
-    } printf("\n");
+    printf("\n");
     
     return;
 }
 
+// allocates a zeroed pixel array of size bytes with the headers and the
+// palette of bmpData copied in front of it, like loadBmp does
+static uint8_t *
+newBmp(bmpFileHeader_t *bmpFH, uint8_t *bmpData, size_t size)
+{
+    size_t pad      = arenaPad(bmpFH->OffBits);
+    uint8_t *bmpimg = (uint8_t *)arenaCalloc(pad + bmpFH->OffBits + size) + pad;
+
+    memcpy(bmpimg, bmpData - bmpFH->OffBits, bmpFH->OffBits);
+
+    return bmpimg + bmpFH->OffBits;
+}
+
 /*!
  ******************************************************************************
  * Function Name: rotate                                                      *
  ******************************************************************************
  * Summary:                                                                   *
- *  rotates the image by a given amount of degrees                            *
+ *  rotates the image clockwise by degree degrees, negative degrees rotate    *
+ *  counter clockwise. The nearest multiple of 90 degrees is turned exactly,  *
+ *  180 degrees in place and 90 and 270 by tiles into a new pixel array. The  *
+ *  remaining -45 - 45 degrees are done by rotatePixels, which grows the      *
+ *  image to fit the corners and leaves the background black. Palettized and  *
+ *  16 bit pixels can't be blended so those always use nearest. Anything but  *
+ *  180 degrees only works on a pixel array from loadBmp, which is freed.     *
+ *  Width, Height, SizeImage and the file size are updated                    *
  *                                                                            *
  * Parameters:                                                                *
  *  bmpFileHeader_t *bmpFH                                                    *
  *  bmpInfoHeader_t *bmpIH                                                    *
  *  uint8_t *bmpData                                                          *
  *  float degree                                                              *
- *                                                                            * 
+ *  enum resampleMode_e mode                                                  *
+ *  threadPool_t *pool                                                        *
+ *                                                                            *
  * Return:                                                                    *
- *  None                                                                      *
+ *  The pixel array location                                                  *
  ******************************************************************************
 !*/
-void 
+uint8_t *
 rotate(
     bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH,
-    uint8_t *bmpData, float degree)
+    uint8_t *bmpData, float degree, enum resampleMode_e mode, threadPool_t *pool)
+{
+    uint32_t bpp     = bmpIH->BitCount / 8;
+    uint32_t width   = bmpIH->Width;
+    uint32_t height  = (bmpIH->Height < 0) ? -bmpIH->Height : bmpIH->Height;
+    uint32_t rowSize = bmpRowSize(bmpIH);
+    int32_t quarters = (int32_t)lroundf(degree / 90);
+    double rest      = degree - quarters * 90.0;
+    uint32_t newWidth, newHeight, newRowSize, pels;
+    uint8_t *rotated;
+
+    // 0 - 3 quarter turns clockwise
+    quarters = ((quarters % 4) + 4) % 4;
+    if (quarters == 0 && rest == 0.0)
+        return bmpData;
+
+    if (bmpIH->BitCount < 8 || bmpIH->BitCount % 8) {
+        fprintf(stderr, "can't rotate %d bit images\n", bmpIH->BitCount);
+        exit(EXIT_FAILURE);
+    }
+
+    if (quarters == 2)
+        rotate180(bmpData, rowSize, width, height, bpp);
+
+    if (quarters % 2) {
+        // the width and height swap, the new rows get their own padding
+        newRowSize = ((height * bmpIH->BitCount + 31) / 32) * 4;
+        rotated    = newBmp(bmpFH, bmpData, (size_t)newRowSize * width);
+
+        // bottom-up images store the rows flipped, so turning the stored
+        // pixels clockwise turns the picture counter clockwise
+        rotate90(
+            bmpData, rowSize, width, height, rotated, newRowSize, bpp,
+            (quarters == 1) == (bmpIH->Height < 0));
+        freeBmp(bmpFH, bmpData);
+        bmpData = rotated;
+
+        bmpIH->Width     = height;
+        bmpIH->Height    = (bmpIH->Height < 0) ? -(int32_t)width : (int32_t)width;
+        bmpIH->SizeImage = newRowSize * width;
+        bmpFH->Size      = bmpFH->OffBits + bmpIH->SizeImage;
+
+        pels                 = bmpIH->XPelsPerMeter;
+        bmpIH->XPelsPerMeter = bmpIH->YPelsPerMeter;
+        bmpIH->YPelsPerMeter = pels;
+
+        width   = bmpIH->Width;
+        height  = (bmpIH->Height < 0) ? -bmpIH->Height : bmpIH->Height;
+        rowSize = newRowSize;
+    }
+
+    if (rest == 0.0)
+        return bmpData;
+
+    if (bpp < 3) mode = resampleNearest;
+
+    rotatedSize(width, height, rest, &newWidth, &newHeight);
+    newRowSize = ((newWidth * bmpIH->BitCount + 31) / 32) * 4;
+    rotated    = newBmp(bmpFH, bmpData, (size_t)newRowSize * newHeight);
+
+    rotatePixels(
+        bmpData, rowSize, width, height, rotated, newRowSize, newWidth, newHeight,
+        bpp, (bmpIH->Height < 0) ? rest : -rest, mode, pool);
+    freeBmp(bmpFH, bmpData);
+
+    bmpIH->Width     = newWidth;
+    bmpIH->Height    = (bmpIH->Height < 0) ? -(int32_t)newHeight : (int32_t)newHeight;
+    bmpIH->SizeImage = newRowSize * newHeight;
+    bmpFH->Size      = bmpFH->OffBits + bmpIH->SizeImage;
+
+    return rotated;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: resize                                                      *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  scales the image to width x height pixels with resamplePixels, a width or *
+ *  height of 0 follows the aspect ratio of the image. Like rotate this only  *
+ *  works on a pixel array from loadBmp, which is freed                       *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  bmpFileHeader_t *bmpFH                                                    *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  uint8_t *bmpData                                                          *
+ *  uint32_t width                                                            *
+ *  uint32_t height                                                           *
+ *  enum resampleMode_e mode                                                  *
+ *  threadPool_t *pool                                                        *
+ *                                                                            *
+ * Return:                                                                    *
+ *  The pixel array location                                                  *
+ ******************************************************************************
+!*/
+uint8_t *
+resize(
+    bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, uint8_t *bmpData,
+    uint32_t width, uint32_t height, enum resampleMode_e mode, threadPool_t *pool)
+{
+    uint32_t oldWidth  = bmpIH->Width;
+    uint32_t oldHeight = (bmpIH->Height < 0) ? -bmpIH->Height : bmpIH->Height;
+    uint32_t newRowSize;
+    uint8_t *resized;
+
+    if (width == 0 && height == 0)
+        return bmpData;
+    if (width == 0)
+        width = (uint32_t)llround((double)oldWidth * height / oldHeight);
+    if (height == 0)
+        height = (uint32_t)llround((double)oldHeight * width / oldWidth);
+    if (width == 0) width = 1;
+    if (height == 0) height = 1;
+
+    if (width == oldWidth && height == oldHeight)
+        return bmpData;
+
+    if (bmpIH->BitCount < 8 || bmpIH->BitCount % 8) {
+        fprintf(stderr, "can't resize %d bit images\n", bmpIH->BitCount);
+        exit(EXIT_FAILURE);
+    }
+    if (bmpIH->BitCount < 24) mode = resampleNearest;
+
+    newRowSize = ((width * bmpIH->BitCount + 31) / 32) * 4;
+    resized    = newBmp(bmpFH, bmpData, (size_t)newRowSize * height);
+
+    // resampling treats both directions alike so the row order doesn't matter
+    resamplePixels(
+        bmpData, bmpRowSize(bmpIH), oldWidth, oldHeight,
+        resized, newRowSize, width, height, bmpIH->BitCount / 8, mode, pool);
+    freeBmp(bmpFH, bmpData);
+
+    bmpIH->Width     = width;
+    bmpIH->Height    = (bmpIH->Height < 0) ? -(int32_t)height : (int32_t)height;
+    bmpIH->SizeImage = newRowSize * height;
+    bmpFH->Size      = bmpFH->OffBits + bmpIH->SizeImage;
+
+    return resized;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: flip                                                        *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  mirrors the image in place, 'h' flips it left to right and 'v' flips it   *
+ *  top to bottom                                                             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  bmpInfoHeader_t *bmpIH                                                    *
+ *  uint8_t *bmpData                                                          *
+ *  char axis                                                                 *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+flip(bmpInfoHeader_t *bmpIH, uint8_t *bmpData, char axis)
 {
-	
+    uint32_t height  = (bmpIH->Height < 0) ? -bmpIH->Height : bmpIH->Height;
+    uint32_t rowSize = bmpRowSize(bmpIH);
+
+    if (axis == 'v') {
+        flipRows(bmpData, rowSize, height);
+        return;
+    }
+
+    if (bmpIH->BitCount < 8 || bmpIH->BitCount % 8) {
+        fprintf(stderr, "can't flip %d bit images\n", bmpIH->BitCount);
+        exit(EXIT_FAILURE);
+    }
+    flipColumns(bmpData, rowSize, bmpIH->Width, height, bmpIH->BitCount / 8);
+
     return;
-}
\ No newline at end of file
+}
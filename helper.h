@@ -8,15 +8,69 @@
 #include <string.h>  // strcmp
 #include <getopt.h>  //
 #include <math.h>    //
+#include <fcntl.h>   // open
+#include <unistd.h>  // close, ftruncate
+#include <sys/mman.h> // mmap, munmap, madvise
+#include <sys/stat.h> // fstat, stat
+#include <sys/xattr.h> // lgetxattr
+
+#include "simd.h"
+#include "threadpool.h"
+#include "geometry.h"
+#include "convolve.h"
+#include "stats.h"
+#include "rle.h"
+#include "arena.h"
+#include "histogram.h"
+#include "lut.h"
 
 #define _DEBUG
+
+// size of the row chunks handed to the workers, about the size of a L2 cache
+#define CHUNK_BYTES  (256 << 10)
      
 enum filterID_e {
     none         = 0,
     sepia        = 1,
     greyscale    = 2,
+    invert       = 3,
+    swap         = 4,
+    brightness   = 5,
+    contrast     = 6,
+    tint         = 7,
+    blur         = 8,    // gaussian blur, the operations from here on look at the neighbors
+    boxblur      = 9,
+    sharpen      = 10,   // unsharp mask
+    edges        = 11,   // sobel edge detection
+    gammaCurve   = 12,   // the operations from here on are lookup tables
+    autolevels   = 13,   // stretches every channel to the full range
+    equalize     = 14,   // flattens the histogram of every channel
 };
 
+// maximum number of operations in a chain
+#define MAX_OPS      16
+
+// number of fraction bits in the color matrix weights
+#define MATRIX_SHIFT 12
+
+// structure for holding a color operation as a fixed point 3x3 matrix:
+// out[c] = (weight[c][0] * B + weight[c][1] * G + weight[c][2] * R
+//          + bias[c] * 2^(MATRIX_SHIFT - 1)) >> MATRIX_SHIFT
+// clamped to 0 - 255. The bias is 2 * offset + 1 so the odd half rounds
+typedef struct colorMatrix_s {
+    int16_t weight[3][3];         // rows are the output, columns the input channel in B, G, R order
+    int16_t bias[3];              // offset of every output channel, see above
+} colorMatrix_t;
+
+// structure for holding a chain of operations that is applied in one pass
+typedef struct opChain_s {
+    uint32_t count;               // number of operations
+    enum filterID_e op[MAX_OPS];  // operations in the order they are applied
+    float arg[MAX_OPS][3];        // arguments of brightness, contrast, tint, blur, boxblur, sharpen, gamma and autolevels
+    colorMatrix_t matrix[MAX_OPS];// the operations in fixed point, filled in by compileOps
+    const channelLut_t *lut;      // looked up by processRows before the matrices, NULL for none. processImage sets it
+} opChain_t;
+
 // structure for holding the bitmaps file header
 #pragma pack(push, 1)
 typedef struct bitmapFileHeader_s {
@@ -32,8 +86,8 @@ typedef struct bitmapFileHeader_s {
 #pragma pack(push, 1)
 typedef struct bitmapFileInfoHeader_s {
     uint32_t Size;           // specifies the number of bytes required by the struct
-    uint32_t Width;          // specifies width in pixels
-    uint32_t Height;         // species height in pixels
+    int32_t  Width;          // specifies width in pixels
+    int32_t  Height;         // species height in pixels, negative for top-down images
     uint16_t Planes;         // specifies the number of color planes, must be 1
     uint16_t BitCount;       // specifies the number of bit per pixel
     uint32_t Compression;    // spcifies the type of compression
@@ -45,13 +99,202 @@ typedef struct bitmapFileInfoHeader_s {
 } bmpInfoHeader_t;
 #pragma pack(pop)
 
-// loads in the info of the bitmap
-uint8_t *loadBmp(char *fp, bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH);
+// values of bmpInfoHeader_t.Compression
+enum bmpCompression_e {
+    compressionRgb            = 0,   // uncompressed
+    compressionRle8           = 1,
+    compressionRle4           = 2,
+    compressionBitfields      = 3,   // uncompressed with color masks after the info header
+    compressionAlphaBitfields = 6,   // same with an alpha mask
+};
+
+// pixel layouts the point operations have a kernel for, see parseFormat
+enum pixelLayout_e {
+    layoutIndexed = 0,   // 1, 4 or 8 bit indices into the palette, the palette is edited instead
+    layoutBgr24   = 1,   // B, G, R bytes
+    layoutBgrx32  = 2,   // B, G, R bytes and an alpha or unused byte that is kept
+    layoutRgb555  = 3,   // 16 bit, 5 bits per channel with blue in the low bits
+    layoutRgb565  = 4,   // 16 bit, 5 bits blue and red and 6 bits green
+    layoutMasks   = 5,   // 16 or 32 bit with any other color masks
+};
+
+// structure for holding how the pixels of an image are stored
+typedef struct pixelFormat_s {
+    enum pixelLayout_e layout;
+    uint32_t bytes;      // bytes per pixel, 0 for indexed images
+    uint8_t shift[3];    // lowest bit of the B, G and R field of 16 and 32 bit pixels
+    uint8_t bits[3];     // width of the B, G and R field, 1 - 30 bits
+    uint32_t palette;    // offset of the palette from the end of the info header
+    uint32_t colors;     // number of palette entries of indexed images
+} pixelFormat_t;
+
+// widens a color field of bits bits to the 8 bits the operations work on,
+// short fields repeat their bits so the largest value becomes 255 and wide
+// ones drop their low bits
+static inline uint32_t
+fieldWiden(uint32_t field, uint32_t bits)
+{
+    if (bits >= 8)
+        return field >> (bits - 8);
+
+    field <<= 8 - bits;
+    for (uint32_t filled = bits; filled < 8; filled *= 2)
+        field |= field >> filled;
+    return field;
+}
 
-// saves the bmp 
+// rounds an 8 bit channel back to a field of bits bits. A channel that still
+// holds the widened field gets the field itself back, so wide fields keep
+// their low bits where the operations leave them alone
+static inline uint32_t
+fieldNarrow(uint32_t value, uint32_t field, uint32_t bits)
+{
+    if (value == fieldWiden(field, bits))
+        return field;
+    return (uint32_t)(((uint64_t)value * ((1u << bits) - 1) + 127) / 255);
+}
+
+// structure for holding a rectangle of pixels, x and y count from the top
+// left corner whatever the order of the scanlines in the file
+typedef struct bitmapRect_s {
+    uint32_t x, y;
+    uint32_t width, height;
+} bmpRect_t;
+
+// structure for holding a memory mapped output bitmap
+typedef struct bitmapMap_s {
+    uint8_t *base;    // start of the mapped output file, NULL when not mapped
+    size_t   length;  // length of the mapping in bytes
+    char    *temp;    // name the output is written under until unmapBmp
+    char    *name;    // renames it to this one
+} bmpMap_t;
+
+// loads in the info of the bitmap, stats may be NULL
+uint8_t *loadBmp(char *fp, bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, bmpStats_t *stats);
+
+// loads only the rectangle of the bitmap, reading just its bytes from the
+// file, the headers and pixels returned are those of the rectangle. Exits
+// when the rectangle isn't inside the image
+uint8_t *loadBmpRegion(
+    char *fp, bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH,
+    const bmpRect_t *rect, bmpStats_t *stats);
+
+// saves the bmp, stats may be NULL. RLE8 and RLE4 in Compression compress
+// the pixels on the way out
 void saveBmp(
     char *fp, bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, 
-    uint8_t *bmpData);
+    uint8_t *bmpData, bmpStats_t *stats);
+
+// writes the headers, the gap and the pixels of a loadBmp image to fp,
+// compressed when Compression is RLE8 or RLE4. Returns the bytes written,
+// 0 when writing failed
+uint64_t writeBmp(FILE *fp, bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, uint8_t *bmpData);
+
+// frees the pixel array of loadBmp
+void freeBmp(bmpFileHeader_t *bmpFH, uint8_t *bmpData);
+
+// maps the input bmp and a freshly created output bmp, returns the pixel array
+// inside the output mapping or NULL when the files can't be mapped
+uint8_t *mapBmp(
+    char *inName, char *outName, bmpFileHeader_t *bmpFH, 
+    bmpInfoHeader_t *bmpIH, bmpMap_t *bmpMap, bmpStats_t *stats);
+
+// releases the output mapping, the kernel writes the pages back to the file
+void unmapBmp(bmpMap_t *bmpMap, bmpStats_t *stats);
+
+// streams the bmp through the point operations in bands of scanlines so no 
+// more than maxMem bytes of pixels are held in memory at once, compress is
+// the compression of the output. The output pixels are counted into
+// histogram unless it is NULL
+void streamBmp(
+    char *inName, char *outName, size_t maxMem, enum bmpCompression_e compress,
+    const opChain_t *chain, pixelHistogram_t *histogram, threadPool_t *pool,
+    bmpStats_t *stats);
+
+// applies the point operations to count scanlines, split over the pool
+// according to the pixel format, indexed images are left alone. When
+// histogram isn't NULL the resulting pixels are added to it in the same pass
+void processRows(
+    uint8_t *rows, uint32_t count, bmpInfoHeader_t *bmpIH, const pixelFormat_t *format,
+    const opChain_t *chain, pixelHistogram_t *histogram, threadPool_t *pool);
+
+// applies the whole chain to an image in memory: the point operations with
+// processRows, the operations from blur to edges, which need the neighbors
+// of every pixel, with convolvePixels and the lookup tables at the start of
+// the next processRows pass. autolevels and equalize build theirs from the
+// pixels counted in the pass before. The final pixels are counted into
+// histogram unless it is NULL, it has to be set up with histogramInit after
+// processPalette. false when the chain has neighborhood operations and the
+// image isn't 24 or 32 bit, or autolevels or equalize and it is indexed
+bool processImage(
+    uint8_t *bmpData, bmpInfoHeader_t *bmpIH, const pixelFormat_t *format,
+    const opChain_t *chain, pixelHistogram_t *histogram, threadPool_t *pool);
+
+// applies the chain to the pixels inside rect only, the rest of the image is
+// left as it is. The histogram counts the rectangle. false like processImage
+// or when the palette of an indexed image would have to change
+bool processRegion(
+    uint8_t *bmpData, bmpInfoHeader_t *bmpIH, const pixelFormat_t *format,
+    const bmpRect_t *rect, const opChain_t *chain, pixelHistogram_t *histogram,
+    threadPool_t *pool);
+
+// true when rect lies inside the image
+bool rectInside(const bmpRect_t *rect, bmpInfoHeader_t *bmpIH);
+
+// true when the chain has an operation that needs the neighbors of a pixel
+bool chainConvolves(const opChain_t *chain);
+
+// true when the chain has an operation that needs the whole image at once,
+// the neighborhood operations, autolevels and equalize
+bool chainWholeImage(const opChain_t *chain);
+
+// applies the point operations and gamma to the palette of an indexed image,
+// extra points at the bytes after the info header. Does nothing for other
+// images
+void processPalette(uint8_t *extra, const pixelFormat_t *format, const opChain_t *chain);
+
+// works out the pixel format from the info header and the extraSize bytes 
+// after it (color masks and palette), false when it isn't supported
+bool parseFormat(
+    bmpInfoHeader_t *bmpIH, const uint8_t *extra, size_t extraSize,
+    pixelFormat_t *format);
+
+// appends an operation to the chain, false if the chain is full
+bool addOp(opChain_t *chain, enum filterID_e filterID);
+
+// appends a comma separated list of operations like "invert,sepia,brightness=20" to the chain
+bool parseOps(const char *list, opChain_t *chain);
+
+// drops the operations that cancel out or repeat themselves and builds the 
+// fixed point matrices, needs to be called before the chain is applied
+bool compileOps(opChain_t *chain);
+
+// number of bytes in one scanline including the padding to 4 bytes
+uint32_t bmpRowSize(bmpInfoHeader_t *bmpIH);
+
+// number of bytes in the pixel array, for uncompressed images the size of the
+// rows since their SizeImage may be 0 or wrong
+uint32_t bmpImageSize(bmpInfoHeader_t *bmpIH);
+
+// parses a size like "64M" into bytes, 0 on a malformed size
+size_t parseSize(const char *str);
+
+// parses none, rle8 or rle4, false on an unknown compression
+bool parseCompress(const char *str, enum bmpCompression_e *compress);
+
+// true for an RLE image the decoder can handle: bottom-up with the bit
+// count matching the compression
+bool bmpRleValid(bmpInfoHeader_t *bmpIH);
+
+// parses a size like "640x480" into pixels, false on a malformed size
+bool parseResize(const char *str, uint32_t *width, uint32_t *height);
+
+// parses a rectangle like "10,20,640,480" (x,y,width,height), false on a
+// malformed or empty one
+bool parseRect(const char *str, bmpRect_t *rect);
+
+// parses nearest, bilinear or lanczos, false on an unknown mode
+bool parseResample(const char *str, enum resampleMode_e *mode);
 
 // inverses the colors of the bmp pixel array
 uint8_t *reverseBmp(uint8_t *bmpimg, uint32_t SizeImage);
@@ -59,6 +302,19 @@ uint8_t *reverseBmp(uint8_t *bmpimg, uint32_t SizeImage);
 // apply a filter to the image
 uint8_t *applyFilter(uint8_t *bmpimg, uint32_t SizeImage, enum filterID_e filerID);
 
+// apply a chain of operations, every pixel is loaded and stored once
+uint8_t *applyOps(uint8_t *bmpimg, uint32_t SizeImage, const opChain_t *chain);
+
+// scalar reference versions of reverseBmp, applyFilter and applyOps
+uint8_t *reverseBmpScalar(uint8_t *bmpimg, uint32_t SizeImage);
+uint8_t *applyFilterScalar(uint8_t *bmpimg, uint32_t SizeImage, enum filterID_e filerID);
+uint8_t *applyOpsScalar(uint8_t *bmpimg, uint32_t SizeImage, const opChain_t *chain);
+
+// scalar reference of the chain on 16 and 32 bit pixels of any format
+uint8_t *applyOpsPackedScalar(
+    uint8_t *bmpimg, uint32_t SizeImage, const pixelFormat_t *format, 
+    const opChain_t *chain);
+
 // checks if the system the program runs on is little or big endian
 uint8_t endianness(void);
 
@@ -66,11 +322,20 @@ uint8_t endianness(void);
 void help(void);
 
 // dump info about the bmp file
-void bmpDump(bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, uint8_t *bmpData);
+void bmpDump(bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH);
 
-// rotates the given images by the given amount of degrees
-void rotate(
+// rotates the given images clockwise by the given amount of degrees, returns
+// the pixel array which is a new one for anything but 180 degrees
+uint8_t *rotate(
     bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH,
-    uint8_t *bmpData, float degree);
+    uint8_t *bmpData, float degree, enum resampleMode_e mode, threadPool_t *pool);
+
+// scales the image to width x height, returns the new pixel array
+uint8_t *resize(
+    bmpFileHeader_t *bmpFH, bmpInfoHeader_t *bmpIH, uint8_t *bmpData,
+    uint32_t width, uint32_t height, enum resampleMode_e mode, threadPool_t *pool);
+
+// mirrors the image in place, 'h' flips left to right and 'v' top to bottom
+void flip(bmpInfoHeader_t *bmpIH, uint8_t *bmpData, char axis);
 
-#endif//_HELPER_H_
\ No newline at end of file
+#endif//_HELPER_H_
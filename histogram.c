@@ -0,0 +1,248 @@
+#include "helper.h"
+
+#include <strings.h>   // strcasecmp
+
+// names of the channels in the JSON
+static const char *channelNames[HISTOGRAM_CHANNELS] = { "blue", "green", "red", "luminance" };
+
+// the luminance percentiles that are reported
+static const uint32_t percentiles[] = { 1, 5, 25, 50, 75, 95, 99 };
+
+void
+histogramInit(
+    pixelHistogram_t *hist, uint32_t width, uint32_t height,
+    const uint8_t *palette, uint32_t colors)
+{
+    memset(hist, 0, sizeof(pixelHistogram_t));
+    hist->width  = width;
+    hist->height = height;
+    if (palette == NULL)
+        return;
+
+    hist->colors = (colors > 256) ? 256 : colors;
+    memcpy(hist->palette, palette, (size_t)hist->colors * 4);
+    return;
+}
+
+// counts one pixel, the luminance uses the weights of greyscale
+static inline void
+countPixel(pixelHistogram_t *hist, uint32_t b, uint32_t g, uint32_t r)
+{
+    hist->count[0][b]++;
+    hist->count[1][g]++;
+    hist->count[2][r]++;
+    hist->count[3][(29 * b + 150 * g + 77 * r + 128) >> 8]++;
+}
+
+// counts a scanline of B, G, R pixels bpp bytes apart. Neighboring pixels
+// tend to have the same values, so the even and odd pixels are counted in
+// two tables or every increment would wait for the one before it
+__attribute__((always_inline)) static inline void
+countBgr(pixelHistogram_t *hist, const uint8_t *line, uint32_t width, uint32_t bpp)
+{
+    uint32_t x = 0;
+
+    for (; x + 1 < width; x += 2, line += 2 * bpp) {
+        uint32_t b0 = line[0], g0 = line[1], r0 = line[2];
+        uint32_t b1 = line[bpp], g1 = line[bpp + 1], r1 = line[bpp + 2];
+
+        hist->count[0][b0]++;
+        hist->odd[0][b1]++;
+        hist->count[1][g0]++;
+        hist->odd[1][g1]++;
+        hist->count[2][r0]++;
+        hist->odd[2][r1]++;
+        hist->count[3][(29 * b0 + 150 * g0 + 77 * r0 + 128) >> 8]++;
+        hist->odd[3][(29 * b1 + 150 * g1 + 77 * r1 + 128) >> 8]++;
+    }
+    if (x < width)
+        countPixel(hist, line[0], line[1], line[2]);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: histogramRow                                                *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Counts the pixels of one scanline. 24 and 32 bit BGR pixels are counted   *
+ *  straight from their bytes, other 16 and 32 bit pixels have their color    *
+ *  fields widened to 8 bits the way the operations see them, and the         *
+ *  indices of indexed images are looked up in the palette                    *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  pixelHistogram_t *hist                                                    *
+ *  const uint8_t *line                                                       *
+ *  uint32_t width                                                            *
+ *  uint32_t bitCount                                                         *
+ *  const pixelFormat_t *format                                               *
+ *  const pixelHistogram_t *colors                                            *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+histogramRow(
+    pixelHistogram_t *hist, const uint8_t *line, uint32_t width, uint32_t bitCount,
+    const pixelFormat_t *format, const pixelHistogram_t *colors)
+{
+    hist->pixels += width;
+
+    switch (format->layout) {
+        case layoutBgr24:
+            countBgr(hist, line, width, 3);
+            break;
+
+        case layoutBgrx32:
+            countBgr(hist, line, width, 4);
+            break;
+
+        case layoutIndexed:
+            for (uint32_t x = 0; x < width; x++) {
+                uint32_t bit   = x * bitCount;
+                uint32_t index = (line[bit / 8] >> (8 - bitCount - bit % 8)) & ((1u << bitCount) - 1);
+                const uint8_t *color = colors->palette[index];
+
+                countPixel(hist, color[0], color[1], color[2]);
+            }
+            break;
+
+        default: {
+            uint32_t max[3];   // largest value of every field
+
+            for (int c = 0; c < 3; c++)
+                max[c] = (1u << format->bits[c]) - 1;
+
+            for (uint32_t x = 0; x < width; x++, line += format->bytes) {
+                uint32_t pixel = line[0] | (uint32_t)line[1] << 8;
+                uint32_t in[3];
+
+                if (format->bytes == 4)
+                    pixel |= (uint32_t)line[2] << 16 | (uint32_t)line[3] << 24;
+
+                for (int c = 0; c < 3; c++)
+                    in[c] = fieldWiden((pixel >> format->shift[c]) & max[c], format->bits[c]);
+                countPixel(hist, in[0], in[1], in[2]);
+            }
+        } break;
+    }
+
+    return;
+}
+
+void
+histogramMerge(pixelHistogram_t *into, const pixelHistogram_t *from)
+{
+    for (uint32_t channel = 0; channel < HISTOGRAM_CHANNELS; channel++)
+        for (uint32_t value = 0; value < 256; value++)
+            into->count[channel][value] += from->count[channel][value] + from->odd[channel][value];
+
+    into->pixels += from->pixels;
+    return;
+}
+
+// the path of the JSON next to an image, malloced
+static char *
+histogramPath(const char *image)
+{
+    size_t length = strlen(image);
+    char *path    = malloc(length + 6);
+
+    if (path == NULL) {
+        fprintf(stderr, "histogram memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // out.bmp becomes out.json, anything else gets .json appended
+    if (length > 4 && strcasecmp(image + length - 4, ".bmp") == 0)
+        length -= 4;
+    memcpy(path, image, length);
+    strcpy(path + length, ".json");
+    return path;
+}
+
+// smallest value with at least percent of the pixels at or below it
+static uint32_t
+percentile(const uint64_t *count, uint64_t pixels, uint32_t percent)
+{
+    uint64_t rank  = (pixels * percent + 99) / 100;
+    uint64_t below = 0;
+
+    for (uint32_t value = 0; value < 256; value++) {
+        below += count[value];
+        if (below >= rank && below != 0)
+            return value;
+    }
+    return 0;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: histogramSave                                               *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Writes the image, the source it was made from, its size and per channel   *
+ *  the minimum, maximum, mean and the 256 counts as JSON next to the image.  *
+ *  The luminance also gets its percentiles, by nearest rank                  *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *image                                                         *
+ *  const char *source                                                        *
+ *  const pixelHistogram_t *hist                                              *
+ *                                                                            *
+ * Return:                                                                    *
+ *  false when the file can't be written                                      *
+ ******************************************************************************
+!*/
+bool
+histogramSave(const char *image, const char *source, const pixelHistogram_t *hist)
+{
+    char *path = histogramPath(image);
+    FILE *fp   = fopen(path, "w");
+
+    free(path);
+    if (fp == NULL)
+        return false;
+
+    fprintf(fp, "{\"image\":");
+    statsJsonString(fp, image);
+    fprintf(fp, ",\"source\":");
+    statsJsonString(fp, source);
+    fprintf(
+        fp, ",\"width\":%u,\"height\":%u,\"pixels\":%llu,\"channels\":{",
+        hist->width, hist->height, (unsigned long long)hist->pixels);
+
+    for (uint32_t channel = 0; channel < HISTOGRAM_CHANNELS; channel++) {
+        const uint64_t *count = hist->count[channel];
+        uint32_t min = 0, max = 0;
+        uint64_t sum = 0;
+
+        for (uint32_t value = 0; value < 256; value++)
+            sum += (uint64_t)value * count[value];
+        while (hist->pixels && count[min] == 0) min++;
+        for (max = 255; hist->pixels && count[max] == 0; max--);
+        if (hist->pixels == 0) max = 0;
+
+        fprintf(
+            fp, "%s\n\"%s\":{\"min\":%u,\"max\":%u,\"mean\":%.3f,", channel ? "," : "",
+            channelNames[channel], min, max, hist->pixels ? (double)sum / hist->pixels : 0.0);
+
+        if (channel == 3) {
+            fprintf(fp, "\"percentiles\":{");
+            for (uint32_t idx = 0; idx < sizeof(percentiles) / sizeof(percentiles[0]); idx++)
+                fprintf(
+                    fp, "%s\"p%u\":%u", idx ? "," : "", percentiles[idx],
+                    percentile(count, hist->pixels, percentiles[idx]));
+            fprintf(fp, "},");
+        }
+
+        fprintf(fp, "\"histogram\":[");
+        for (uint32_t value = 0; value < 256; value++)
+            fprintf(fp, "%s%llu", value ? "," : "", (unsigned long long)count[value]);
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n}}\n");
+
+    return fclose(fp) == 0;
+}
+
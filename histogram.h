@@ -0,0 +1,47 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>  // int typedefs
+#include <stdbool.h> // true, false
+
+struct pixelFormat_s;
+
+// channels counted, blue, green, red and the luminance
+#define HISTOGRAM_CHANNELS  4
+
+// structure for holding the histograms of an image, every worker counts
+// into one of its own and they are merged once the pass is done
+typedef struct pixelHistogram_s {
+    uint64_t count[HISTOGRAM_CHANNELS][256];   // pixels per value of every channel
+    uint64_t odd[HISTOGRAM_CHANNELS][256];     // the odd pixels of 24 and 32 bit rows, see
+                                               // histogramRow, added to count by histogramMerge
+    uint64_t pixels;                           // pixels counted
+    uint32_t width, height;                    // size of the image
+    uint32_t colors;                           // palette entries of an indexed image
+    uint8_t palette[256][4];                   // its colors in B, G, R, X order, after
+                                               // processPalette. Also keeps the counts
+                                               // of neighboring workers on other lines
+} pixelHistogram_t;
+
+// clears the counts, notes the size of the image and copies the palette of
+// an indexed image, palette may be NULL for other images
+void histogramInit(
+    pixelHistogram_t *hist, uint32_t width, uint32_t height,
+    const uint8_t *palette, uint32_t colors);
+
+// counts the width pixels of one scanline of bitCount bits per pixel,
+// indices of indexed images are looked up in the palette of colors
+void histogramRow(
+    pixelHistogram_t *hist, const uint8_t *line, uint32_t width, uint32_t bitCount,
+    const struct pixelFormat_s *format, const pixelHistogram_t *colors);
+
+// adds the counts of from to into
+void histogramMerge(pixelHistogram_t *into, const pixelHistogram_t *from);
+
+// writes the histograms with the minimum, maximum and mean of every channel
+// and the percentiles of the luminance as JSON next to image, out.bmp gets
+// out.json. source is the image it was made from. false when the file
+// can't be written
+bool histogramSave(const char *image, const char *source, const pixelHistogram_t *hist);
+
+#endif//_HISTOGRAM_H_
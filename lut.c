@@ -0,0 +1,175 @@
+#include "helper.h"
+
+void
+lutGamma(channelLut_t *lut, float gamma)
+{
+    for (uint32_t value = 0; value < 256; value++) {
+        uint8_t out = (uint8_t)lround(255.0 * pow(value / 255.0, 1.0 / gamma));
+
+        lut->table[0][value] = lut->table[1][value] = lut->table[2][value] = out;
+    }
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: lutLevels                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Finds the lowest and the highest value of every channel, skipping clip    *
+ *  percent of the pixels at both ends so a few stray pixels don't decide the *
+ *  stretch, and maps that range linearly onto 0 - 255. A channel with only   *
+ *  one value left is kept as it is                                           *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  channelLut_t *lut                                                         *
+ *  const pixelHistogram_t *hist                                              *
+ *  float clip                                                                *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+lutLevels(channelLut_t *lut, const pixelHistogram_t *hist, float clip)
+{
+    uint64_t cut = (uint64_t)(hist->pixels * (double)clip / 100.0);
+
+    for (uint32_t c = 0; c < 3; c++) {
+        const uint64_t *count = hist->count[c];
+        uint64_t below = 0, above = 0;
+        uint32_t low = 0, high = 255;
+
+        while (low < 255 && (below += count[low]) <= cut) low++;
+        while (high > 0 && (above += count[high]) <= cut) high--;
+
+        for (uint32_t value = 0; value < 256; value++) {
+            if (high <= low)
+                lut->table[c][value] = (uint8_t)value;
+            else if (value <= low)
+                lut->table[c][value] = 0;
+            else if (value >= high)
+                lut->table[c][value] = 255;
+            else
+                lut->table[c][value] = (uint8_t)(((value - low) * 510 + (high - low)) / (2 * (high - low)));
+        }
+    }
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: lutEqualize                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Maps every value of a channel to the share of the pixels at or below it,  *
+ *  scaled to 0 - 255 from the lowest value that occurs, so the values that   *
+ *  hold many pixels are spread apart and rare ones are squeezed together     *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  channelLut_t *lut                                                         *
+ *  const pixelHistogram_t *hist                                              *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+lutEqualize(channelLut_t *lut, const pixelHistogram_t *hist)
+{
+    for (uint32_t c = 0; c < 3; c++) {
+        const uint64_t *count = hist->count[c];
+        uint64_t first = 0, below = 0, range;
+        uint32_t value = 0;
+
+        // the pixels of the lowest value all end up at 0
+        while (value < 255 && count[value] == 0) value++;
+        first = count[value];
+        range = hist->pixels - first;
+
+        for (value = 0; value < 256; value++) {
+            below += count[value];
+            if (range == 0)
+                lut->table[c][value] = (uint8_t)value;
+            else
+                lut->table[c][value] = (below <= first) ? 0 : (uint8_t)(((below - first) * 510 + range) / (2 * range));
+        }
+    }
+    return;
+}
+
+void
+lutCompose(channelLut_t *lut, const channelLut_t *next)
+{
+    for (uint32_t c = 0; c < 3; c++)
+        for (uint32_t value = 0; value < 256; value++)
+            lut->table[c][value] = next->table[c][lut->table[c][value]];
+    return;
+}
+
+// looks up the pixels with a constant pixel size, two at the time so the
+// loads of the second pixel don't wait for the stores of the first
+__attribute__((always_inline)) static inline void
+lookupPixels(uint8_t *line, uint32_t width, uint32_t bpp, const channelLut_t *lut)
+{
+    const uint8_t *blue = lut->table[0], *green = lut->table[1], *red = lut->table[2];
+    uint32_t x = 0;
+
+    for (; x + 1 < width; x += 2, line += 2 * bpp) {
+        uint8_t b0 = blue[line[0]], g0 = green[line[1]], r0 = red[line[2]];
+        uint8_t b1 = blue[line[bpp]], g1 = green[line[bpp + 1]], r1 = red[line[bpp + 2]];
+
+        line[0]       = b0;
+        line[1]       = g0;
+        line[2]       = r0;
+        line[bpp]     = b1;
+        line[bpp + 1] = g1;
+        line[bpp + 2] = r1;
+    }
+    if (x < width) {
+        line[0] = blue[line[0]];
+        line[1] = green[line[1]];
+        line[2] = red[line[2]];
+    }
+}
+
+void
+lutApply(uint8_t *line, uint32_t width, uint32_t bpp, const channelLut_t *lut)
+{
+    if (bpp == 3)
+        lookupPixels(line, width, 3, lut);
+    else
+        lookupPixels(line, width, 4, lut);
+    return;
+}
+
+void
+lutApplyPacked(uint8_t *line, uint32_t width, const pixelFormat_t *format, const channelLut_t *lut)
+{
+    uint32_t max[3];   // largest value of every field
+
+    for (int c = 0; c < 3; c++)
+        max[c] = (1u << format->bits[c]) - 1;
+
+    for (uint32_t x = 0; x < width; x++, line += format->bytes) {
+        uint32_t pixel = line[0] | (uint32_t)line[1] << 8;
+
+        if (format->bytes == 4)
+            pixel |= (uint32_t)line[2] << 16 | (uint32_t)line[3] << 24;
+
+        for (int c = 0; c < 3; c++) {
+            uint32_t field = (pixel >> format->shift[c]) & max[c];
+            uint32_t out   = fieldNarrow(lut->table[c][fieldWiden(field, format->bits[c])], field, format->bits[c]);
+
+            pixel = (pixel & ~(max[c] << format->shift[c])) | out << format->shift[c];
+        }
+
+        line[0] = (uint8_t)pixel;
+        line[1] = (uint8_t)(pixel >> 8);
+        if (format->bytes == 4) {
+            line[2] = (uint8_t)(pixel >> 16);
+            line[3] = (uint8_t)(pixel >> 24);
+        }
+    }
+    return;
+}
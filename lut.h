@@ -0,0 +1,38 @@
+#ifndef _LUT_H_
+#define _LUT_H_
+
+#include <stdint.h>  // int typedefs
+
+#include "histogram.h"
+
+struct pixelFormat_s;
+
+// structure for holding a lookup table for every channel, in B, G, R order
+typedef struct channelLut_s {
+    uint8_t table[3][256];
+} channelLut_t;
+
+// out = 255 * (in / 255)^(1 / gamma), above 1 brightens the midtones
+void lutGamma(channelLut_t *lut, float gamma);
+
+// stretches every channel so the darkest and the brightest values, apart
+// from clip percent of the pixels at either end, become 0 and 255
+void lutLevels(channelLut_t *lut, const pixelHistogram_t *hist, float clip);
+
+// spreads the values of every channel so their histogram becomes about flat
+void lutEqualize(channelLut_t *lut, const pixelHistogram_t *hist);
+
+// changes lut into lut followed by next
+void lutCompose(channelLut_t *lut, const channelLut_t *next);
+
+// looks up the width B, G, R pixels of a scanline, bpp bytes apart. The
+// fourth byte of 32 bit pixels is kept
+void lutApply(uint8_t *line, uint32_t width, uint32_t bpp, const channelLut_t *lut);
+
+// the same on 16 and 32 bit pixels with color fields of any size, those are
+// widened to 8 bits, looked up and narrowed back
+void lutApplyPacked(
+    uint8_t *line, uint32_t width, const struct pixelFormat_s *format,
+    const channelLut_t *lut);
+
+#endif//_LUT_H_
@@ -20,6 +20,9 @@
 !*/
 
 #include "helper.h"
+#include "batch.h"
+#include "server.h"
+#include "cache.h"
 
 int
 main(int argc, char *argv[])
@@ -35,23 +38,77 @@ main(int argc, char *argv[])
         { "invert",     0, NULL, 'i' },
         { "rotate",     1, NULL, 'r' },
         { "outputfile", 1, NULL, 'o' },
+        { "threads",    1, NULL, 'j' },
+        { "max-mem",    1, NULL, 'm' },
         { "filter",     1, NULL, 'f' },
+        { "ops",        1, NULL, 'O' },
+        { "flip",       1, NULL, 'F' },
+        { "resize",     1, NULL, 'R' },
+        { "resample",   1, NULL, 'S' },
+        { "batch",      1, NULL, 'b' },
+        { "outdir",     1, NULL, 'd' },
+        { "stats",      1, NULL, 'T' },
+        { "stats-file", 1, NULL, 'P' },
+        { "compress",   1, NULL, 'C' },
+        { "histogram",  0, NULL, 'H' },
+        { "stats-pixels", 0, NULL, 'H' },
+        { "crop",       1, NULL, 'X' },
+        { "roi",        1, NULL, 'Z' },
+        { "serve",      1, NULL, 's' },
+        { "cache",      1, NULL, 'K' },
+        { "cache-size", 1, NULL, 'k' },
         { NULL,         0, NULL, 0 }
     };
-    const char *short_options = "hvir:o:f:";
+    const char *short_options = "hvir:o:j:m:f:b:d:";
 
     bool verbose          = false;
-    int32_t rotation      = 0;
+    float rotation        = 0;
+    uint32_t resizeWidth  = 0;
+    uint32_t resizeHeight = 0;
+    enum resampleMode_e resample = resampleBilinear;
     uint8_t filter        = 0;
+    char flipAxis         = 0;
     uint32_t next_option  = 0;
-    uint8_t invert        = 0;
+    bool inverted         = false;
+    opChain_t ops         = { 0 };
+    opChain_t chain       = { 0 };
     uint8_t endian        = endianness();
     uint8_t *bmpData      = NULL;
-    int8_t *outputfile    = NULL;
+    uint8_t *extra;       // the masks and the palette after the info header
+    char *outputName      = NULL;
+    size_t maxMem         = 0;
+    uint32_t threads      = 1;
+    char *batchSource     = NULL;
+    char *outputDir       = NULL;
+    char *servePath       = NULL;
+    char *cacheDir        = NULL;
+    size_t cacheSize      = (size_t)1 << 30;
+    resultCache_t cache;
+    char description[CACHE_DESCRIPTION]; // everything the result depends on but the input
+    uint32_t failures     = 0;
+    threadPool_t *pool    = NULL;
+    enum statsFormat_e statsFormat = statsOff;
+    char *statsPath       = NULL;
+    statsSink_t sink;
+    bmpStats_t stats      = { 0 };
+    bmpStats_t *imageStats = NULL;  // &stats when --stats is given, NULL turns the timing off
+    enum bmpCompression_e compress = compressionRgb;
+    pixelHistogram_t pixels;
+    pixelHistogram_t *histogram = NULL; // &pixels when --histogram is given
+    bmpRect_t cropRect;
+    bmpRect_t *crop       = NULL;   // &cropRect when --crop is given
+    bmpRect_t roiRect;
+    bmpRect_t *roi        = NULL;   // &roiRect when --roi is given
+    double start;
+    pixelFormat_t format;
+    bmpMap_t bmpMap;
 
     bmpFileHeader_t bmpFH;
     bmpInfoHeader_t bmpIH;
 
+    // pick the pixel kernels for this cpu
+    selectKernels();
+
     // parse options
     while (1) {
         // obtain a option
@@ -64,49 +121,363 @@ main(int argc, char *argv[])
                    case 'h':    help();
                                 exit(EXIT_SUCCESS);
             break; case 'v':    verbose = true;
-            break; case 'i':    invert = 1;
-            break; case 'r':    rotation = atoi(optarg);
-            break; case 'o':    outputfile = malloc(sizeof(char) * (strlen(optarg) + 1));
-                                strcpy((char *)outputfile, optarg);
+            break; case 'i':    inverted = true;
+            break; case 'r':    rotation = atof(optarg);
+            break; case 'o':    outputName = optarg;
+            break; case 'j':    threads = atoi(optarg);
+            break; case 'm':    maxMem = parseSize(optarg);
+                                if (maxMem == 0) {
+                                    fprintf(stderr, "invalid max-mem \"%s\"\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
             break; case 'f':    filter = atoi(optarg);
+            break; case 'b':    batchSource = optarg;
+            break; case 'd':    outputDir = optarg;
+            break; case 's':    servePath = optarg;
+            break; case 'K':    cacheDir = optarg;
+            break; case 'k':    cacheSize = parseSize(optarg);
+                                if (cacheSize == 0) {
+                                    fprintf(stderr, "invalid cache-size \"%s\"\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
+            break; case 'F':    flipAxis = optarg[0];
+                                if ((flipAxis != 'h' && flipAxis != 'v') || optarg[1] != '\0') {
+                                    fprintf(stderr, "invalid flip \"%s\", use h or v\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
+            break; case 'R':    if (!parseResize(optarg, &resizeWidth, &resizeHeight)) {
+                                    fprintf(stderr, "invalid resize \"%s\", use WIDTHxHEIGHT\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
+            break; case 'S':    if (!parseResample(optarg, &resample)) {
+                                    fprintf(stderr, "unknown resample mode \"%s\"\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
+            break; case 'T':    if (!statsParse(optarg, &statsFormat)) {
+                                    fprintf(stderr, "unknown stats format \"%s\", use json or prometheus\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
+            break; case 'P':    statsPath = optarg;
+            break; case 'H':    histogram = &pixels;
+            break; case 'X':    if (!parseRect(optarg, &cropRect)) {
+                                    fprintf(stderr, "invalid crop \"%s\", use x,y,width,height\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
+                                crop = &cropRect;
+            break; case 'Z':    if (!parseRect(optarg, &roiRect)) {
+                                    fprintf(stderr, "invalid roi \"%s\", use x,y,width,height\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
+                                roi = &roiRect;
+            break; case 'C':    if (!parseCompress(optarg, &compress)) {
+                                    fprintf(stderr, "unknown compression \"%s\", use none, rle8 or rle4\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
+            break; case 'O':    if (!parseOps(optarg, &ops)) {
+                                    fprintf(stderr, "invalid operation list \"%s\"\n", optarg);
+                                    exit(EXIT_FAILURE);
+                                }
             break; case '?':    help();
                    case -1:     // no more options
             break; default:     exit(EXIT_FAILURE);
         }
     }
 
-    // load in the .bmp file
-    bmpData = loadBmp(argv[optind], &bmpFH, &bmpIH);
-    rotate(&bmpFH, &bmpIH, bmpData, 0);
+    // if the outputfile hasn't been declared take on default name of "output.bmp"
+    if (outputName == NULL) outputName = "output.bmp";
+
+    // build the chain: invert, then the filter, then the --ops list
+    if (inverted) addOp(&chain, invert);
+    if (filter > greyscale || !addOp(&chain, filter)) {
+        fprintf(stderr, "unknown filter %d\n", filter);
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t opIdx = 0; opIdx < ops.count; opIdx++) {
+        if (!addOp(&chain, ops.op[opIdx])) {
+            fprintf(stderr, "too many operations, at most %d are allowed\n", MAX_OPS);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(chain.arg[chain.count - 1], ops.arg[opIdx], sizeof(ops.arg[0]));
+    }
+    if (!compileOps(&chain)) {
+        fprintf(stderr, "operation arguments out of range\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // start the worker threads, 0 means one thread per core. The server
+    // runs its jobs on threads of its own instead
+    if (threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > 1 && servePath == NULL) pool = poolCreate(threads);
+
+    // the stats of every image go to stdout or the stats file
+    if (statsFormat != statsOff) {
+        if (!statsOpen(&sink, statsFormat, statsPath)) {
+            fprintf(stderr, "Failed opening file \"%s\"\n", statsPath);
+            exit(EXIT_FAILURE);
+        }
+        imageStats = &stats;
+    }
+
+    // the geometry needs the whole image in memory
+    if ((fmodf(rotation, 360) != 0 || flipAxis || resizeWidth || resizeHeight) &&
+        (batchSource != NULL || maxMem)) {
+        fprintf(stderr, "rotate, flip and resize can't be combined with --batch or --max-mem\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // so do the rectangles, which are in pixels of one image
+    if ((crop != NULL || roi != NULL) && (batchSource != NULL || maxMem)) {
+        fprintf(stderr, "crop and roi can't be combined with --batch or --max-mem\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the cache holds one result per input and set of operations, the
+    // histogram isn't part of it
+    if (cacheDir != NULL && (batchSource != NULL || servePath != NULL || histogram != NULL)) {
+        fprintf(stderr, "--cache can't be combined with --batch, --serve or --histogram\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cacheDir != NULL && optind >= argc) {
+        fprintf(stderr, "--cache needs an input file, it keys the result on the file's bytes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the server takes its images from the jobs sent to it
+    if (servePath != NULL) {
+        if (batchSource != NULL || maxMem || crop != NULL || roi != NULL || histogram != NULL ||
+            fmodf(rotation, 360) != 0 || flipAxis || resizeWidth || resizeHeight) {
+            fprintf(stderr, "--serve only takes the operations, --compress, --stats and -j\n");
+            exit(EXIT_FAILURE);
+        }
+        failures = serveRun(servePath, &chain, compress, threads, verbose, imageStats ? &sink : NULL);
+        if (imageStats) statsClose(&sink);
+        arenaTrim();
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // batch mode processes a whole directory or list of files in one go
+    if (batchSource != NULL) {
+        if (outputDir == NULL) {
+            fprintf(stderr, "batch mode needs an output directory (-d)\n");
+            exit(EXIT_FAILURE);
+        }
+        failures = batchRun(
+            batchSource, outputDir, compress, &chain, histogram != NULL, pool, verbose, imageStats ? &sink : NULL);
+        if (imageStats) statsClose(&sink);
+        poolDestroy(pool);
+        arenaTrim();
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // with a memory cap the image is streamed through the filters in bands,
+    // which only works for operations that look at one pixel at the time
+    if (maxMem && chainWholeImage(&chain)) {
+        fprintf(stderr, "blur, boxblur, sharpen, edges, autolevels and equalize can't be combined with --max-mem\n");
+        exit(EXIT_FAILURE);
+    }
+    // the key of the cache is the input and everything else that shapes the
+    // result, the rotation normalized and the operations as compiled, so -i
+    // and --ops invert share an entry. On a hit the result is copied over
+    if (cacheDir != NULL) {
+        int used = snprintf(
+            description, sizeof(description), "rotate=%.9g flip=%c resize=%ux%u resample=%d compress=%d",
+            fmodf(fmodf(rotation, 360) + 360, 360), flipAxis ? flipAxis : '-', resizeWidth, resizeHeight,
+            (int)resample, (int)compress);
+
+        if (crop != NULL)
+            used += snprintf(description + used, sizeof(description) - used, " crop=%u,%u,%u,%u",
+                crop->x, crop->y, crop->width, crop->height);
+        if (roi != NULL)
+            used += snprintf(description + used, sizeof(description) - used, " roi=%u,%u,%u,%u",
+                roi->x, roi->y, roi->width, roi->height);
+        for (uint32_t opIdx = 0; opIdx < chain.count; opIdx++)
+            used += snprintf(description + used, sizeof(description) - used, " %d=%.9g,%.9g,%.9g",
+                (int)chain.op[opIdx], chain.arg[opIdx][0], chain.arg[opIdx][1], chain.arg[opIdx][2]);
+
+        start = statsNow();
+        if (!cacheOpen(&cache, cacheDir, cacheSize)) {
+            fprintf(stderr, "Failed creating directory \"%s\"\n", cacheDir);
+            exit(EXIT_FAILURE);
+        }
+        if (!cacheKey(&cache, argv[optind], description)) {
+            fprintf(stderr, "Failed hashing \"%s\", --cache only takes regular files\n", argv[optind]);
+            exit(EXIT_FAILURE);
+        }
+        if (cacheFetch(&cache, outputName)) {
+            statsStage(imageStats, "cache", start, cache.inputBytes);
+            if (verbose)
+                printf("cache hit %s, %llu hits, %llu misses\n", cache.key,
+                    (unsigned long long)cache.counters.hits, (unsigned long long)cache.counters.misses);
+            if (imageStats) {
+                statsReport(&sink, argv[optind], imageStats);
+                statsClose(&sink);
+            }
+            poolDestroy(pool);
+            return 0;
+        }
+        statsStage(imageStats, "cache", start, cache.inputBytes);
+    }
+
+    if (maxMem) {
+        streamBmp(argv[optind], outputName, maxMem, compress, &chain, histogram, pool, imageStats);
+        if (histogram != NULL) {
+            start = statsNow();
+            if (!histogramSave(outputName, argv[optind], histogram)) {
+                fprintf(stderr, "error writing the histogram of \"%s\"\n", outputName);
+                exit(EXIT_FAILURE);
+            }
+            statsStage(imageStats, "histogram", start, 0);
+        }
+        if (cacheDir != NULL) {
+            start = statsNow();
+            if (!cacheStore(&cache, outputName))
+                fprintf(stderr, "error storing \"%s\" in the cache\n", outputName);
+            statsStage(imageStats, "cache_store", start, 0);
+            if (verbose)
+                printf("cache miss %s, %llu hits, %llu misses, %llu evictions, %llu entries of %llu bytes\n", cache.key,
+                    (unsigned long long)cache.counters.hits, (unsigned long long)cache.counters.misses,
+                    (unsigned long long)cache.counters.evictions, (unsigned long long)cache.counters.entries,
+                    (unsigned long long)cache.counters.bytes);
+        }
+        if (imageStats) {
+            statsReport(&sink, argv[optind], imageStats);
+            statsClose(&sink);
+        }
+        poolDestroy(pool);
+        arenaTrim();
+        return 0;
+    }
+
+    // map the .bmp file straight into the output file, when that isn't 
+    // possible load it into memory instead. Anything but a half turn or a
+    // flip changes the size of the pixel array so it can't be done inside
+    // the mapping, neither can compressing the output. A crop only reads the
+    // scanlines and bytes of the rectangle from the file
+    bmpMap.base = NULL;
+    bmpMap.temp = NULL;
+    if (crop != NULL)
+        bmpData = loadBmpRegion(argv[optind], &bmpFH, &bmpIH, crop, imageStats);
+    else if (fmodf(rotation, 180) == 0 && !resizeWidth && !resizeHeight && compress == compressionRgb)
+        bmpData = mapBmp(argv[optind], outputName, &bmpFH, &bmpIH, &bmpMap, imageStats);
+    if (bmpData == NULL)
+        bmpData = loadBmp(argv[optind], &bmpFH, &bmpIH, imageStats);
+
+    // the operations have a kernel per pixel format, the masks and the 
+    // palette follow the info header
+    if (!parseFormat(
+            &bmpIH, bmpData - bmpFH.OffBits + sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t),
+            bmpFH.OffBits - sizeof(bmpFileHeader_t) - sizeof(bmpInfoHeader_t), &format)) {
+        fprintf(stderr, "unsupported bitmap format: %d bit, compression %d\n", bmpIH.BitCount, bmpIH.Compression);
+        exit(EXIT_FAILURE);
+    }
+
+    // the geometry is timed per operation, only when it was asked for
+    start   = statsNow();
+    bmpData = rotate(&bmpFH, &bmpIH, bmpData, rotation, resample, pool);
+    if (fmodf(rotation, 360) != 0)
+        statsStage(imageStats, "rotate", start, bmpIH.SizeImage);
+    if (flipAxis) {
+        start = statsNow();
+        flip(&bmpIH, bmpData, flipAxis);
+        statsStage(imageStats, "flip", start, bmpIH.SizeImage);
+    }
+    start   = statsNow();
+    bmpData = resize(&bmpFH, &bmpIH, bmpData, resizeWidth, resizeHeight, resample, pool);
+    if (resizeWidth || resizeHeight)
+        statsStage(imageStats, "resize", start, bmpIH.SizeImage);
 
 #ifdef _DEBUG
     if (verbose) {
         printf("System endianness == %s\n", (endian ? "little endian" : "big endian"));
         printf(".bmp file before editing:\n");
-        bmpDump(&bmpFH, &bmpIH, bmpData);
+        bmpDump(&bmpFH, &bmpIH);
     }
 #endif
 
-    // if the invert flag is set invert the image
-    if (invert) bmpData = reverseBmp(bmpData, bmpIH.SizeImage);
+    // run the whole chain of operations in one pass, scanline by scanline 
+    // spread over the threads, with a tiled pass for every convolution in
+    // between. The operations are timed together. Indexed images only get
+    // their palette edited, which the histogram then looks the pixels up in.
+    // The histogram is counted in the last pass, while it edits the rows.
+    // With a region of interest only its pixels are edited and counted, the
+    // palette is shared with the rest of the image so it stays as it is
+    if (roi != NULL && !rectInside(roi, &bmpIH)) {
+        fprintf(stderr, "roi %u,%u,%u,%u is outside the %dx%d image\n", roi->x, roi->y, roi->width, roi->height, bmpIH.Width, bmpIH.Height);
+        exit(EXIT_FAILURE);
+    }
+    if (roi != NULL && format.layout == layoutIndexed && chain.count) {
+        fprintf(stderr, "roi can't edit part of an indexed image, its colors are in the palette\n");
+        exit(EXIT_FAILURE);
+    }
+    start = statsNow();
+    extra = bmpData - bmpFH.OffBits + sizeof(bmpFileHeader_t) + sizeof(bmpInfoHeader_t);
+    processPalette(extra, &format, &chain);
+    if (histogram != NULL)
+        histogramInit(
+            histogram, (roi != NULL) ? roi->width : (uint32_t)bmpIH.Width,
+            (roi != NULL) ? roi->height : (bmpIH.Height < 0) ? -(uint32_t)bmpIH.Height : (uint32_t)bmpIH.Height,
+            (format.layout == layoutIndexed) ? extra + format.palette : NULL, format.colors);
+    if (!((roi != NULL) ? processRegion(bmpData, &bmpIH, &format, roi, &chain, histogram, pool)
+                        : processImage(bmpData, &bmpIH, &format, &chain, histogram, pool))) {
+        fprintf(stderr, "blur, boxblur, sharpen and edges need a 24 or 32 bit image, autolevels and equalize a 16, 24 or 32 bit one\n");
+        exit(EXIT_FAILURE);
+    }
+    if (chain.count || histogram != NULL)
+        statsStage(imageStats, "ops", start, bmpIH.SizeImage);
+
+    // RLE8 only holds 8 bit and RLE4 only 4 bit images
+    if (compress != compressionRgb) {
+        if (bmpIH.BitCount != ((compress == compressionRle8) ? 8 : 4)) {
+            fprintf(stderr, "can't compress a %d bit image as RLE%d\n", bmpIH.BitCount, (compress == compressionRle8) ? 8 : 4);
+            exit(EXIT_FAILURE);
+        }
+        bmpIH.Compression = compress;
+    }
 
-    // if there is a filter pressent apply it
-    if (filter) bmpData = applyFilter(bmpData, bmpIH.SizeImage, filter);
+    // a mapped image already lives in the outputfile
+    if (bmpMap.base == NULL)
+        saveBmp(outputName, &bmpFH, &bmpIH, bmpData, imageStats);
 
-    // if the outputfile hasn't been declared take on default name of "output.bmp"
-    if (outputfile != NULL)
-        saveBmp((char *)outputfile, &bmpFH, &bmpIH, bmpData);
-    else
-        saveBmp("output.bmp", &bmpFH, &bmpIH, bmpData);
+    // the histogram goes next to the image
+    if (histogram != NULL) {
+        start = statsNow();
+        if (!histogramSave(outputName, argv[optind], histogram)) {
+            fprintf(stderr, "error writing the histogram of \"%s\"\n", outputName);
+            exit(EXIT_FAILURE);
+        }
+        statsStage(imageStats, "histogram", start, 0);
+    }
 
 #ifdef _DEBUG
     if (verbose) {
         printf(".bmp file after editing:\n");
-        bmpDump(&bmpFH, &bmpIH, bmpData);
+        bmpDump(&bmpFH, &bmpIH);
     }
 #endif
 
-    free(bmpData);
+    if (bmpMap.base != NULL)
+        unmapBmp(&bmpMap, imageStats);
+    else
+        freeBmp(&bmpFH, bmpData);
+
+    if (cacheDir != NULL) {
+        start = statsNow();
+        if (!cacheStore(&cache, outputName))
+            fprintf(stderr, "error storing \"%s\" in the cache\n", outputName);
+        statsStage(imageStats, "cache_store", start, 0);
+        if (verbose)
+            printf("cache miss %s, %llu hits, %llu misses, %llu evictions, %llu entries of %llu bytes\n", cache.key,
+                (unsigned long long)cache.counters.hits, (unsigned long long)cache.counters.misses,
+                (unsigned long long)cache.counters.evictions, (unsigned long long)cache.counters.entries,
+                (unsigned long long)cache.counters.bytes);
+    }
+
+    if (imageStats) {
+        statsReport(&sink, argv[optind], imageStats);
+        statsClose(&sink);
+    }
+    poolDestroy(pool);
+    arenaTrim();
 
     return 0;
 }
@@ -0,0 +1,249 @@
+#include <stdlib.h>  // malloc, free, exit
+#include <string.h>  // memset
+
+#include "rle.h"
+
+// escape codes that follow a 0 count
+#define RLE_END_OF_LINE    0
+#define RLE_END_OF_BITMAP  1
+#define RLE_DELTA          2
+
+// pixel x of a row of 4 or 8 bit pixels
+static inline uint32_t
+rlePixel(const uint8_t *row, uint32_t x, uint32_t bits)
+{
+    if (bits == 8)
+        return row[x];
+    return (x & 1) ? (row[x >> 1] & 0x0F) : (row[x >> 1] >> 4);
+}
+
+// stores the next decoded pixel when it falls inside the current band
+static inline void
+rlePut(rleDecoder_t *dec, uint8_t *rows, uint32_t last, uint32_t rowSize, uint32_t value)
+{
+    if (dec->x < dec->width && dec->y >= dec->row && dec->y < last) {
+        uint8_t *row = rows + (size_t)(dec->y - dec->row) * rowSize;
+
+        if (dec->bits == 8)
+            row[dec->x] = (uint8_t)value;
+        else
+            row[dec->x >> 1] |= (uint8_t)((dec->x & 1) ? value : value << 4);
+    }
+    dec->x++;
+}
+
+void
+rleDecoderInit(rleDecoder_t *dec, FILE *fp, uint32_t width, uint32_t bits)
+{
+    *dec = (rleDecoder_t){ 0 };
+    dec->fp    = fp;
+    dec->width = width;
+    dec->bits  = bits;
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: rleDecodeRows                                               *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Decodes the next count rows. The stream is a list of byte pairs: a count  *
+ *  and a pixel (RLE8) or two alternating pixels (RLE4) to repeat, or a 0     *
+ *  followed by an escape: end of line, end of bitmap, a delta that moves the *
+ *  position right and down, or 3 - 255 literal pixels padded to an even      *
+ *  number of bytes. Only the rows of the band are written, the position is   *
+ *  kept for the next band. Pixels past the width are dropped                 *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  rleDecoder_t *dec                                                         *
+ *  uint8_t *rows                                                             *
+ *  uint32_t count                                                            *
+ *  uint32_t rowSize                                                          *
+ *                                                                            *
+ * Return:                                                                    *
+ *  false on corrupt or truncated data                                        *
+ ******************************************************************************
+!*/
+bool
+rleDecodeRows(rleDecoder_t *dec, uint8_t *rows, uint32_t count, uint32_t rowSize)
+{
+    uint32_t last = dec->row + count;  // first row past the band
+    uint8_t literal[128];              // literal pixels of one escape, packed
+    int length, value;
+
+    memset(rows, 0, (size_t)count * rowSize);
+
+    while (!dec->end && dec->y < last) {
+        length = getc_unlocked(dec->fp);
+        value  = getc_unlocked(dec->fp);
+        if (value == EOF)
+            return false;
+
+        // a run, RLE4 alternates the high and the low nibble
+        if (length > 0) {
+            for (int pixel = 0; pixel < length; pixel++) {
+                rlePut(
+                    dec, rows, last, rowSize,
+                    (uint32_t)((dec->bits == 8) ? value : (pixel & 1) ? (value & 0x0F) : (value >> 4)));
+            }
+            continue;
+        }
+
+        switch (value) {
+        case RLE_END_OF_LINE:
+            dec->x = 0;
+            dec->y++;
+            break;
+
+        case RLE_END_OF_BITMAP:
+            dec->end = true;
+            break;
+
+        case RLE_DELTA:
+            length = getc_unlocked(dec->fp);
+            value  = getc_unlocked(dec->fp);
+            if (value == EOF)
+                return false;
+            dec->x += length;
+            dec->y += value;
+            break;
+
+        default: {
+            // value literal pixels, the escape is padded to a 16 bit boundary
+            uint32_t bytes = (dec->bits == 8) ? (uint32_t)value : ((uint32_t)value + 1) / 2;
+
+            if (fread(literal, 1, bytes + (bytes & 1), dec->fp) != bytes + (bytes & 1))
+                return false;
+            for (int pixel = 0; pixel < value; pixel++)
+                rlePut(dec, rows, last, rowSize, rlePixel(literal, pixel, dec->bits));
+            break;
+        }
+        }
+    }
+
+    dec->row = last;
+    return true;
+}
+
+// length of the run of equal pixels at x, at most 255
+static inline uint32_t
+rleRun(const uint8_t *row, uint32_t x, uint32_t width, uint32_t bits)
+{
+    uint32_t first = rlePixel(row, x, bits);
+    uint32_t length = 1;
+
+    while (x + length < width && length < 255 && rlePixel(row, x + length, bits) == first)
+        length++;
+
+    return length;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: rleEncodeRows                                               *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Compresses count rows one at the time into a buffer of the worst case     *
+ *  size and writes every row with one fwrite. Runs of 2 or more equal pixels *
+ *  become a count and a pixel, everything in between is gathered in literal  *
+ *  escapes until the next run of 3 or more. Literals shorter than 3 pixels   *
+ *  can't be escaped and are written as runs of 1                             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  FILE *fp                                                                  *
+ *  const uint8_t *rows                                                       *
+ *  uint32_t count                                                            *
+ *  uint32_t rowSize                                                          *
+ *  uint32_t width                                                            *
+ *  uint32_t bits                                                             *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the number of bytes written, 0 when writing failed                        *
+ ******************************************************************************
+!*/
+uint64_t
+rleEncodeRows(
+    FILE *fp, const uint8_t *rows, uint32_t count, uint32_t rowSize,
+    uint32_t width, uint32_t bits)
+{
+    uint8_t *out = malloc((size_t)width * 2 + 4);  // runs of 1 are the worst case
+    uint64_t written = 0;
+
+    if (out == NULL) {
+        fprintf(stderr, "rle memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t rowIdx = 0; rowIdx < count; rowIdx++) {
+        const uint8_t *row = rows + (size_t)rowIdx * rowSize;
+        size_t size = 0;
+        uint32_t x = 0;
+
+        while (x < width) {
+            uint32_t length = rleRun(row, x, width, bits);
+            uint32_t literal;
+
+            if (length >= 2) {
+                uint32_t pixel = rlePixel(row, x, bits);
+
+                out[size++] = (uint8_t)length;
+                out[size++] = (uint8_t)((bits == 8) ? pixel : (pixel << 4) | pixel);
+                x += length;
+                continue;
+            }
+
+            // gather pixels up to the next run worth its own pair
+            for (literal = 1; x + literal < width && literal < 255; literal++)
+                if (x + literal + 2 < width && rleRun(row, x + literal, width, bits) >= 3)
+                    break;
+
+            if (literal < 3) {
+                for (uint32_t pixel = 0; pixel < literal; pixel++) {
+                    uint32_t value = rlePixel(row, x + pixel, bits);
+
+                    out[size++] = 1;
+                    out[size++] = (uint8_t)((bits == 8) ? value : value << 4);
+                }
+            } else {
+                size_t start;
+
+                out[size++] = 0;
+                out[size++] = (uint8_t)literal;
+                start = size;
+                for (uint32_t pixel = 0; pixel < literal; pixel++) {
+                    uint32_t value = rlePixel(row, x + pixel, bits);
+
+                    if (bits == 8)
+                        out[size++] = (uint8_t)value;
+                    else if (pixel & 1)
+                        out[size - 1] |= (uint8_t)value;
+                    else
+                        out[size++] = (uint8_t)(value << 4);
+                }
+                if ((size - start) & 1)
+                    out[size++] = 0;
+            }
+            x += literal;
+        }
+
+        out[size++] = 0;
+        out[size++] = RLE_END_OF_LINE;
+
+        if (fwrite(out, 1, size, fp) != size) {
+            free(out);
+            return 0;
+        }
+        written += size;
+    }
+
+    free(out);
+    return written;
+}
+
+uint64_t
+rleEncodeEnd(FILE *fp)
+{
+    static const uint8_t end[2] = { 0, RLE_END_OF_BITMAP };
+
+    return fwrite(end, 1, sizeof(end), fp);
+}
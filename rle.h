@@ -0,0 +1,36 @@
+#ifndef _RLE_H_
+#define _RLE_H_
+
+#include <stdio.h>   // FILE
+#include <stdint.h>  // int typedefs
+#include <stdbool.h> // true, false
+
+// structure for holding the state of an RLE8 or RLE4 decoder. The rows come
+// out in the order they are stored in the file, a band at the time, so a
+// delta that jumps past the current band is picked up by the next one
+typedef struct rleDecoder_s {
+    FILE *fp;          // the compressed pixels
+    uint32_t width;    // pixels per row
+    uint32_t bits;     // bits per pixel, 8 for RLE8 and 4 for RLE4
+    uint32_t row;      // first row of the next band
+    uint32_t x, y;     // position of the next pixel
+    bool end;          // the end of bitmap has been read
+} rleDecoder_t;
+
+// starts decoding the compressed pixels at the current position of fp
+void rleDecoderInit(rleDecoder_t *dec, FILE *fp, uint32_t width, uint32_t bits);
+
+// decodes the next count rows into rows, rowSize bytes apart. Pixels the
+// stream skips or never reaches are 0. false on corrupt or truncated data
+bool rleDecodeRows(rleDecoder_t *dec, uint8_t *rows, uint32_t count, uint32_t rowSize);
+
+// compresses count rows, every row ends with an end of line. Returns the
+// number of bytes written, 0 when writing failed
+uint64_t rleEncodeRows(
+    FILE *fp, const uint8_t *rows, uint32_t count, uint32_t rowSize,
+    uint32_t width, uint32_t bits);
+
+// writes the end of bitmap marker, returns the number of bytes written
+uint64_t rleEncodeEnd(FILE *fp);
+
+#endif//_RLE_H_
@@ -0,0 +1,789 @@
+#define _GNU_SOURCE      // fopencookie
+#include <errno.h>       // errno, EINTR
+#include <fcntl.h>       // fcntl, O_NONBLOCK
+#include <poll.h>        // poll
+#include <pthread.h>     // pthread_create, pthread_join, mutexes and conditions
+#include <signal.h>      // sigaction, pthread_sigmask, SIGPIPE
+#include <sys/socket.h>  // socket, bind, listen, accept, shutdown
+#include <sys/un.h>      // sockaddr_un
+
+#include "server.h"
+
+// an open connection, its streams keep what was read ahead between jobs
+typedef struct serverConnection_s {
+    int fd;
+    FILE *in;
+    FILE *out;                 // on a dup of fd
+} serverConnection_t;
+
+// connections with a job to answer, waiting for a worker. It holds as many
+// as can be open, so pushing never waits. Once closed and empty the workers
+// stop
+typedef struct serverQueue_s {
+    serverConnection_t *conn[SERVER_CONNECTIONS];
+    uint32_t head, count;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} serverQueue_t;
+
+// growable buffer behind a FILE for the RLE results sent back. Unlike with
+// open_memstream the bytes past the position survive writeBmp going back
+// to fill in the sizes
+typedef struct serverBuffer_s {
+    char *data;
+    size_t length;             // bytes written
+    size_t capacity;           // allocated size of data
+    size_t position;
+} serverBuffer_t;
+
+struct server_s;
+
+// a worker thread and the buffers it keeps from job to job
+typedef struct serverWorker_s {
+    struct server_s *server;
+    pthread_t thread;
+    batchSlot_t slot;          // buffers of the last job, they only grow
+    serverBuffer_t encoded;    // the last RLE result sent back, only grows too
+    int fd;                    // connection being served, -1 when idle
+} serverWorker_t;
+
+// everything the workers share
+typedef struct server_s {
+    const opChain_t *chain;    // chain of the jobs without ops
+    enum bmpCompression_e compress; // compression of the jobs without compress
+    int listenFd;              // the listening socket
+    serverQueue_t queue;       // connections waiting for a worker
+    serverWorker_t *workers;
+    uint32_t count;            // number of workers
+    int wake[2];               // a byte in this pipe wakes the accepting thread
+
+    pthread_mutex_t lock;      // guards everything below and the fd of the workers
+    bool stopping;             // set once the server shuts down
+    serverConnection_t *idle[SERVER_CONNECTIONS]; // handed back by the workers,
+    uint32_t idleCount;        // the accepting thread waits for their next job
+    uint32_t open;             // connections open
+    statsSink_t *sink;         // where the stats of every job go, NULL for none
+    double *latency;           // seconds of every job, to take the percentiles
+    uint32_t jobs;             // number of jobs answered
+    uint32_t capacity;         // allocated length of latency
+    uint32_t failures;         // number of jobs that failed
+} server_t;
+
+// one job as sent by the client, the paths are kept in the slot
+typedef struct serverJob_s {
+    opChain_t ops;             // the operations, when the job names them
+    bool hasOps;
+    enum bmpCompression_e compress;
+    bool histogram;            // write the histogram next to the output
+    bool inlined;              // the image came with the job
+    bool quit;                 // stop the server once the job is answered
+    double start;              // when the first line of the job arrived
+} serverJob_t;
+
+// set by SIGINT and SIGTERM
+static volatile sig_atomic_t stopSignal = 0;
+
+static void
+stopHandler(int sig)
+{
+    (void)sig;
+    stopSignal = 1;
+}
+
+static ssize_t
+bufferWrite(void *cookie, const char *data, size_t size)
+{
+    serverBuffer_t *buffer = cookie;
+
+    if (buffer->position + size > buffer->capacity) {
+        size_t capacity = (buffer->position + size) * 2;
+        char *grown     = realloc(buffer->data, capacity);
+
+        if (grown == NULL) return -1;
+        buffer->data     = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->position, data, size);
+    buffer->position += size;
+    if (buffer->position > buffer->length) buffer->length = buffer->position;
+    return size;
+}
+
+static int
+bufferSeek(void *cookie, off64_t *offset, int whence)
+{
+    serverBuffer_t *buffer = cookie;
+    off64_t base = (whence == SEEK_CUR) ? (off64_t)buffer->position :
+                   (whence == SEEK_END) ? (off64_t)buffer->length : 0;
+
+    if (base + *offset < 0 || base + *offset > (off64_t)buffer->length) return -1;
+    buffer->position = base + *offset;
+    *offset          = buffer->position;
+    return 0;
+}
+
+// opens the buffer for writing from the start, what it held is dropped
+static FILE *
+bufferOpen(serverBuffer_t *buffer)
+{
+    cookie_io_functions_t io = { .write = bufferWrite, .seek = bufferSeek };
+
+    buffer->length   = 0;
+    buffer->position = 0;
+    return fopencookie(buffer, "w", io);
+}
+
+static void
+queueInit(serverQueue_t *queue)
+{
+    queue->head   = 0;
+    queue->count  = 0;
+    queue->closed = false;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+}
+
+static void
+queueDestroy(serverQueue_t *queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+}
+
+static void
+queuePush(serverQueue_t *queue, serverConnection_t *conn)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->conn[(queue->head + queue->count) % SERVER_CONNECTIONS] = conn;
+    queue->count++;
+    pthread_cond_signal(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// the workers drain what is queued and then stop
+static void
+queueClose(serverQueue_t *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static serverConnection_t *
+queuePop(serverQueue_t *queue)
+{
+    serverConnection_t *conn = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->closed)
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    if (queue->count > 0) {
+        conn = queue->conn[queue->head];
+        queue->head = (queue->head + 1) % SERVER_CONNECTIONS;
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return conn;
+}
+
+// a full pipe fails the write, but then the accepting thread wakes anyway
+static void
+serverWake(server_t *server)
+{
+    char byte = 0;
+    ssize_t written = write(server->wake[1], &byte, 1);
+
+    (void)written;
+}
+
+// opens the streams of an accepted connection, NULL when that fails
+static serverConnection_t *
+connectionOpen(int fd)
+{
+    serverConnection_t *conn = malloc(sizeof(serverConnection_t));
+    int outFd                = dup(fd);
+
+    if (conn != NULL) {
+        conn->fd  = fd;
+        conn->in  = fdopen(fd, "rb");
+        conn->out = (outFd >= 0) ? fdopen(outFd, "wb") : NULL;
+    }
+    if (conn == NULL || conn->in == NULL || conn->out == NULL) {
+        if (conn != NULL && conn->in != NULL) fclose(conn->in); else close(fd);
+        if (conn != NULL && conn->out != NULL) fclose(conn->out); else if (outFd >= 0) close(outFd);
+        free(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+static void
+connectionClose(server_t *server, serverConnection_t *conn)
+{
+    fclose(conn->in);
+    fclose(conn->out);
+    free(conn);
+
+    pthread_mutex_lock(&server->lock);
+    server->open--;
+    pthread_mutex_unlock(&server->lock);
+}
+
+// whether the client has sent more, in the stream's buffer or on the socket,
+// without waiting for it. At the end of the stream it is true as well, so
+// readJob sees the end
+static bool
+connectionPending(serverConnection_t *conn)
+{
+    int flags = fcntl(conn->fd, F_GETFL);
+    int c;
+
+    if (flags < 0 || fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK) != 0)
+        return true;
+    c = getc(conn->in);
+    fcntl(conn->fd, F_SETFL, flags);
+
+    if (c != EOF) {
+        ungetc(c, conn->in);
+        return true;
+    }
+    if (feof(conn->in))
+        return true;
+    clearerr(conn->in);
+    return false;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: readJob                                                     *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Reads the lines of one job, a key and a value each. A blank line ends the *
+ *  job, so does "data N" which is followed by the N bytes of a .bmp file.    *
+ *  Those go straight into the slot's buffer, placed like readSlot places a   *
+ *  file. The paths are kept in the slot, the rest in job                     *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  FILE *fp                                                                  *
+ *  server_t *server                                                          *
+ *  batchSlot_t *slot                                                         *
+ *  serverJob_t *job                                                          *
+ *  const char **error                                                        *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true when a job was read, false at the end of the connection or, with     *
+ *  error set, when the job is malformed                                      *
+ ******************************************************************************
+!*/
+static bool
+readJob(FILE *fp, server_t *server, batchSlot_t *slot, serverJob_t *job, const char **error)
+{
+    char line[SERVER_LINE];
+    bool started = false;      // a line of this job has been read
+
+    *error = NULL;
+    *job   = (serverJob_t){ .compress = server->compress };
+    free(slot->inName);
+    free(slot->outName);
+    slot->inName  = NULL;
+    slot->outName = NULL;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        size_t length = strlen(line);
+        char *value;
+
+        if (line[length - 1] != '\n' && !feof(fp)) {
+            *error = "line too long";
+            return false;
+        }
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = '\0';
+
+        // blank lines between jobs are skipped, the first one after a key ends the job
+        if (length == 0) {
+            if (started) return true;
+            continue;
+        }
+        if (!started) job->start = statsNow();
+        started = true;
+
+        value = strchr(line, ' ');
+        if (value != NULL) *value++ = '\0';
+
+        if (strcmp(line, "in") == 0 && value != NULL) {
+            free(slot->inName);
+            slot->inName = strdup(value);
+        } else if (strcmp(line, "out") == 0 && value != NULL) {
+            free(slot->outName);
+            slot->outName = strdup(value);
+        } else if (strcmp(line, "ops") == 0 && value != NULL) {
+            job->ops = (opChain_t){ 0 };
+            if (!parseOps(value, &job->ops) || !compileOps(&job->ops)) {
+                *error = "invalid operation list";
+                return false;
+            }
+            job->hasOps = true;
+        } else if (strcmp(line, "compress") == 0 && value != NULL) {
+            if (!parseCompress(value, &job->compress)) {
+                *error = "unknown compression";
+                return false;
+            }
+        } else if (strcmp(line, "histogram") == 0 && value == NULL) {
+            job->histogram = true;
+        } else if (strcmp(line, "quit") == 0 && value == NULL) {
+            job->quit = true;
+        } else if (strcmp(line, "data") == 0 && value != NULL) {
+            char *end;
+            unsigned long long size = strtoull(value, &end, 10);
+            bmpFileHeader_t peek;
+            size_t done = 0;
+
+            if (*end != '\0' || size < sizeof(bmpFileHeader_t) || size > SIZE_MAX / 2 ||
+                fread(&peek, sizeof(bmpFileHeader_t), 1, fp) != 1) {
+                *error = "invalid data size";
+                return false;
+            }
+
+            // the pixels land on an ARENA_ALIGN boundary, like a file read by readSlot
+            memcpy(reserveSlot(slot, &peek, size), &peek, sizeof(bmpFileHeader_t));
+            done = sizeof(bmpFileHeader_t);
+            done += fread(slot->file + done, 1, size - done, fp);
+            if (done != size) {
+                *error = "short data";
+                return false;
+            }
+
+            free(slot->inName);
+            slot->inName  = strdup("inline");
+            slot->length  = size;
+            job->inlined  = true;
+            return true;
+        } else {
+            *error = "unknown key";
+            return false;
+        }
+    }
+
+    // a job can also end with the connection
+    if (started && ferror(fp) == 0)
+        return true;
+    return false;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: runJob                                                      *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Reads, filters and writes the image of one job with the worker's slot.    *
+ *  Without an output path the result is sent back on the connection, RLE     *
+ *  compressed when asked for and the bit count allows it. The answer is      *
+ *  "ok seconds bytes" followed by those bytes, or "error message"            *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  server_t *server                                                          *
+ *  serverWorker_t *worker                                                    *
+ *  serverJob_t *job                                                          *
+ *  FILE *out                                                                 *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true when the job succeeded                                               *
+ ******************************************************************************
+!*/
+static bool
+runJob(server_t *server, serverWorker_t *worker, serverJob_t *job, FILE *out)
+{
+    batchSlot_t *slot      = &worker->slot;
+    const opChain_t *chain = job->hasOps ? &job->ops : server->chain;
+    const char *error      = NULL;
+    uint8_t *result        = NULL;  // the bytes sent back
+    size_t length          = 0;
+    double start, seconds;
+
+    if (job->inlined) {
+        slot->stats = (bmpStats_t){ 0 };
+        if (!parseSlot(slot)) error = "can't read the image";
+    } else if (slot->inName == NULL) {
+        error = "the job has neither in nor data";
+    } else if (!readSlot(slot)) {
+        error = "can't read the image";
+    }
+
+    if (error == NULL && job->histogram && slot->outName == NULL)
+        error = "histogram needs out";
+    if (error == NULL && !filterSlot(slot, chain, job->histogram, NULL))
+        error = "the operations don't support this image";
+
+    if (error == NULL && slot->outName != NULL) {
+        if (!writeSlot(slot, job->compress))
+            error = "can't write the result";
+        else if (job->histogram && !histogramSave(slot->outName, slot->inName, &slot->histogram))
+            error = "can't write the histogram";
+    } else if (error == NULL) {
+        start = statsNow();
+        if (job->compress != compressionRgb &&
+            slot->bmpIH.BitCount == ((job->compress == compressionRle8) ? 8 : 4)) {
+            bmpInfoHeader_t bmpIH = slot->bmpIH;
+            FILE *fp = bufferOpen(&worker->encoded);
+
+            bmpIH.Compression = job->compress;
+            length = (fp != NULL) ? writeBmp(fp, &slot->bmpFH, &bmpIH, slot->file + slot->bmpFH.OffBits) : 0;
+            if ((fp != NULL && fclose(fp) != 0) || length == 0)
+                error = "can't encode the result";
+            result = (uint8_t *)worker->encoded.data;
+            length = worker->encoded.length;
+            if (error == NULL)
+                statsStage(&slot->stats, "encode", start, length);
+        } else {
+            result = slot->file;
+            length = slot->length;
+        }
+    }
+
+    // the latency sent with the answer runs up to here, the transfer of the
+    // result is timed as the send stage
+    start   = statsNow();
+    seconds = start - job->start;
+    if (error != NULL) {
+        fprintf(out, "error %s\n", error);
+    } else {
+        fprintf(out, "ok %.6f %zu\n", seconds, (result != NULL) ? length : (size_t)0);
+        if (result != NULL) fwrite(result, 1, length, out);
+    }
+    fflush(out);
+    if (error == NULL && result != NULL)
+        statsStage(&slot->stats, "send", start, length);
+
+    pthread_mutex_lock(&server->lock);
+    if (server->jobs == server->capacity) {
+        server->capacity = server->capacity ? server->capacity * 2 : 1024;
+        server->latency  = realloc(server->latency, server->capacity * sizeof(double));
+        if (server->latency == NULL) {
+            fprintf(stderr, "server memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    server->latency[server->jobs++] = seconds;
+    if (error != NULL)
+        server->failures++;
+    else
+        statsReport(server->sink, slot->inName, &slot->stats);
+    pthread_mutex_unlock(&server->lock);
+
+    return error == NULL;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: serveJobs                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Answers the jobs a connection has sent so far, in order. Once the client  *
+ *  has sent nothing more the connection goes back to the accepting thread,   *
+ *  so a client that stays connected between jobs doesn't keep the worker.    *
+ *  A malformed job is answered with an error and closes the connection,      *
+ *  since the rest of the stream can't be trusted. A job with quit stops the  *
+ *  server once it is answered                                                *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  serverWorker_t *worker                                                    *
+ *  serverConnection_t *conn                                                  *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true when the connection stays open for more jobs                         *
+ ******************************************************************************
+!*/
+static bool
+serveJobs(serverWorker_t *worker, serverConnection_t *conn)
+{
+    server_t *server = worker->server;
+    const char *error;
+    serverJob_t job;
+
+    while (readJob(conn->in, server, &worker->slot, &job, &error)) {
+        // a job can be nothing but quit
+        if (job.quit && worker->slot.inName == NULL) {
+            fprintf(conn->out, "ok 0.000000 0\n");
+            fflush(conn->out);
+        } else {
+            runJob(server, worker, &job, conn->out);
+        }
+        if (job.quit) {
+            pthread_mutex_lock(&server->lock);
+            server->stopping = true;
+            pthread_mutex_unlock(&server->lock);
+            serverWake(server);
+            return false;
+        }
+        if (!connectionPending(conn))
+            return true;
+    }
+    if (error != NULL) {
+        fprintf(conn->out, "error %s\n", error);
+        pthread_mutex_lock(&server->lock);
+        server->failures++;
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    return false;
+}
+
+static void *
+serveWorker(void *arg)
+{
+    serverWorker_t *worker = arg;
+    server_t *server       = worker->server;
+    serverConnection_t *conn;
+
+    while ((conn = queuePop(&server->queue)) != NULL) {
+        bool stopping, keep;
+
+        pthread_mutex_lock(&server->lock);
+        stopping = server->stopping;
+        if (!stopping) worker->fd = conn->fd;
+        pthread_mutex_unlock(&server->lock);
+
+        // connections still queued at shutdown are closed unanswered
+        keep = !stopping && serveJobs(worker, conn);
+
+        // an open connection waits for its next job in the accepting thread
+        pthread_mutex_lock(&server->lock);
+        worker->fd = -1;
+        keep = keep && !server->stopping;
+        if (keep) server->idle[server->idleCount++] = conn;
+        pthread_mutex_unlock(&server->lock);
+
+        if (keep)
+            serverWake(server);
+        else
+            connectionClose(server, conn);
+    }
+
+    return NULL;
+}
+
+static int
+compareSeconds(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: serveRun                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Binds the socket, replacing a stale one left by an earlier server, and    *
+ *  polls it and the idle connections. A connection with a job to answer is   *
+ *  handed to a pool of worker threads and comes back once it has none left.  *
+ *  Every worker keeps a slot of its own, so once the slots have grown to the *
+ *  largest image no buffer is allocated or mapped per job. The operations of *
+ *  a job run on its worker alone, the jobs themselves are what runs in       *
+ *  parallel. On shutdown the workers finish the job they are on, idle        *
+ *  connections are closed. Stats are reported under a lock since every       *
+ *  worker uses the sink                                                      *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  const char *path                                                          *
+ *  const opChain_t *chain                                                    *
+ *  enum bmpCompression_e compress                                            *
+ *  uint32_t workers                                                          *
+ *  bool verbose                                                              *
+ *  statsSink_t *sink                                                         *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the number of jobs that failed                                            *
+ ******************************************************************************
+!*/
+uint32_t
+serveRun(
+    const char *path, const opChain_t *chain, enum bmpCompression_e compress,
+    uint32_t workers, bool verbose, statsSink_t *sink)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    server_t server         = { 0 };
+    struct sigaction action = { 0 };
+    sigset_t block, old;
+    struct stat st;
+    serverConnection_t *watched[SERVER_CONNECTIONS]; // idle, polled here
+    struct pollfd polled[SERVER_CONNECTIONS + 2];
+    uint32_t watchedCount = 0;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path \"%s\" is too long\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+
+    // a socket left behind by a server that didn't shut down cleanly
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    server.listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.listenFd < 0 ||
+        bind(server.listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server.listenFd, SERVER_BACKLOG) != 0) {
+        fprintf(stderr, "Failed listening on \"%s\"\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (workers == 0) workers = 1;
+    server.chain    = chain;
+    server.compress = compress;
+    server.sink     = sink;
+    server.count    = workers;
+    server.workers  = calloc(workers, sizeof(serverWorker_t));
+    if (server.workers == NULL) {
+        fprintf(stderr, "server memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pipe(server.wake) != 0 ||
+        fcntl(server.wake[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(server.wake[1], F_SETFL, O_NONBLOCK) != 0) {
+        fprintf(stderr, "Failed creating the server's pipe\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&server.lock, NULL);
+    queueInit(&server.queue);
+
+    // a client that hangs up early must not kill the server, and only the
+    // accepting thread takes SIGINT and SIGTERM so they interrupt poll
+    signal(SIGPIPE, SIG_IGN);
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    for (uint32_t id = 0; id < workers; id++) {
+        server.workers[id].server = &server;
+        server.workers[id].fd     = -1;
+        if (pthread_create(&server.workers[id].thread, NULL, serveWorker, &server.workers[id]) != 0) {
+            fprintf(stderr, "Failed creating server threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    action.sa_handler = stopHandler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (verbose)
+        printf("listening on %s with %u workers\n", path, workers);
+    fflush(stdout);
+
+    // the listening socket, the pipe the workers wake this thread with and the
+    // idle connections are polled. A connection that has sent a job goes to
+    // the workers and is polled again once they hand it back
+    while (!stopSignal) {
+        bool stopping;
+        char drain[64];
+
+        polled[0] = (struct pollfd){ .fd = server.listenFd, .events = POLLIN };
+        polled[1] = (struct pollfd){ .fd = server.wake[0], .events = POLLIN };
+        for (uint32_t connIdx = 0; connIdx < watchedCount; connIdx++)
+            polled[connIdx + 2] = (struct pollfd){ .fd = watched[connIdx]->fd, .events = POLLIN };
+
+        if (poll(polled, watchedCount + 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // from the back, so moving the last one into a hole keeps the order
+        // of the ones still to look at
+        for (uint32_t connIdx = watchedCount; connIdx-- > 0;) {
+            if (polled[connIdx + 2].revents == 0) continue;
+            queuePush(&server.queue, watched[connIdx]);
+            watched[connIdx] = watched[--watchedCount];
+        }
+
+        if (polled[0].revents & POLLIN) {
+            fd = accept(server.listenFd, NULL, NULL);
+            if (fd >= 0) {
+                serverConnection_t *conn;
+                bool full;
+
+                pthread_mutex_lock(&server.lock);
+                full = server.open == SERVER_CONNECTIONS;
+                pthread_mutex_unlock(&server.lock);
+
+                // a client beyond the limit is told so, the others wait for
+                // their first job like any idle connection
+                if (full) {
+                    ssize_t written = write(fd, "error too many connections\n", 27);
+
+                    (void)written;
+                    close(fd);
+                } else if ((conn = connectionOpen(fd)) == NULL) {
+                    fprintf(stderr, "Failed opening connection\n");
+                } else {
+                    pthread_mutex_lock(&server.lock);
+                    server.open++;
+                    pthread_mutex_unlock(&server.lock);
+                    watched[watchedCount++] = conn;
+                }
+            }
+        }
+
+        while (read(server.wake[0], drain, sizeof(drain)) > 0)
+            continue;
+        pthread_mutex_lock(&server.lock);
+        stopping = server.stopping;
+        for (uint32_t connIdx = 0; connIdx < server.idleCount; connIdx++)
+            watched[watchedCount++] = server.idle[connIdx];
+        server.idleCount = 0;
+        pthread_mutex_unlock(&server.lock);
+        if (stopping) break;  // a quit job was answered
+    }
+
+    // let the jobs in flight finish, a connection waiting for its next job
+    // is closed
+    pthread_mutex_lock(&server.lock);
+    server.stopping = true;
+    for (uint32_t id = 0; id < workers; id++)
+        if (server.workers[id].fd >= 0)
+            shutdown(server.workers[id].fd, SHUT_RD);
+    pthread_mutex_unlock(&server.lock);
+
+    queueClose(&server.queue);
+    for (uint32_t id = 0; id < workers; id++) {
+        pthread_join(server.workers[id].thread, NULL);
+        freeSlot(&server.workers[id].slot);
+        free(server.workers[id].encoded.data);
+    }
+    for (uint32_t connIdx = 0; connIdx < server.idleCount; connIdx++)
+        watched[watchedCount++] = server.idle[connIdx];
+    for (uint32_t connIdx = 0; connIdx < watchedCount; connIdx++)
+        connectionClose(&server, watched[connIdx]);
+
+    close(server.listenFd);
+    close(server.wake[0]);
+    close(server.wake[1]);
+    unlink(path);
+
+    if (verbose) {
+        double p50 = 0, p99 = 0, max = 0;
+
+        if (server.jobs > 0) {
+            qsort(server.latency, server.jobs, sizeof(double), compareSeconds);
+            p50 = server.latency[(server.jobs - 1) * 50 / 100];
+            p99 = server.latency[(server.jobs - 1) * 99 / 100];
+            max = server.latency[server.jobs - 1];
+        }
+        printf("%u jobs, %u failed, latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            server.jobs, server.failures, p50 * 1e3, p99 * 1e3, max * 1e3);
+    }
+
+    free(server.latency);
+    free(server.workers);
+    queueDestroy(&server.queue);
+    pthread_mutex_destroy(&server.lock);
+
+    return server.failures;
+}
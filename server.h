@@ -0,0 +1,25 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include "batch.h"
+
+// connections the kernel holds until they are accepted
+#define SERVER_BACKLOG  64
+
+// connections open at once, more are answered with an error and closed
+#define SERVER_CONNECTIONS  512
+
+// longest line of a job, paths and operation lists included
+#define SERVER_LINE  4096
+
+// listens on the Unix domain socket path and runs the jobs sent to it on
+// workers threads, each with its own slot so the buffers stay warm between
+// jobs. A worker takes a connection only while it has jobs to answer. chain and compress are used by jobs that don't name their own. Runs
+// until a job says quit or the process gets SIGINT or SIGTERM, returns the
+// number of jobs that failed. sink gets the stats of every job unless it is
+// NULL, with verbose the job count and latencies are printed at the end
+uint32_t serveRun(
+    const char *path, const opChain_t *chain, enum bmpCompression_e compress,
+    uint32_t workers, bool verbose, statsSink_t *sink);
+
+#endif//_SERVER_H_
@@ -0,0 +1,617 @@
+#include "helper.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h> // SSE2, SSSE3 and AVX2 intrinsics
+#define SIMD_X86
+#endif
+
+static void invertScalar(uint8_t *bmpimg, uint32_t size);
+static void chainScalar(uint8_t *bmpimg, uint32_t size, const opChain_t *chain);
+static void chain32Scalar(uint8_t *bmpimg, uint32_t size, const opChain_t *chain);
+static void chain555Scalar(uint8_t *bmpimg, uint32_t size, const opChain_t *chain);
+static void chain565Scalar(uint8_t *bmpimg, uint32_t size, const opChain_t *chain);
+
+pixelKernels_t kernels = {
+    "scalar", invertScalar, chainScalar, chain32Scalar, chain555Scalar, chain565Scalar
+};
+
+// the pixel formats with a kernel of their own
+static const pixelFormat_t formatBgrx32 = { layoutBgrx32, 4, { 0, 8, 16 }, { 8, 8, 8 }, 0, 0 };
+static const pixelFormat_t format555    = { layoutRgb555, 2, { 0, 5, 10 }, { 5, 5, 5 }, 0, 0 };
+static const pixelFormat_t format565    = { layoutRgb565, 2, { 0, 5, 11 }, { 5, 6, 5 }, 0, 0 };
+
+/*!
+ ******************************************************************************
+ * Scalar kernels                                                             *
+ ******************************************************************************
+ * The reference implementations in helper.c, also used for the tail bytes    *
+ * the vector kernels can't fill a whole register with                        *
+ ******************************************************************************
+!*/
+static void
+invertScalar(uint8_t *bmpimg, uint32_t size)
+{
+    reverseBmpScalar(bmpimg, size);
+}
+
+static void
+chainScalar(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    applyOpsScalar(bmpimg, size, chain);
+}
+
+static void
+chain32Scalar(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    applyOpsPackedScalar(bmpimg, size, &formatBgrx32, chain);
+}
+
+static void
+chain555Scalar(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    applyOpsPackedScalar(bmpimg, size, &format555, chain);
+}
+
+static void
+chain565Scalar(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    applyOpsPackedScalar(bmpimg, size, &format565, chain);
+}
+
+#ifdef SIMD_X86
+
+/*!
+ ******************************************************************************
+ * Shuffle tables                                                             *
+ ******************************************************************************
+ * 16 BGR pixels span 3 registers. deinterleave[plane][reg] gathers the bytes *
+ * of one color plane out of one register, interleave[reg][plane] scatters a  *
+ * color plane back, 0x80 zeroes the byte                                     *
+ ******************************************************************************
+!*/
+static const uint8_t deinterleave[3][3][16] __attribute__((aligned(16))) = {
+    { // blue
+        { 0x00, 0x03, 0x06, 0x09, 0x0C, 0x0F, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+        { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x02, 0x05, 0x08, 0x0B, 0x0E, 0x80, 0x80, 0x80, 0x80, 0x80 },
+        { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01, 0x04, 0x07, 0x0A, 0x0D },
+    },
+    { // green
+        { 0x01, 0x04, 0x07, 0x0A, 0x0D, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+        { 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x03, 0x06, 0x09, 0x0C, 0x0F, 0x80, 0x80, 0x80, 0x80, 0x80 },
+        { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x02, 0x05, 0x08, 0x0B, 0x0E },
+    },
+    { // red
+        { 0x02, 0x05, 0x08, 0x0B, 0x0E, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+        { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01, 0x04, 0x07, 0x0A, 0x0D, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+        { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x03, 0x06, 0x09, 0x0C, 0x0F },
+    },
+};
+
+static const uint8_t interleave[3][3][16] __attribute__((aligned(16))) = {
+    {
+        { 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80, 0x05 },
+        { 0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80 },
+        { 0x80, 0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80 },
+    },
+    {
+        { 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0A, 0x80 },
+        { 0x05, 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0A },
+        { 0x80, 0x05, 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80 },
+    },
+    {
+        { 0x80, 0x0B, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x0D, 0x80, 0x80, 0x0E, 0x80, 0x80, 0x0F, 0x80, 0x80 },
+        { 0x80, 0x80, 0x0B, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x0D, 0x80, 0x80, 0x0E, 0x80, 0x80, 0x0F, 0x80 },
+        { 0x0A, 0x80, 0x80, 0x0B, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x0D, 0x80, 0x80, 0x0E, 0x80, 0x80, 0x0F },
+    },
+};
+
+// packs two 16 bit weights into the (low, high) halves of a pmaddwd pair
+#define PAIR(lo, hi)  ((int32_t)(((uint32_t)(uint16_t)(hi) << 16) | (uint16_t)(lo)))
+
+/*!
+ ******************************************************************************
+ * Function Name: loadPlanesSsse3 / storePlanesSsse3                          *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Splits 16 BGR pixels into a blue, green and red register of 16 bytes and  *
+ *  merges them back                                                          *
+ ******************************************************************************
+!*/
+__attribute__((target("ssse3"))) static inline void
+loadPlanesSsse3(const uint8_t *src, __m128i plane[3])
+{
+    __m128i reg[3];
+
+    reg[0] = _mm_loadu_si128((const __m128i *)(src));
+    reg[1] = _mm_loadu_si128((const __m128i *)(src + 16));
+    reg[2] = _mm_loadu_si128((const __m128i *)(src + 32));
+
+    for (int p = 0; p < 3; p++) {
+        plane[p] = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(reg[0], _mm_load_si128((const __m128i *)deinterleave[p][0])),
+                _mm_shuffle_epi8(reg[1], _mm_load_si128((const __m128i *)deinterleave[p][1]))),
+            _mm_shuffle_epi8(reg[2], _mm_load_si128((const __m128i *)deinterleave[p][2])));
+    }
+}
+
+__attribute__((target("ssse3"))) static inline void
+storePlanesSsse3(uint8_t *dst, const __m128i plane[3])
+{
+    for (int r = 0; r < 3; r++) {
+        __m128i reg = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(plane[0], _mm_load_si128((const __m128i *)interleave[r][0])),
+                _mm_shuffle_epi8(plane[1], _mm_load_si128((const __m128i *)interleave[r][1]))),
+            _mm_shuffle_epi8(plane[2], _mm_load_si128((const __m128i *)interleave[r][2])));
+
+        _mm_storeu_si128((__m128i *)(dst + 16 * r), reg);
+    }
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: matrixWordsSse2                                             *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Applies a color matrix to 8 pixels held as 16 bit blue, green and red     *
+ *  lanes. Blue and green are paired with their weights and red with the bias *
+ *  so every output channel takes 2 pmaddwd per 4 pixels. All channels are    *
+ *  computed from the input pixel and clamped to 0 - 255                      *
+ ******************************************************************************
+!*/
+static inline void
+matrixWordsSse2(__m128i *b, __m128i *g, __m128i *r, const colorMatrix_t *matrix)
+{
+    const __m128i half = _mm_set1_epi16(1 << (MATRIX_SHIFT - 1));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max  = _mm_set1_epi16(255);
+    __m128i bgLo = _mm_unpacklo_epi16(*b, *g), bgHi = _mm_unpackhi_epi16(*b, *g);
+    __m128i rkLo = _mm_unpacklo_epi16(*r, half), rkHi = _mm_unpackhi_epi16(*r, half);
+    __m128i out[3];
+
+    for (int c = 0; c < 3; c++) {
+        __m128i bg = _mm_set1_epi32(PAIR(matrix->weight[c][0], matrix->weight[c][1]));
+        __m128i rk = _mm_set1_epi32(PAIR(matrix->weight[c][2], matrix->bias[c]));
+        __m128i lo = _mm_add_epi32(_mm_madd_epi16(bgLo, bg), _mm_madd_epi16(rkLo, rk));
+        __m128i hi = _mm_add_epi32(_mm_madd_epi16(bgHi, bg), _mm_madd_epi16(rkHi, rk));
+
+        out[c] = _mm_packs_epi32(_mm_srai_epi32(lo, MATRIX_SHIFT), _mm_srai_epi32(hi, MATRIX_SHIFT));
+        out[c] = _mm_min_epi16(_mm_max_epi16(out[c], zero), max);
+    }
+
+    *b = out[0];
+    *g = out[1];
+    *r = out[2];
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: invertSse2                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Inverts 16 bytes per iteration                                            *
+ ******************************************************************************
+!*/
+static void
+invertSse2(uint8_t *bmpimg, uint32_t size)
+{
+    const __m128i ones = _mm_set1_epi8(-1);
+    uint32_t imgIdx = 0;
+
+    for (; imgIdx + 16 <= size; imgIdx += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(bmpimg + imgIdx));
+        _mm_storeu_si128((__m128i *)(bmpimg + imgIdx), _mm_xor_si128(v, ones));
+    }
+
+    reverseBmpScalar(bmpimg + imgIdx, size - imgIdx);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: chainWordsSse2                                              *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Runs every operation of the chain on 8 pixels while they sit in registers *
+ ******************************************************************************
+!*/
+static inline void
+chainWordsSse2(__m128i *b, __m128i *g, __m128i *r, const opChain_t *chain)
+{
+    const __m128i max = _mm_set1_epi16(255);
+
+    for (uint32_t opIdx = 0; opIdx < chain->count; opIdx++) {
+        if (chain->op[opIdx] == invert) {
+            *b = _mm_xor_si128(*b, max);
+            *g = _mm_xor_si128(*g, max);
+            *r = _mm_xor_si128(*r, max);
+        } else {
+            matrixWordsSse2(b, g, r, &chain->matrix[opIdx]);
+        }
+    }
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: chainSsse3                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Filters 16 BGR pixels per iteration, the pixels are split into color      *
+ *  planes, widened to 16 bit, put through the whole chain and merged back    *
+ *  so every pixel is loaded and stored once                                  *
+ ******************************************************************************
+!*/
+__attribute__((target("ssse3"))) static void
+chainSsse3(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t imgIdx = 0;
+
+    for (; imgIdx + 48 <= size; imgIdx += 48) {
+        __m128i plane[3], lo[3], hi[3];
+
+        loadPlanesSsse3(bmpimg + imgIdx, plane);
+        for (int p = 0; p < 3; p++) {
+            lo[p] = _mm_unpacklo_epi8(plane[p], zero);
+            hi[p] = _mm_unpackhi_epi8(plane[p], zero);
+        }
+
+        chainWordsSse2(&lo[0], &lo[1], &lo[2], chain);
+        chainWordsSse2(&hi[0], &hi[1], &hi[2], chain);
+
+        for (int p = 0; p < 3; p++)
+            plane[p] = _mm_packus_epi16(lo[p], hi[p]);
+        storePlanesSsse3(bmpimg + imgIdx, plane);
+    }
+
+    applyOpsScalar(bmpimg + imgIdx, size - imgIdx, chain);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: chain32Sse2                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Filters 8 BGRX pixels per iteration. Every pixel fills a 32 bit lane so   *
+ *  the channels come out with a shift and a mask, no shuffles needed. They   *
+ *  are narrowed to 16 bit lanes for the chain and merged back over the       *
+ *  fourth byte, which is kept                                                *
+ ******************************************************************************
+!*/
+static void
+chain32Sse2(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    const __m128i low  = _mm_set1_epi32(0xFF);
+    const __m128i high = _mm_set1_epi32((int32_t)0xFF000000);
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t imgIdx = 0;
+
+    for (; imgIdx + 32 <= size; imgIdx += 32) {
+        __m128i px[2], b, g, r;
+
+        px[0] = _mm_loadu_si128((const __m128i *)(bmpimg + imgIdx));
+        px[1] = _mm_loadu_si128((const __m128i *)(bmpimg + imgIdx + 16));
+
+        b = _mm_packs_epi32(_mm_and_si128(px[0], low), _mm_and_si128(px[1], low));
+        g = _mm_packs_epi32(
+            _mm_and_si128(_mm_srli_epi32(px[0], 8), low), _mm_and_si128(_mm_srli_epi32(px[1], 8), low));
+        r = _mm_packs_epi32(
+            _mm_and_si128(_mm_srli_epi32(px[0], 16), low), _mm_and_si128(_mm_srli_epi32(px[1], 16), low));
+
+        chainWordsSse2(&b, &g, &r, chain);
+
+        px[0] = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(px[0], high), _mm_unpacklo_epi16(b, zero)),
+            _mm_or_si128(_mm_slli_epi32(_mm_unpacklo_epi16(g, zero), 8), _mm_unpacklo_epi16(zero, r)));
+        px[1] = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(px[1], high), _mm_unpackhi_epi16(b, zero)),
+            _mm_or_si128(_mm_slli_epi32(_mm_unpackhi_epi16(g, zero), 8), _mm_unpackhi_epi16(zero, r)));
+
+        _mm_storeu_si128((__m128i *)(bmpimg + imgIdx), px[0]);
+        _mm_storeu_si128((__m128i *)(bmpimg + imgIdx + 16), px[1]);
+    }
+
+    chain32Scalar(bmpimg + imgIdx, size - imgIdx, chain);
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: chain16Sse2                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Filters 8 pixels of 16 bits per iteration, with 5 bits of blue and red    *
+ *  and greenBits of green. The fields are widened to 8 bits by repeating     *
+ *  their top bits and rounded back with (v * max + 128) / 255, done as       *
+ *  (t + (t >> 8)) >> 8, just like applyOpsPackedScalar. It is always inlined *
+ *  with a constant greenBits so 555 and 565 both get a kernel with the       *
+ *  shifts and masks folded in. The top bit of 555 pixels is kept             *
+ ******************************************************************************
+!*/
+static inline __m128i
+narrowSse2(__m128i v, int16_t max)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(max)), _mm_set1_epi16(128));
+
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static inline __attribute__((always_inline)) void
+chain16Sse2(uint8_t *bmpimg, uint32_t size, const opChain_t *chain, const int greenBits)
+{
+    const int redShift  = 5 + greenBits;
+    const __m128i five  = _mm_set1_epi16(0x1F);
+    const __m128i green = _mm_set1_epi16((1 << greenBits) - 1);
+    const __m128i keep  = _mm_set1_epi16((greenBits == 5) ? (int16_t)0x8000 : 0);
+    uint32_t imgIdx = 0;
+
+    for (; imgIdx + 16 <= size; imgIdx += 16) {
+        __m128i px = _mm_loadu_si128((const __m128i *)(bmpimg + imgIdx));
+        __m128i b  = _mm_and_si128(px, five);
+        __m128i g  = _mm_and_si128(_mm_srli_epi16(px, 5), green);
+        __m128i r  = _mm_and_si128(_mm_srli_epi16(px, redShift), five);
+
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 8 - greenBits), _mm_srli_epi16(g, 2 * greenBits - 8));
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+
+        chainWordsSse2(&b, &g, &r, chain);
+
+        b  = narrowSse2(b, 0x1F);
+        g  = narrowSse2(g, (1 << greenBits) - 1);
+        r  = narrowSse2(r, 0x1F);
+        px = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(px, keep), b),
+            _mm_or_si128(_mm_slli_epi16(g, 5), _mm_slli_epi16(r, redShift)));
+
+        _mm_storeu_si128((__m128i *)(bmpimg + imgIdx), px);
+    }
+
+    if (greenBits == 5)
+        chain555Scalar(bmpimg + imgIdx, size - imgIdx, chain);
+    else
+        chain565Scalar(bmpimg + imgIdx, size - imgIdx, chain);
+}
+
+static void
+chain555Sse2(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    chain16Sse2(bmpimg, size, chain, 5);
+}
+
+static void
+chain565Sse2(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    chain16Sse2(bmpimg, size, chain, 6);
+}
+
+/*!
+ ******************************************************************************
+ * AVX2 kernels                                                               *
+ ******************************************************************************
+ * Same as the SSE kernels on 32 bytes or 32 pixels per iteration. The 256    *
+ * bit unpack and pack instructions work per 128 bit lane, since the planes   *
+ * are packed back with the same lanes the pixel order comes out unchanged.   *
+ * The same goes for the 32 bit pixels, narrowed and widened per lane         *
+ ******************************************************************************
+!*/
+__attribute__((target("avx2"))) static inline void
+matrixWordsAvx2(__m256i *b, __m256i *g, __m256i *r, const colorMatrix_t *matrix)
+{
+    const __m256i half = _mm256_set1_epi16(1 << (MATRIX_SHIFT - 1));
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max  = _mm256_set1_epi16(255);
+    __m256i bgLo = _mm256_unpacklo_epi16(*b, *g), bgHi = _mm256_unpackhi_epi16(*b, *g);
+    __m256i rkLo = _mm256_unpacklo_epi16(*r, half), rkHi = _mm256_unpackhi_epi16(*r, half);
+    __m256i out[3];
+
+    for (int c = 0; c < 3; c++) {
+        __m256i bg = _mm256_set1_epi32(PAIR(matrix->weight[c][0], matrix->weight[c][1]));
+        __m256i rk = _mm256_set1_epi32(PAIR(matrix->weight[c][2], matrix->bias[c]));
+        __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(bgLo, bg), _mm256_madd_epi16(rkLo, rk));
+        __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(bgHi, bg), _mm256_madd_epi16(rkHi, rk));
+
+        out[c] = _mm256_packs_epi32(_mm256_srai_epi32(lo, MATRIX_SHIFT), _mm256_srai_epi32(hi, MATRIX_SHIFT));
+        out[c] = _mm256_min_epi16(_mm256_max_epi16(out[c], zero), max);
+    }
+
+    *b = out[0];
+    *g = out[1];
+    *r = out[2];
+}
+
+__attribute__((target("avx2"))) static void
+invertAvx2(uint8_t *bmpimg, uint32_t size)
+{
+    const __m256i ones = _mm256_set1_epi8(-1);
+    uint32_t imgIdx = 0;
+
+    for (; imgIdx + 32 <= size; imgIdx += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(bmpimg + imgIdx));
+        _mm256_storeu_si256((__m256i *)(bmpimg + imgIdx), _mm256_xor_si256(v, ones));
+    }
+
+    reverseBmpScalar(bmpimg + imgIdx, size - imgIdx);
+}
+
+__attribute__((target("avx2"))) static inline void
+chainWordsAvx2(__m256i *b, __m256i *g, __m256i *r, const opChain_t *chain)
+{
+    const __m256i max = _mm256_set1_epi16(255);
+
+    for (uint32_t opIdx = 0; opIdx < chain->count; opIdx++) {
+        if (chain->op[opIdx] == invert) {
+            *b = _mm256_xor_si256(*b, max);
+            *g = _mm256_xor_si256(*g, max);
+            *r = _mm256_xor_si256(*r, max);
+        } else {
+            matrixWordsAvx2(b, g, r, &chain->matrix[opIdx]);
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static void
+chainAvx2(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t imgIdx = 0;
+
+    for (; imgIdx + 96 <= size; imgIdx += 96) {
+        __m128i first[3], second[3];
+        __m256i plane[3], lo[3], hi[3];
+
+        loadPlanesSsse3(bmpimg + imgIdx, first);
+        loadPlanesSsse3(bmpimg + imgIdx + 48, second);
+        for (int p = 0; p < 3; p++) {
+            plane[p] = _mm256_set_m128i(second[p], first[p]);
+            lo[p] = _mm256_unpacklo_epi8(plane[p], zero);
+            hi[p] = _mm256_unpackhi_epi8(plane[p], zero);
+        }
+
+        chainWordsAvx2(&lo[0], &lo[1], &lo[2], chain);
+        chainWordsAvx2(&hi[0], &hi[1], &hi[2], chain);
+
+        for (int p = 0; p < 3; p++) {
+            plane[p] = _mm256_packus_epi16(lo[p], hi[p]);
+            first[p] = _mm256_castsi256_si128(plane[p]);
+            second[p] = _mm256_extracti128_si256(plane[p], 1);
+        }
+        storePlanesSsse3(bmpimg + imgIdx, first);
+        storePlanesSsse3(bmpimg + imgIdx + 48, second);
+    }
+
+    chainSsse3(bmpimg + imgIdx, size - imgIdx, chain);
+}
+
+__attribute__((target("avx2"))) static void
+chain32Avx2(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    const __m256i low  = _mm256_set1_epi32(0xFF);
+    const __m256i high = _mm256_set1_epi32((int32_t)0xFF000000);
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t imgIdx = 0;
+
+    for (; imgIdx + 64 <= size; imgIdx += 64) {
+        __m256i px[2], b, g, r;
+
+        px[0] = _mm256_loadu_si256((const __m256i *)(bmpimg + imgIdx));
+        px[1] = _mm256_loadu_si256((const __m256i *)(bmpimg + imgIdx + 32));
+
+        b = _mm256_packs_epi32(_mm256_and_si256(px[0], low), _mm256_and_si256(px[1], low));
+        g = _mm256_packs_epi32(
+            _mm256_and_si256(_mm256_srli_epi32(px[0], 8), low), _mm256_and_si256(_mm256_srli_epi32(px[1], 8), low));
+        r = _mm256_packs_epi32(
+            _mm256_and_si256(_mm256_srli_epi32(px[0], 16), low), _mm256_and_si256(_mm256_srli_epi32(px[1], 16), low));
+
+        chainWordsAvx2(&b, &g, &r, chain);
+
+        px[0] = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(px[0], high), _mm256_unpacklo_epi16(b, zero)),
+            _mm256_or_si256(_mm256_slli_epi32(_mm256_unpacklo_epi16(g, zero), 8), _mm256_unpacklo_epi16(zero, r)));
+        px[1] = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(px[1], high), _mm256_unpackhi_epi16(b, zero)),
+            _mm256_or_si256(_mm256_slli_epi32(_mm256_unpackhi_epi16(g, zero), 8), _mm256_unpackhi_epi16(zero, r)));
+
+        _mm256_storeu_si256((__m256i *)(bmpimg + imgIdx), px[0]);
+        _mm256_storeu_si256((__m256i *)(bmpimg + imgIdx + 32), px[1]);
+    }
+
+    chain32Sse2(bmpimg + imgIdx, size - imgIdx, chain);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+narrowAvx2(__m256i v, int16_t max)
+{
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(v, _mm256_set1_epi16(max)), _mm256_set1_epi16(128));
+
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2"), always_inline)) static inline void
+chain16Avx2(uint8_t *bmpimg, uint32_t size, const opChain_t *chain, const int greenBits)
+{
+    const int redShift  = 5 + greenBits;
+    const __m256i five  = _mm256_set1_epi16(0x1F);
+    const __m256i green = _mm256_set1_epi16((1 << greenBits) - 1);
+    const __m256i keep  = _mm256_set1_epi16((greenBits == 5) ? (int16_t)0x8000 : 0);
+    uint32_t imgIdx = 0;
+
+    for (; imgIdx + 32 <= size; imgIdx += 32) {
+        __m256i px = _mm256_loadu_si256((const __m256i *)(bmpimg + imgIdx));
+        __m256i b  = _mm256_and_si256(px, five);
+        __m256i g  = _mm256_and_si256(_mm256_srli_epi16(px, 5), green);
+        __m256i r  = _mm256_and_si256(_mm256_srli_epi16(px, redShift), five);
+
+        b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 8 - greenBits), _mm256_srli_epi16(g, 2 * greenBits - 8));
+        r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+
+        chainWordsAvx2(&b, &g, &r, chain);
+
+        b  = narrowAvx2(b, 0x1F);
+        g  = narrowAvx2(g, (1 << greenBits) - 1);
+        r  = narrowAvx2(r, 0x1F);
+        px = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(px, keep), b),
+            _mm256_or_si256(_mm256_slli_epi16(g, 5), _mm256_slli_epi16(r, redShift)));
+
+        _mm256_storeu_si256((__m256i *)(bmpimg + imgIdx), px);
+    }
+
+    chain16Sse2(bmpimg + imgIdx, size - imgIdx, chain, greenBits);
+}
+
+__attribute__((target("avx2"))) static void
+chain555Avx2(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    chain16Avx2(bmpimg, size, chain, 5);
+}
+
+__attribute__((target("avx2"))) static void
+chain565Avx2(uint8_t *bmpimg, uint32_t size, const opChain_t *chain)
+{
+    chain16Avx2(bmpimg, size, chain, 6);
+}
+
+#endif//SIMD_X86
+
+/*!
+ ******************************************************************************
+ * Function Name: selectKernels                                               *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Checks which instruction sets the cpu supports and points the kernels to  *
+ *  the widest implementation. Without SSSE3 (or on other architectures) the  *
+ *  scalar reference code is used                                             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  None                                                                      *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+selectKernels(void)
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = (pixelKernels_t){
+            "avx2", invertAvx2, chainAvx2, chain32Avx2, chain555Avx2, chain565Avx2
+        };
+    } else if (__builtin_cpu_supports("ssse3")) {
+        kernels = (pixelKernels_t){
+            "ssse3", invertSse2, chainSsse3, chain32Sse2, chain555Sse2, chain565Sse2
+        };
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernels.name     = "sse2";
+        kernels.invert   = invertSse2;
+        kernels.chain32  = chain32Sse2;
+        kernels.chain555 = chain555Sse2;
+        kernels.chain565 = chain565Sse2;
+    }
+#endif
+
+    return;
+}
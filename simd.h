@@ -0,0 +1,28 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <stdint.h>  // int typedefs
+
+struct opChain_s;
+
+// structure for holding the pixel kernels used by reverseBmp, applyFilter and applyOps
+typedef struct pixelKernels_s {
+    const char *name;                                  // name of the instruction set
+    void (*invert)(uint8_t *bmpimg, uint32_t size);    // inverts every byte
+    void (*chain)(uint8_t *bmpimg, uint32_t size,      // runs a chain of operations
+        const struct opChain_s *chain);                // on BGR pixels in one pass
+    void (*chain32)(uint8_t *bmpimg, uint32_t size,    // the same on BGRX pixels,
+        const struct opChain_s *chain);                // the fourth byte is kept
+    void (*chain555)(uint8_t *bmpimg, uint32_t size,   // the same on 16 bit 555 pixels
+        const struct opChain_s *chain);
+    void (*chain565)(uint8_t *bmpimg, uint32_t size,   // the same on 16 bit 565 pixels
+        const struct opChain_s *chain);
+} pixelKernels_t;
+
+// the kernels in use, the scalar reference ones until selectKernels is called
+extern pixelKernels_t kernels;
+
+// picks the fastest kernels the cpu supports
+void selectKernels(void);
+
+#endif//_SIMD_H_
@@ -0,0 +1,236 @@
+#include <stdlib.h>       // malloc, free
+#include <string.h>       // strcmp
+#include <time.h>         // clock_gettime
+#include <sys/resource.h> // getrusage
+
+#include "stats.h"
+
+double
+statsNow(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// adds seconds and bytes to the stage called name, new stages are appended
+// so they keep the order they first ran in
+static void
+statsAdd(bmpStats_t *stats, const char *name, double seconds, uint64_t bytes)
+{
+    uint32_t stageIdx;
+
+    for (stageIdx = 0; stageIdx < stats->count; stageIdx++)
+        if (strcmp(stats->stage[stageIdx].name, name) == 0)
+            break;
+
+    if (stageIdx == stats->count) {
+        if (stats->count == STATS_STAGES)
+            return;
+        stats->stage[stats->count++] = (statsStage_t){ name, 0.0, 0 };
+    }
+
+    stats->stage[stageIdx].seconds += seconds;
+    stats->stage[stageIdx].bytes   += bytes;
+    return;
+}
+
+void
+statsStage(bmpStats_t *stats, const char *name, double start, uint64_t bytes)
+{
+    if (stats != NULL)
+        statsAdd(stats, name, statsNow() - start, bytes);
+    return;
+}
+
+bool
+statsParse(const char *str, enum statsFormat_e *format)
+{
+    if (strcmp(str, "json") == 0)
+        *format = statsJson;
+    else if (strcmp(str, "prometheus") == 0)
+        *format = statsPrometheus;
+    else
+        return false;
+
+    return true;
+}
+
+// peak resident memory of the process in bytes
+static uint64_t
+peakRss(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)usage.ru_maxrss * 1024;
+}
+
+void
+statsJsonString(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(fp, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(fp, "\\u%04x", (unsigned char)*str);
+        else
+            fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+bool
+statsOpen(statsSink_t *sink, enum statsFormat_e format, const char *path)
+{
+    *sink = (statsSink_t){ 0 };
+    sink->format = format;
+    sink->path   = path;
+    sink->fp     = stdout;
+    sink->start  = statsNow();
+
+    // JSON lines are appended as the images finish, Prometheus is written
+    // once at the end
+    if (format == statsJson && path != NULL) {
+        sink->fp = fopen(path, "a");
+        if (sink->fp == NULL)
+            return false;
+    }
+
+    return true;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: statsReport                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Adds the stages of an image to the totals and, for JSON, writes them as   *
+ *  one line: the image, its size, the total time, the peak resident memory   *
+ *  so far and per stage the seconds and, where bytes were moved, the bytes   *
+ *  and MB/s                                                                  *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  statsSink_t *sink                                                         *
+ *  const char *image                                                         *
+ *  const bmpStats_t *stats                                                   *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+statsReport(statsSink_t *sink, const char *image, const bmpStats_t *stats)
+{
+    double total = 0.0;
+
+    if (sink == NULL || sink->format == statsOff)
+        return;
+
+    sink->images++;
+    for (uint32_t stageIdx = 0; stageIdx < stats->count; stageIdx++) {
+        statsAdd(&sink->totals, stats->stage[stageIdx].name, stats->stage[stageIdx].seconds, stats->stage[stageIdx].bytes);
+        total += stats->stage[stageIdx].seconds;
+    }
+
+    if (sink->format != statsJson)
+        return;
+
+    fprintf(sink->fp, "{\"image\":");
+    statsJsonString(sink->fp, image);
+    fprintf(
+        sink->fp, ",\"width\":%u,\"height\":%u,\"bits\":%u,\"seconds\":%.6f,\"peak_rss_bytes\":%llu,\"stages\":{",
+        stats->width, stats->height, stats->bitCount, total, (unsigned long long)peakRss());
+
+    for (uint32_t stageIdx = 0; stageIdx < stats->count; stageIdx++) {
+        const statsStage_t *stage = &stats->stage[stageIdx];
+
+        fprintf(sink->fp, "%s\"%s\":{\"seconds\":%.6f", stageIdx ? "," : "", stage->name, stage->seconds);
+        if (stage->bytes != 0)
+            fprintf(
+                sink->fp, ",\"bytes\":%llu,\"mb_per_s\":%.1f", (unsigned long long)stage->bytes,
+                (stage->seconds > 0) ? stage->bytes / stage->seconds / 1e6 : 0.0);
+        fputc('}', sink->fp);
+    }
+    fprintf(sink->fp, "}}\n");
+    fflush(sink->fp);
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: statsClose                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  For Prometheus writes the totals of the run as counters per stage. A file *
+ *  is written next to its final name and renamed into place, so a node       *
+ *  exporter textfile collector never sees half of it                         *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  statsSink_t *sink                                                         *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+statsClose(statsSink_t *sink)
+{
+    const bmpStats_t *totals = &sink->totals;
+    char *temp = NULL;
+    FILE *fp   = stdout;
+
+    if (sink->format == statsJson && sink->fp != stdout)
+        fclose(sink->fp);
+    if (sink->format != statsPrometheus)
+        return;
+
+    if (sink->path != NULL) {
+        temp = malloc(strlen(sink->path) + 5);
+        if (temp == NULL) {
+            fprintf(stderr, "stats memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+        sprintf(temp, "%s.tmp", sink->path);
+        fp = fopen(temp, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "Failed opening file \"%s\"\n", temp);
+            free(temp);
+            return;
+        }
+    }
+
+    fprintf(fp, "# HELP bmp_images_total Images processed.\n");
+    fprintf(fp, "# TYPE bmp_images_total counter\n");
+    fprintf(fp, "bmp_images_total %llu\n", (unsigned long long)sink->images);
+
+    fprintf(fp, "# HELP bmp_stage_seconds_total Time spent in every stage.\n");
+    fprintf(fp, "# TYPE bmp_stage_seconds_total counter\n");
+    for (uint32_t stageIdx = 0; stageIdx < totals->count; stageIdx++)
+        fprintf(fp, "bmp_stage_seconds_total{stage=\"%s\"} %.6f\n", totals->stage[stageIdx].name, totals->stage[stageIdx].seconds);
+
+    fprintf(fp, "# HELP bmp_stage_bytes_total Bytes read, processed or written in every stage.\n");
+    fprintf(fp, "# TYPE bmp_stage_bytes_total counter\n");
+    for (uint32_t stageIdx = 0; stageIdx < totals->count; stageIdx++)
+        if (totals->stage[stageIdx].bytes != 0)
+            fprintf(fp, "bmp_stage_bytes_total{stage=\"%s\"} %llu\n", totals->stage[stageIdx].name, (unsigned long long)totals->stage[stageIdx].bytes);
+
+    fprintf(fp, "# HELP bmp_run_seconds Wall clock time of the run.\n");
+    fprintf(fp, "# TYPE bmp_run_seconds gauge\n");
+    fprintf(fp, "bmp_run_seconds %.6f\n", statsNow() - sink->start);
+
+    fprintf(fp, "# HELP bmp_peak_rss_bytes Peak resident memory of the run.\n");
+    fprintf(fp, "# TYPE bmp_peak_rss_bytes gauge\n");
+    fprintf(fp, "bmp_peak_rss_bytes %llu\n", (unsigned long long)peakRss());
+
+    if (temp != NULL) {
+        if (fclose(fp) != 0 || rename(temp, sink->path) != 0)
+            fprintf(stderr, "Failed writing file \"%s\"\n", sink->path);
+        free(temp);
+    } else {
+        fflush(fp);
+    }
+    return;
+}
@@ -0,0 +1,66 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>   // FILE
+#include <stdint.h>  // int typedefs
+#include <stdbool.h> // true, false
+
+// most stages recorded for one image
+#define STATS_STAGES  16
+
+// how the stats are reported
+enum statsFormat_e {
+    statsOff        = 0,
+    statsJson       = 1,    // one line of JSON per image
+    statsPrometheus = 2,    // counters for the whole run in the Prometheus text format
+};
+
+// time and bytes of one stage, a stage that runs more than once (like the
+// bands of streamBmp) adds up
+typedef struct statsStage_s {
+    const char *name;         // name of the stage, a string literal
+    double seconds;           // time spent in the stage
+    uint64_t bytes;           // bytes read, processed or written, 0 when it doesn't apply
+} statsStage_t;
+
+// the stages of one image, NULL everywhere stats are taken turns them off
+typedef struct bmpStats_s {
+    uint32_t width;           // size of the input image, filled in when the header is parsed
+    uint32_t height;
+    uint32_t bitCount;
+    uint32_t count;           // number of stages
+    statsStage_t stage[STATS_STAGES];
+} bmpStats_t;
+
+// where the stats of every image go, only to be used from one thread
+typedef struct statsSink_s {
+    enum statsFormat_e format;
+    const char *path;         // file the stats are written to, NULL for stdout
+    FILE *fp;                 // open file for the JSON lines
+    uint64_t images;          // number of images reported
+    bmpStats_t totals;        // the stages of every image added up
+    double start;             // when the sink was opened
+} statsSink_t;
+
+// monotonic clock in seconds
+double statsNow(void);
+
+// adds the time since start and the bytes to a stage of the image
+void statsStage(bmpStats_t *stats, const char *name, double start, uint64_t bytes);
+
+// parses json or prometheus, false on an unknown format
+bool statsParse(const char *str, enum statsFormat_e *format);
+
+// writes a string as a JSON string, escaping what JSON doesn't allow raw
+void statsJsonString(FILE *fp, const char *str);
+
+// opens the sink, false when the file can't be opened
+bool statsOpen(statsSink_t *sink, enum statsFormat_e format, const char *path);
+
+// reports the stats of one image
+void statsReport(statsSink_t *sink, const char *image, const bmpStats_t *stats);
+
+// writes what is still pending and closes the sink
+void statsClose(statsSink_t *sink);
+
+#endif//_STATS_H_
@@ -0,0 +1,325 @@
+#include <stdio.h>     // fprintf
+#include <stdlib.h>    // malloc, free, exit
+#include <stdbool.h>   // true, false
+#include <stdatomic.h> // atomic_load, atomic_compare_exchange_weak
+#include <pthread.h>   // pthread_create, pthread_join, mutexes and conditions
+
+#include "threadpool.h"
+
+// every worker owns a range of chunks, head in the low and tail in the high
+// 32 bits so both ends can be updated with one compare and swap. The ranges
+// are padded to a cache line so the workers don't share lines
+typedef struct poolRange_s {
+    _Atomic uint64_t range;
+    char pad[64 - sizeof(uint64_t)];
+} poolRange_t;
+
+struct threadPool_s {
+    pthread_t *threads;     // worker threads, the caller is worker 0
+    uint32_t count;         // number of workers including the caller
+    poolRange_t *ranges;    // the chunks still owned by every worker
+
+    pthread_mutex_t lock;   // guards everything below
+    pthread_cond_t wake;    // signals a new job or quit to the workers
+    pthread_cond_t done;    // signals the caller the workers are finished
+    uint64_t generation;    // bumped for every job
+    uint32_t busy;          // workers that haven't finished the current job
+    bool quit;              // set when the pool is destroyed
+
+    poolTask_f task;        // task of the current job
+    void *ctx;              // context of the current job
+};
+
+// id of the worker thread, 0 for every thread outside the pool
+static _Thread_local uint32_t workerId = 0;
+
+// arguments for a worker thread
+typedef struct poolWorker_s {
+    threadPool_t *pool;
+    uint32_t id;
+} poolWorker_t;
+
+/*!
+ ******************************************************************************
+ * Function Name: takeChunk                                                   *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Takes a chunk from a range, the owner takes from the head and thieves     *
+ *  steal from the tail so they only meet on the last chunk                   *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  poolRange_t *range                                                        *
+ *  bool steal                                                                *
+ *  uint32_t *chunk                                                           *
+ *                                                                            *
+ * Return:                                                                    *
+ *  true if a chunk was taken, false if the range is empty                    *
+ ******************************************************************************
+!*/
+static bool
+takeChunk(poolRange_t *range, bool steal, uint32_t *chunk)
+{
+    uint64_t old = atomic_load(&range->range);
+    uint64_t new;
+    uint32_t head, tail;
+
+    do {
+        head = (uint32_t)old;
+        tail = (uint32_t)(old >> 32);
+        if (head >= tail)
+            return false;
+
+        if (steal) {
+            *chunk = tail - 1;
+            new = ((uint64_t)(tail - 1) << 32) | head;
+        } else {
+            *chunk = head;
+            new = ((uint64_t)tail << 32) | (head + 1);
+        }
+    } while (!atomic_compare_exchange_weak(&range->range, &old, new));
+
+    return true;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: poolWork                                                    *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Runs the chunks of the worker's own range and then steals from the other  *
+ *  workers until every range is empty                                        *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  threadPool_t *pool                                                        *
+ *  uint32_t id                                                               *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+static void
+poolWork(threadPool_t *pool, uint32_t id)
+{
+    uint32_t chunk;
+
+    while (takeChunk(&pool->ranges[id], false, &chunk))
+        pool->task(pool->ctx, chunk);
+
+    for (uint32_t step = 1; step < pool->count; step++) {
+        poolRange_t *victim = &pool->ranges[(id + step) % pool->count];
+
+        // keep stealing from this victim until it runs dry
+        while (takeChunk(victim, true, &chunk))
+            pool->task(pool->ctx, chunk);
+    }
+
+    return;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: poolThread                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Main loop of a worker thread, sleeps until a job is posted, works on it   *
+ *  and reports back to the caller                                            *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  void *arg                                                                 *
+ *                                                                            *
+ * Return:                                                                    *
+ *  NULL                                                                      *
+ ******************************************************************************
+!*/
+static void *
+poolThread(void *arg)
+{
+    poolWorker_t *worker = arg;
+    threadPool_t *pool   = worker->pool;
+    uint64_t seen        = 0;
+
+    workerId = worker->id;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        poolWork(pool, worker->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    free(worker);
+    return NULL;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: poolCreate                                                  *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Starts threads - 1 worker threads, the thread calling poolRun does its    *
+ *  share of the work as worker 0                                             *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  uint32_t threads                                                          *
+ *                                                                            *
+ * Return:                                                                    *
+ *  the new pool                                                              *
+ ******************************************************************************
+!*/
+threadPool_t *
+poolCreate(uint32_t threads)
+{
+    threadPool_t *pool = calloc(1, sizeof(threadPool_t));
+
+    if (threads == 0) threads = 1;
+
+    if (pool == NULL ||
+        (pool->threads = calloc(threads, sizeof(pthread_t))) == NULL ||
+        posix_memalign((void **)&pool->ranges, 64, threads * sizeof(poolRange_t)) != 0) {
+        fprintf(stderr, "thread pool memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pool->count = threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (uint32_t id = 0; id < threads; id++)
+        atomic_init(&pool->ranges[id].range, 0);
+
+    for (uint32_t id = 1; id < threads; id++) {
+        poolWorker_t *worker = malloc(sizeof(poolWorker_t));
+
+        if (worker == NULL) {
+            fprintf(stderr, "thread pool memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+        worker->pool = pool;
+        worker->id   = id;
+
+        if (pthread_create(&pool->threads[id], NULL, poolThread, worker) != 0) {
+            fprintf(stderr, "Failed creating worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return pool;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: poolRun                                                     *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Hands every worker an equal, contiguous range of the chunks and wakes     *
+ *  them up. Workers that finish early steal chunks from the back of the      *
+ *  other ranges so uneven chunks balance out. Without a pool the chunks are  *
+ *  run in order on the calling thread                                        *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  threadPool_t *pool                                                        *
+ *  uint32_t chunks                                                           *
+ *  poolTask_f task                                                           *
+ *  void *ctx                                                                 *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+poolRun(threadPool_t *pool, uint32_t chunks, poolTask_f task, void *ctx)
+{
+    if (pool == NULL || pool->count == 1 || chunks < 2) {
+        for (uint32_t chunk = 0; chunk < chunks; chunk++)
+            task(ctx, chunk);
+        return;
+    }
+
+    // split the chunks in equal ranges, the first ranges get the remainder
+    for (uint32_t id = 0, start = 0; id < pool->count; id++) {
+        uint32_t size = chunks / pool->count + (id < chunks % pool->count);
+
+        atomic_store(&pool->ranges[id].range, ((uint64_t)(start + size) << 32) | start);
+        start += size;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx  = ctx;
+    pool->busy = pool->count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    poolWork(pool, 0);
+
+    // wait for the chunks the other workers are still busy with
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy != 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    return;
+}
+
+uint32_t
+poolWorker(void)
+{
+    return workerId;
+}
+
+uint32_t
+poolSize(threadPool_t *pool)
+{
+    return (pool == NULL) ? 1 : pool->count;
+}
+
+/*!
+ ******************************************************************************
+ * Function Name: poolDestroy                                                 *
+ ******************************************************************************
+ * Summary:                                                                   *
+ *  Tells the workers to quit, waits for them and frees the pool              *
+ *                                                                            *
+ * Parameters:                                                                *
+ *  threadPool_t *pool                                                        *
+ *                                                                            *
+ * Return:                                                                    *
+ *  None                                                                      *
+ ******************************************************************************
+!*/
+void
+poolDestroy(threadPool_t *pool)
+{
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint32_t id = 1; id < pool->count; id++)
+        pthread_join(pool->threads[id], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->ranges);
+    free(pool->threads);
+    free(pool);
+    return;
+}
@@ -0,0 +1,28 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <stdint.h>  // int typedefs
+
+// a task processes one chunk of a job, chunks are numbered from 0
+typedef void (*poolTask_f)(void *ctx, uint32_t chunk);
+
+// opaque thread pool, see threadpool.c
+typedef struct threadPool_s threadPool_t;
+
+// creates a pool of threads workers, the calling thread counts as one of them
+threadPool_t *poolCreate(uint32_t threads);
+
+// runs task on chunks 0 .. chunks - 1 and returns when all of them are done
+void poolRun(threadPool_t *pool, uint32_t chunks, poolTask_f task, void *ctx);
+
+// number of workers in the pool, 1 for a NULL pool
+uint32_t poolSize(threadPool_t *pool);
+
+// index of the worker running the calling task, 0 .. poolSize - 1, so a
+// task can keep per worker state. The thread calling poolRun is worker 0
+uint32_t poolWorker(void);
+
+// stops the threads and frees the pool
+void poolDestroy(threadPool_t *pool);
+
+#endif//_THREADPOOL_H_